@@ -0,0 +1,371 @@
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include "battlescene.hpp"
+#include "constants.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "parse.hpp"
+#include "stats.hpp"
+#include "vram.hpp"
+
+namespace qi = boost::spirit::qi;
+
+// Base color palette used for battle scenes.
+// Each value in the textures is actually an index to one of this array's cells.
+//
+
+static boost::uint8_t const g_primitivePalette[] = {
+
+      0,   8,  16,  24,
+     32,  40,  48,  56,
+     65,  73,  81,  89,
+    100, 108, 118, 125,
+    135, 143, 152, 162,
+    170, 178, 186, 194,
+    202, 210, 217, 225,
+    232, 240, 246, 255
+
+};
+
+static void parseTexturePacket( MemoryRange & range, boost::uint8_t & palX, boost::uint8_t & palY, boost::uint8_t & texX, boost::uint8_t & texY )
+{
+    // binary packet structure :
+    // aaaaaaaa aabbbbbb ???????? ccccdddd
+    //
+    // a : palyy
+    // b : palxx
+    //
+    // c : texture Y
+    // d : texture X
+
+    boost::uint32_t packet;
+    parse( range, qi::dword, packet );
+
+    palX = ( ( packet >> 16 ) & 0x3F ) * 16 * 2;
+    palY = ( ( packet >> 22 ) );
+    texX = ( packet >> 0 ) & 0xF;
+    texY = ( packet >> 4 ) & 0x1;
+}
+
+////////////
+// 4 bytes : ???
+// 2 bytes : object count
+// 2 bytes : ???
+// 2 bytes : texture count
+// 2 bytes : textures offset
+// 2 bytes : ???
+// 2 bytes : object offset
+
+BattleScene::BattleScene( MemoryRange range )
+    : m_range( range.begin( ), range.end( ) )
+{
+    STATS_TIMER( timer, "parse headers" );
+
+    boost::uint16_t objectCount, verticesOffset;
+
+    parse( range, qi::dword );
+    parse( range, qi::word, objectCount );
+    parse( range, qi::word );
+    parse( range, qi::word, this->m_textureCount );
+    parse( range, qi::word, this->m_texturesOffset );
+    parse( range, qi::word );
+    parse( range, qi::word, verticesOffset );
+    parse( range, qi::word );
+    parse( range, qi::word );
+    parse( range, qi::word );
+    parse( range, qi::word );
+
+    // The headers prepass computes where each object starts, in the file
+    // and in the OBJ indices ; it does not touch the objects data.
+
+    this->m_headers.resize( objectCount );
+
+    unsigned long objectVerticesOffset = verticesOffset;
+
+    for ( boost::uint16_t objectIndex = 0, verticesStart = 0, uvStart = 0; objectIndex < objectCount; ++ objectIndex ) {
+
+        ObjectHeader & header = this->m_headers[ objectIndex ];
+
+        header.headerOffset = range.current( ) - range.begin( );
+        header.verticesOffset = objectVerticesOffset;
+
+        parse( range, qi::word );
+        parse( range, qi::word, header.verticeCount );
+        parse( range, qi::word );
+        parse( range, qi::word, header.texidxOffset );
+        parse( range, qi::word, header.facesOffset );
+        parse( range, qi::word, header.texmapOffset );
+        parse( range, qi::word, header.rectangleCount );
+        parse( range, qi::word, header.triangleCount );
+
+        header.verticesStart = verticesStart;
+        header.uvStart = uvStart;
+
+        LOG( Verbose, " - Processing object #" << static_cast< int >( objectIndex ) );
+        LOG( Verbose, "   Vertice count   : " << static_cast< int >( header.verticeCount ) );
+        LOG( Verbose, "   Rectangle count : " << static_cast< int >( header.rectangleCount ) );
+        LOG( Verbose, "   Triangle count  : " << static_cast< int >( header.triangleCount ) );
+
+        objectVerticesOffset += header.verticeCount * 6;
+        verticesStart += header.verticeCount;
+        uvStart += header.rectangleCount * 4 + header.triangleCount * 3;
+
+    }
+}
+
+MemoryRange BattleScene::texturePacket( unsigned long textureIndex ) const
+{
+    MemoryRange range( this->m_range );
+    range.seek( MemoryRange::SeekSet, this->m_texturesOffset );
+    range.seek( MemoryRange::SeekCur, textureIndex * 4 );
+
+    return MemoryRange( range.current( ), range.current( ) + 4 );
+}
+
+std::vector< VRAMRect > BattleScene::textureRects( void ) const
+{
+    std::vector< VRAMRect > rects;
+
+    for ( unsigned long textureIndex = 0; textureIndex < this->m_textureCount; ++ textureIndex ) {
+
+        MemoryRange range = this->texturePacket( textureIndex );
+
+        boost::uint8_t palX, palY, texX, texY;
+        parseTexturePacket( range, palX, palY, texX, texY );
+
+        VRAMRect page = { texX * BATTLESCENE_CELL_WIDTH / 2u, texY * BATTLESCENE_CELL_HEIGHT * 1u, BATTLESCENE_TEXTURE_WIDTH / 2u, BATTLESCENE_TEXTURE_HEIGHT };
+        VRAMRect clut = { palX, palY, SIZE( BATTLESCENE_PALETTE ), 1 };
+
+        rects.push_back( page );
+        rects.push_back( clut );
+
+    }
+
+    return rects;
+}
+
+std::vector< boost::uint32_t > BattleScene::decodeTexture( VRAM const & vram, unsigned long textureIndex ) const
+{
+    MemoryRange range = this->texturePacket( textureIndex );
+
+    STATS_TIMER( timer, "decode texture" );
+
+    boost::uint8_t palX, palY, texX, texY;
+    parseTexturePacket( range, palX, palY, texX, texY );
+
+    // Palette generation
+
+    boost::uint32_t palette[ SIZE( BATTLESCENE_PALETTE ) ] = { };
+
+    for ( int u = 0; u < SIZE( BATTLESCENE_PALETTE ); ++ u ) {
+
+        boost::uint16_t colorIndex = vram[ palY * VRAM_WIDTH + palX + u ];
+
+        palette[ u ]
+            = ( g_primitivePalette[ ( colorIndex >>  0 ) & 0x1f ] << 16 )
+            | ( g_primitivePalette[ ( colorIndex >>  5 ) & 0x1f ] <<  8 )
+            | ( g_primitivePalette[ ( colorIndex >> 10 ) & 0x1f ] <<  0 )
+            ;
+
+        if ( ( colorIndex & 0x8000 ) == 0x8000 ) {
+            palette[ u ] |= 0xff000000;
+        }
+
+    }
+
+    // Image restitution
+
+    std::vector< boost::uint32_t > data( SIZE( BATTLESCENE_TEXTURE ) );
+
+    for ( boost::uint32_t y = 0; y < BATTLESCENE_TEXTURE_HEIGHT; ++ y ) {
+        for ( boost::uint32_t x = 0; x < BATTLESCENE_TEXTURE_WIDTH; ++ x ) {
+            boost::uint8_t const * binaryvram = reinterpret_cast< boost::uint8_t const * >( & vram );
+            boost::uint32_t absoluteX = texX * BATTLESCENE_CELL_WIDTH + x;
+            boost::uint32_t absoluteY = texY * BATTLESCENE_CELL_HEIGHT + y;
+            data[ y * BATTLESCENE_TEXTURE_WIDTH + x ] = palette[ binaryvram[ absoluteY * VRAM_WIDTH * 2 + absoluteX ] ];
+        }
+    }
+
+    return data;
+}
+
+BattleScene::Object BattleScene::decodeObject( unsigned long objectIndex ) const
+{
+    MemoryRange range( this->m_range );
+    ObjectHeader const & header = this->m_headers[ objectIndex ];
+
+    STATS_TIMER( timer, "decode geometry" );
+
+    Object object;
+
+    boost::uint16_t rectangleCount = header.rectangleCount;
+    boost::uint16_t triangleCount = header.triangleCount;
+
+    boost::uint32_t totalVerticeCount = rectangleCount * 4 + triangleCount * 3;
+
+    MemoryRange verticesRange( range );
+    verticesRange.seek( MemoryRange::SeekSet, header.verticesOffset );
+
+    object.vertices.resize( header.verticeCount );
+
+    for ( Vertex & vertex : object.vertices ) {
+        parse( verticesRange, qi::word, vertex.x );
+        parse( verticesRange, qi::word, vertex.y );
+        parse( verticesRange, qi::word, vertex.z );
+    }
+
+    MemoryRange texmapRange( range );
+    texmapRange.seek( MemoryRange::SeekSet, header.headerOffset );
+    texmapRange.seek( MemoryRange::SeekCur, header.texmapOffset );
+
+    object.texCoords.resize( totalVerticeCount );
+
+    for ( TexCoord & texCoord : object.texCoords ) {
+        parse( texmapRange, qi::byte_, texCoord.u );
+        parse( texmapRange, qi::byte_, texCoord.v );
+    }
+
+    MemoryRange facesRange( range );
+    facesRange.seek( MemoryRange::SeekSet, header.headerOffset );
+    facesRange.seek( MemoryRange::SeekCur, header.facesOffset );
+
+    MemoryRange texidxRange( range );
+    texidxRange.seek( MemoryRange::SeekSet, header.headerOffset );
+    texidxRange.seek( MemoryRange::SeekCur, header.texidxOffset );
+
+    for ( boost::uint16_t rectangleIndex = 0; rectangleIndex < rectangleCount; ++ rectangleIndex ) {
+
+        boost::uint32_t texidx;
+        parse( texidxRange, qi::dword, texidx );
+        texidx = ( texidx >> 24 ) & 0x1f;
+
+        boost::uint16_t v1, v2, v3, v4;
+        parse( facesRange, qi::word, v1 ); v1 /= 4;
+        parse( facesRange, qi::word, v2 ); v2 /= 4;
+        parse( facesRange, qi::word, v3 ); v3 /= 4;
+        parse( facesRange, qi::word, v4 ); v4 /= 4;
+
+        boost::uint16_t uv = rectangleIndex * 4;
+
+        Face first = { { v1, v2, v3 }, { uv, static_cast< boost::uint16_t >( uv + 1 ), static_cast< boost::uint16_t >( uv + 2 ) }, static_cast< boost::uint8_t >( texidx ) };
+        Face second = { { v4, v3, v2 }, { static_cast< boost::uint16_t >( uv + 3 ), static_cast< boost::uint16_t >( uv + 2 ), static_cast< boost::uint16_t >( uv + 1 ) }, static_cast< boost::uint8_t >( texidx ) };
+
+        object.faces.push_back( first );
+        object.faces.push_back( second );
+
+    }
+
+    for ( boost::uint16_t triangleIndex = 0; triangleIndex < triangleCount; ++ triangleIndex ) {
+
+        boost::uint32_t texidx;
+        parse( texidxRange, qi::dword, texidx );
+        texidx = ( texidx >> 24 ) & 0x1f;
+
+        boost::uint16_t v1, v2, v3;
+        parse( facesRange, qi::word, v1 ); v1 /= 4;
+        parse( facesRange, qi::word, v2 ); v2 /= 4;
+        parse( facesRange, qi::word, v3 ); v3 /= 4;
+
+        boost::uint16_t uv = rectangleCount * 4 + triangleIndex * 3;
+
+        Face face = { { v1, v2, v3 }, { uv, static_cast< boost::uint16_t >( uv + 1 ), static_cast< boost::uint16_t >( uv + 2 ) }, static_cast< boost::uint8_t >( texidx ) };
+
+        object.faces.push_back( face );
+
+    }
+
+    return object;
+}
+
+std::string BattleScene::serializeObject( unsigned long objectIndex ) const
+{
+    ObjectHeader const & header = this->m_headers[ objectIndex ];
+
+    return serializeObject( this->decodeObject( objectIndex ), header.verticesStart, header.uvStart );
+}
+
+std::string BattleScene::serializeObject( Object const & object, unsigned long verticesStart, unsigned long uvStart )
+{
+    STATS_TIMER( timer, "serialize geometry" );
+
+    std::ostringstream geometry;
+
+    for ( Vertex const & vertex : object.vertices ) {
+
+        double dx = + static_cast< double >( vertex.x ) / 100.0;
+        double dy = - static_cast< double >( vertex.y ) / 100.0;
+        double dz = + static_cast< double >( vertex.z ) / 100.0;
+
+        geometry << "v " << std::fixed << dx << " " << std::fixed << dy << " " << std::fixed << dz << std::endl;
+
+    }
+
+    for ( TexCoord const & texCoord : object.texCoords ) {
+
+        double dtx = 0.0 + static_cast< double >( texCoord.u ) / 255.0;
+        double dty = 1.0 - static_cast< double >( texCoord.v ) / 255.0;
+
+        geometry << "vt" << " " << std::fixed << dtx << " " << std::fixed << dty << std::endl;
+
+    }
+
+    boost::int16_t previousTexidx = - 1;
+
+    for ( Face const & face : object.faces ) {
+
+        if ( face.texture != previousTexidx ) {
+            geometry << "usemtl tex" << static_cast< int >( face.texture ) << std::endl;
+            previousTexidx = face.texture;
+        }
+
+        geometry << "f " << ( verticesStart + face.vertices[ 0 ] + 1 ) << "/" << ( uvStart + face.texCoords[ 0 ] + 1 )
+                 << " "  << ( verticesStart + face.vertices[ 1 ] + 1 ) << "/" << ( uvStart + face.texCoords[ 1 ] + 1 )
+                 << " "  << ( verticesStart + face.vertices[ 2 ] + 1 ) << "/" << ( uvStart + face.texCoords[ 2 ] + 1 )
+        << std::endl;
+
+    }
+
+    STATS_COUNT( "objects", 1 );
+
+    return geometry.str( );
+}
+
+std::string BattleScene::geometryHeader( void ) const
+{
+    return "mtllib materials.mtl\n";
+}
+
+std::string BattleScene::geometry( void ) const
+{
+    std::string geometry = this->geometryHeader( );
+
+    for ( unsigned long objectIndex = 0; objectIndex < this->m_headers.size( ); ++ objectIndex )
+        geometry += this->serializeObject( objectIndex );
+
+    return geometry;
+}
+
+std::string BattleScene::material( std::string const & textureExtension ) const
+{
+    std::ostringstream material;
+
+    for ( unsigned long textureIndex = 0; textureIndex < this->m_textureCount; ++ textureIndex ) {
+
+        material << "newmtl tex" << textureIndex << std::endl;
+        material << "Ka 1 1 1" << std::endl;
+        material << "Kd 1 1 1" << std::endl;
+        material << "Ks 0 0 0" << std::endl;
+        material << "d 1" << std::endl;
+        material << "illum 0" << std::endl;
+        material << "map_Kd " << std::setfill( '0' ) << std::setw( 3 ) << textureIndex << textureExtension << std::endl;
+
+    }
+
+    return material.str( );
+}
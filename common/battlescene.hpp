@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+#include "vram.hpp"
+
+// A battle scene (.ff9bs) : textured objects, and the texture packets
+// telling where their texture pages and palettes lie in the VRAM. The
+// headers are parsed on construction ; the textures and the objects are
+// decoded on demand, independently from each other (so they can be
+// processed in any order, on any thread). The scene range must outlive
+// the scene.
+
+class BattleScene
+{
+
+public:
+
+    // An object, as stored in the scene : its vertices, the texture
+    // coordinates of each face corner, and its faces, the rectangles being
+    // split into two triangles. The indices are relative to the object.
+
+    struct Vertex {
+        boost::int16_t x, y, z;
+    };
+
+    struct TexCoord {
+        boost::uint8_t u, v;
+    };
+
+    struct Face {
+        boost::uint16_t vertices[ 3 ];
+        boost::uint16_t texCoords[ 3 ];
+        boost::uint8_t texture;
+    };
+
+    struct Object {
+        std::vector< Vertex > vertices;
+        std::vector< TexCoord > texCoords;
+        std::vector< Face > faces;
+    };
+
+public:
+
+    BattleScene( MemoryRange range );
+
+public:
+
+    inline MemoryRange const & range( void ) const;
+
+    inline unsigned long textureCount( void ) const;
+
+    inline unsigned long objectCount( void ) const;
+
+public:
+
+    // The 4 bytes describing a texture, from which it is decoded.
+
+    MemoryRange texturePacket( unsigned long textureIndex ) const;
+
+    // The VRAM areas read by the textures : one rectangle for each texture
+    // page, and one for each palette.
+
+    std::vector< VRAMRect > textureRects( void ) const;
+
+    // BATTLESCENE_TEXTURE_WIDTH x BATTLESCENE_TEXTURE_HEIGHT ARGB pixels.
+
+    std::vector< boost::uint32_t > decodeTexture( VRAM const & vram, unsigned long textureIndex ) const;
+
+public:
+
+    Object decodeObject( unsigned long objectIndex ) const;
+
+public:
+
+    // The OBJ statements of a single object ; the OBJ file is the
+    // geometryHeader( ) followed by every object, in order.
+
+    std::string serializeObject( unsigned long objectIndex ) const;
+
+    // Same, for an object which has been decoded (and maybe modified) ;
+    // its indices are shifted by the number of vertices and texture
+    // coordinates written before it.
+
+    static std::string serializeObject( Object const & object, unsigned long verticesStart, unsigned long uvStart );
+
+    std::string geometryHeader( void ) const;
+
+    std::string geometry( void ) const;
+
+    // The MTL file, each texture being named "<texture index><extension>".
+
+    std::string material( std::string const & textureExtension ) const;
+
+private:
+
+    ////////////
+    // 2 bytes : timp
+    // 2 bytes : vertice count
+    // 2 bytes : ???
+    // 2 bytes : texidx offset
+    // 2 bytes : faces offset
+    // 2 bytes : texmap offset
+    // 2 bytes : rectangle count
+    // 2 bytes : triangle count
+    //
+    // Offsets are relative to the object header. The vertices are not part
+    // of the object data : they are stored one object after the other,
+    // starting at the scene vertices offset.
+
+    struct ObjectHeader {
+        unsigned long headerOffset;
+        unsigned long verticesOffset;
+        boost::uint16_t verticeCount;
+        boost::uint16_t texidxOffset;
+        boost::uint16_t facesOffset;
+        boost::uint16_t texmapOffset;
+        boost::uint16_t rectangleCount;
+        boost::uint16_t triangleCount;
+        boost::uint32_t verticesStart;
+        boost::uint32_t uvStart;
+    };
+
+private:
+
+    MemoryRange m_range;
+
+    boost::uint16_t m_textureCount;
+
+    boost::uint16_t m_texturesOffset;
+
+    std::vector< ObjectHeader > m_headers;
+
+};
+
+MemoryRange const & BattleScene::range( void ) const
+{
+    return this->m_range;
+}
+
+unsigned long BattleScene::textureCount( void ) const
+{
+    return this->m_textureCount;
+}
+
+unsigned long BattleScene::objectCount( void ) const
+{
+    return this->m_headers.size( );
+}
@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "bc.hpp"
+#include "threadpool.hpp"
+
+// The encoders below work on whole blocks at once, with the channels split
+// into plain arrays. This layout lets the compiler vectorize the inner loops
+// without having to rely on platform specific intrinsics.
+
+static boost::uint16_t packRgb565( int r, int g, int b )
+{
+    return ( ( r * 31 + 127 ) / 255 ) << 11 | ( ( g * 63 + 127 ) / 255 ) << 5 | ( ( b * 31 + 127 ) / 255 );
+}
+
+static void unpackRgb565( boost::uint16_t color, int & r, int & g, int & b )
+{
+    int r5 = ( color >> 11 ) & 0x1f, g6 = ( color >> 5 ) & 0x3f, b5 = color & 0x1f;
+
+    r = ( r5 << 3 ) | ( r5 >> 2 );
+    g = ( g6 << 2 ) | ( g6 >> 4 );
+    b = ( b5 << 3 ) | ( b5 >> 2 );
+}
+
+static void storeLittle( boost::uint8_t * output, boost::uint64_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t ) {
+        output[ t ] = ( value >> ( t * 8 ) ) & 0xff;
+    }
+}
+
+static void encodeColorBlock( boost::uint32_t const * pixels, boost::uint8_t * output )
+{
+    int r[ 16 ], g[ 16 ], b[ 16 ];
+
+    for ( int t = 0; t < 16; ++ t ) {
+        r[ t ] = ( pixels[ t ] >> 16 ) & 0xff;
+        g[ t ] = ( pixels[ t ] >>  8 ) & 0xff;
+        b[ t ] = ( pixels[ t ] >>  0 ) & 0xff;
+    }
+
+    int minR = 255, minG = 255, minB = 255;
+    int maxR = 0, maxG = 0, maxB = 0;
+
+    for ( int t = 0; t < 16; ++ t ) {
+        minR = std::min( minR, r[ t ] ); maxR = std::max( maxR, r[ t ] );
+        minG = std::min( minG, g[ t ] ); maxG = std::max( maxG, g[ t ] );
+        minB = std::min( minB, b[ t ] ); maxB = std::max( maxB, b[ t ] );
+    }
+
+    // Pick the bounding box diagonal which follows the colors distribution
+
+    int centerR = ( minR + maxR ) / 2, centerG = ( minG + maxG ) / 2, centerB = ( minB + maxB ) / 2;
+    int covarianceRG = 0, covarianceRB = 0, covarianceGB = 0;
+
+    for ( int t = 0; t < 16; ++ t ) {
+        covarianceRG += ( r[ t ] - centerR ) * ( g[ t ] - centerG );
+        covarianceRB += ( r[ t ] - centerR ) * ( b[ t ] - centerB );
+        covarianceGB += ( g[ t ] - centerG ) * ( b[ t ] - centerB );
+    }
+
+    if ( maxR == minR ? covarianceGB < 0 : covarianceRB < 0 )
+        std::swap( minB, maxB );
+
+    if ( maxR != minR && covarianceRG < 0 )
+        std::swap( minG, maxG );
+
+    // Inset the bounding box a bit, so the endpoints are not wasted on outliers
+
+    int insetR = ( maxR - minR ) >> 4, insetG = ( maxG - minG ) >> 4, insetB = ( maxB - minB ) >> 4;
+    minR += insetR; maxR -= insetR;
+    minG += insetG; maxG -= insetG;
+    minB += insetB; maxB -= insetB;
+
+    boost::uint16_t color0 = packRgb565( maxR, maxG, maxB );
+    boost::uint16_t color1 = packRgb565( minR, minG, minB );
+
+    // color0 > color1 selects the four colors mode
+
+    if ( color0 < color1 )
+        std::swap( color0, color1 );
+
+    boost::uint32_t indices = 0;
+
+    if ( color0 != color1 ) {
+
+        int paletteR[ 4 ], paletteG[ 4 ], paletteB[ 4 ];
+        unpackRgb565( color0, paletteR[ 0 ], paletteG[ 0 ], paletteB[ 0 ] );
+        unpackRgb565( color1, paletteR[ 1 ], paletteG[ 1 ], paletteB[ 1 ] );
+
+        paletteR[ 2 ] = ( 2 * paletteR[ 0 ] + paletteR[ 1 ] ) / 3; paletteR[ 3 ] = ( paletteR[ 0 ] + 2 * paletteR[ 1 ] ) / 3;
+        paletteG[ 2 ] = ( 2 * paletteG[ 0 ] + paletteG[ 1 ] ) / 3; paletteG[ 3 ] = ( paletteG[ 0 ] + 2 * paletteG[ 1 ] ) / 3;
+        paletteB[ 2 ] = ( 2 * paletteB[ 0 ] + paletteB[ 1 ] ) / 3; paletteB[ 3 ] = ( paletteB[ 0 ] + 2 * paletteB[ 1 ] ) / 3;
+
+        int best[ 16 ], bestDistance[ 16 ];
+
+        for ( int t = 0; t < 16; ++ t ) {
+            best[ t ] = 0;
+            bestDistance[ t ] = 0x7fffffff;
+        }
+
+        for ( int p = 0; p < 4; ++ p ) {
+            for ( int t = 0; t < 16; ++ t ) {
+                int dr = r[ t ] - paletteR[ p ], dg = g[ t ] - paletteG[ p ], db = b[ t ] - paletteB[ p ];
+                int distance = dr * dr + dg * dg + db * db;
+                best[ t ] = distance < bestDistance[ t ] ? p : best[ t ];
+                bestDistance[ t ] = std::min( distance, bestDistance[ t ] );
+            }
+        }
+
+        for ( int t = 0; t < 16; ++ t ) {
+            indices |= static_cast< boost::uint32_t >( best[ t ] ) << ( t * 2 );
+        }
+
+    }
+
+    storeLittle( output + 0, color0, 2 );
+    storeLittle( output + 2, color1, 2 );
+    storeLittle( output + 4, indices, 4 );
+}
+
+static void encodeAlphaBlock( boost::uint32_t const * pixels, boost::uint8_t * output )
+{
+    int a[ 16 ];
+
+    for ( int t = 0; t < 16; ++ t ) {
+        a[ t ] = ( pixels[ t ] >> 24 ) & 0xff;
+    }
+
+    int minA = 255, maxA = 0;
+
+    for ( int t = 0; t < 16; ++ t ) {
+        minA = std::min( minA, a[ t ] );
+        maxA = std::max( maxA, a[ t ] );
+    }
+
+    boost::uint64_t indices = 0;
+
+    if ( minA != maxA ) {
+
+        // alpha0 > alpha1 selects the eight alphas mode
+
+        int palette[ 8 ] = { maxA, minA };
+        for ( int p = 1; p < 7; ++ p )
+            palette[ p + 1 ] = ( ( 7 - p ) * maxA + p * minA ) / 7;
+
+        int best[ 16 ], bestDistance[ 16 ];
+
+        for ( int t = 0; t < 16; ++ t ) {
+            best[ t ] = 0;
+            bestDistance[ t ] = 0x7fffffff;
+        }
+
+        for ( int p = 0; p < 8; ++ p ) {
+            for ( int t = 0; t < 16; ++ t ) {
+                int distance = std::abs( a[ t ] - palette[ p ] );
+                best[ t ] = distance < bestDistance[ t ] ? p : best[ t ];
+                bestDistance[ t ] = std::min( distance, bestDistance[ t ] );
+            }
+        }
+
+        for ( int t = 0; t < 16; ++ t ) {
+            indices |= static_cast< boost::uint64_t >( best[ t ] ) << ( t * 3 );
+        }
+
+    }
+
+    output[ 0 ] = maxA;
+    output[ 1 ] = minA;
+    storeLittle( output + 2, indices, 6 );
+}
+
+void encodeBC1Block( boost::uint32_t const * pixels, boost::uint8_t * output )
+{
+    encodeColorBlock( pixels, output );
+}
+
+void encodeBC3Block( boost::uint32_t const * pixels, boost::uint8_t * output )
+{
+    encodeAlphaBlock( pixels, output );
+    encodeColorBlock( pixels, output + 8 );
+}
+
+BlockFormat selectBlockFormat( std::vector< boost::uint32_t > const & data )
+{
+    for ( boost::uint32_t color : data )
+        if ( ( color ^ data[ 0 ] ) & 0xff000000 )
+            return BlockFormatBC3;
+
+    return BlockFormatBC1;
+}
+
+std::vector< MipLevel > buildMipChain( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data )
+{
+    std::vector< MipLevel > chain( 1 );
+    chain[ 0 ].width = width;
+    chain[ 0 ].height = height;
+    chain[ 0 ].data = data;
+
+    while ( chain.back( ).width > 1 || chain.back( ).height > 1 ) {
+
+        MipLevel const & source = chain.back( );
+
+        MipLevel level;
+        level.width = std::max( 1, source.width / 2 );
+        level.height = std::max( 1, source.height / 2 );
+        level.data.resize( level.width * level.height );
+
+        for ( boost::uint32_t y = 0; y < level.height; ++ y ) {
+            for ( boost::uint32_t x = 0; x < level.width; ++ x ) {
+
+                boost::uint32_t x0 = std::min< boost::uint32_t >( x * 2, source.width - 1 ), x1 = std::min< boost::uint32_t >( x * 2 + 1, source.width - 1 );
+                boost::uint32_t y0 = std::min< boost::uint32_t >( y * 2, source.height - 1 ), y1 = std::min< boost::uint32_t >( y * 2 + 1, source.height - 1 );
+
+                boost::uint32_t samples[ 4 ] = {
+                    source.data[ y0 * source.width + x0 ], source.data[ y0 * source.width + x1 ],
+                    source.data[ y1 * source.width + x0 ], source.data[ y1 * source.width + x1 ]
+                };
+
+                boost::uint32_t color = 0;
+
+                for ( int shift = 0; shift < 32; shift += 8 ) {
+                    boost::uint32_t sum = 2;
+                    for ( int s = 0; s < 4; ++ s )
+                        sum += ( samples[ s ] >> shift ) & 0xff;
+                    color |= ( sum / 4 ) << shift;
+                }
+
+                level.data[ y * level.width + x ] = color;
+
+            }
+        }
+
+        chain.push_back( level );
+
+    }
+
+    return chain;
+}
+
+std::vector< boost::uint8_t > encodeBlocks( BlockFormat format, MipLevel const & level, ThreadPool & pool )
+{
+    unsigned int blockSize = format == BlockFormatBC1 ? 8 : 16;
+    unsigned int blocksAcross = ( level.width + 3 ) / 4;
+    unsigned int blocksDown = ( level.height + 3 ) / 4;
+
+    std::vector< boost::uint8_t > output( blocksAcross * blocksDown * blockSize );
+
+    pool.parallelFor( blocksDown, [ & ] ( unsigned long blockY ) {
+
+        for ( unsigned int blockX = 0; blockX < blocksAcross; ++ blockX ) {
+
+            // Levels smaller than a block repeat their edge pixels
+
+            boost::uint32_t pixels[ 16 ];
+
+            for ( unsigned int y = 0; y < 4; ++ y ) {
+                for ( unsigned int x = 0; x < 4; ++ x ) {
+                    unsigned int sx = std::min< unsigned int >( blockX * 4 + x, level.width - 1 );
+                    unsigned int sy = std::min< unsigned int >( blockY * 4 + y, level.height - 1 );
+                    pixels[ y * 4 + x ] = level.data[ sy * level.width + sx ];
+                }
+            }
+
+            boost::uint8_t * block = & output[ ( blockY * blocksAcross + blockX ) * blockSize ];
+
+            if ( format == BlockFormatBC1 ) {
+                encodeBC1Block( pixels, block );
+            } else {
+                encodeBC3Block( pixels, block );
+            }
+
+        }
+
+    } );
+
+    return output;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "threadpool.hpp"
+
+// Block compression of 32 bits ARGB images (0xAARRGGBB, as produced by the
+// texture decoders). Each 4x4 block is encoded independently.
+
+enum BlockFormat {
+    BlockFormatBC1,
+    BlockFormatBC3
+};
+
+// A single mip level, stored as ARGB pixels.
+
+struct MipLevel {
+    boost::uint16_t width;
+    boost::uint16_t height;
+    std::vector< boost::uint32_t > data;
+};
+
+// BC1 is enough when every pixel shares the same alpha value : the alpha
+// channel then carries no information. Otherwise BC3 keeps it.
+
+BlockFormat selectBlockFormat( std::vector< boost::uint32_t > const & data );
+
+std::vector< MipLevel > buildMipChain( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data );
+
+std::vector< boost::uint8_t > encodeBlocks( BlockFormat format, MipLevel const & level, ThreadPool & pool );
+
+void encodeBC1Block( boost::uint32_t const * pixels, boost::uint8_t * output );
+
+void encodeBC3Block( boost::uint32_t const * pixels, boost::uint8_t * output );
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include <boost/cstdint.hpp>
+
+#include "bundle.hpp"
+#include "packedfile.hpp"
+#include "path.hpp"
+#include "stats.hpp"
+
+#define TAR_BLOCK_LENGTH 512
+
+static void storeLittle( char * output, boost::uint64_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t ) {
+        output[ t ] = ( value >> ( t * 8 ) ) & 0xff;
+    }
+}
+
+// The field ends with a null byte, so length - 1 digits are available.
+
+static void storeOctal( char * output, boost::uint64_t value, int length )
+{
+    if ( ( value >> ( 3 * ( length - 1 ) ) ) != 0 )
+        throw std::runtime_error( "Value too large for a TAR header field (files are limited to 8GB)." );
+
+    char digits[ 24 ];
+    std::snprintf( digits, sizeof( digits ), "%0*llo", length - 1, static_cast< unsigned long long >( value ) );
+
+    std::memcpy( output, digits, length );
+}
+
+Bundle::Bundle( Format format, std::string const & path, std::string const & root )
+    : m_format( format )
+    , m_root( root )
+    , m_packSize( 0 )
+{
+    Path( path ).open( this->m_output );
+
+    std::time_t now = std::time( nullptr );
+    std::tm local = * std::localtime( & now );
+
+    this->m_unixTime = now;
+    this->m_dosTime = ( local.tm_year - 80 ) << 25 | ( local.tm_mon + 1 ) << 21 | local.tm_mday << 16 | local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2;
+}
+
+Bundle::~Bundle( void )
+{
+    if ( this->m_output.is_open( ) ) {
+        try {
+            this->close( );
+        } catch ( ... ) {
+        }
+    }
+}
+
+Bundle::Format Bundle::format( std::string const & name )
+{
+    if ( name == "zip" )
+        return Zip;
+
+    if ( name == "tar" )
+        return Tar;
+
+    if ( name == "ff9pack" )
+        return Pack;
+
+    throw std::runtime_error( "Invalid bundle format (zip, tar or ff9pack expected)." );
+}
+
+////////////
+// ZIP local file header (30 bytes + name), the sizes and CRC being set
+// once the file is complete :
+//
+// 4 bytes : magic 0x04034B50
+// 2 bytes : version needed (2.0)
+// 2 bytes : flags
+// 2 bytes : method (0 = stored)
+// 4 bytes : DOS time
+// 4 bytes : CRC32
+// 4 bytes : compressed size
+// 4 bytes : uncompressed size
+// 2 bytes : name length
+// 2 bytes : extra field length
+//
+// TAR (ustar) header : one 512 bytes block, with octal text fields.
+
+void Bundle::writeHeader( File const & file )
+{
+    if ( this->m_format == Zip ) {
+
+        if ( file.size > 0xFFFFFFFFUL || file.headerOffset > 0xFFFFFFFFUL )
+            throw std::runtime_error( "Archive too large for the ZIP format (use --bundle tar)." );
+
+        char header[ 30 ] = { };
+
+        storeLittle( header +  0, 0x04034B50, 4 );
+        storeLittle( header +  4, 20, 2 );
+        storeLittle( header + 10, this->m_dosTime, 4 );
+        storeLittle( header + 14, file.crc, 4 );
+        storeLittle( header + 18, file.size, 4 );
+        storeLittle( header + 22, file.size, 4 );
+        storeLittle( header + 26, file.name.size( ), 2 );
+
+        this->m_output.write( header, sizeof( header ) );
+        this->m_output.write( file.name.data( ), file.name.size( ) );
+
+    } else {
+
+        char header[ TAR_BLOCK_LENGTH ] = { };
+
+        // Names longer than 100 characters are split on a slash, between
+        // the prefix and the name fields
+
+        std::string prefix, name = file.name;
+
+        if ( name.size( ) > 100 ) {
+            std::string::size_type separator = name.find( '/', name.size( ) - 101 );
+            if ( separator == std::string::npos || separator > 155 )
+                throw std::runtime_error( "Path too long for the TAR format : " + name );
+            prefix = name.substr( 0, separator );
+            name = name.substr( separator + 1 );
+        }
+
+        std::copy( name.begin( ), name.end( ), header );
+        storeOctal( header + 100, 0644, 8 );
+        storeOctal( header + 108, 0, 8 );
+        storeOctal( header + 116, 0, 8 );
+        storeOctal( header + 124, file.size, 12 );
+        storeOctal( header + 136, this->m_unixTime, 12 );
+        std::fill( header + 148, header + 156, ' ' );
+        header[ 156 ] = '0';
+        std::memcpy( header + 257, "ustar\0" "00", 8 );
+        std::copy( prefix.begin( ), prefix.end( ), header + 345 );
+
+        unsigned int checksum = 0;
+        for ( int t = 0; t < TAR_BLOCK_LENGTH; ++ t )
+            checksum += static_cast< unsigned char >( header[ t ] );
+
+        storeOctal( header + 148, checksum, 7 );
+
+        this->m_output.write( header, sizeof( header ) );
+
+    }
+}
+
+void Bundle::add( std::string const & path, char const * data, unsigned long size )
+{
+    this->begin( path );
+
+    // Releases the archive if the write throws ; end() releases it
+    // otherwise
+
+    std::unique_lock< std::mutex > lock( this->m_mutex, std::adopt_lock );
+    this->write( data, size );
+    lock.release( );
+
+    this->end( );
+}
+
+void Bundle::begin( std::string const & path )
+{
+    // The archive stays locked until end(), unless this throws
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    std::string name = path;
+    if ( name.compare( 0, this->m_root.size( ), this->m_root ) == 0 && name.size( ) > this->m_root.size( ) && name[ this->m_root.size( ) ] == '/' )
+        name = name.substr( this->m_root.size( ) + 1 );
+
+    // Pack files have no header : they are located by their offset in the
+    // uncompressed stream
+
+    this->m_current.name = name;
+    this->m_current.headerOffset = this->m_format == Pack ? this->m_packSize : static_cast< boost::uint64_t >( this->m_output.tellp( ) );
+    this->m_current.size = 0;
+    this->m_current.crc = crc32( 0, Z_NULL, 0 );
+
+    if ( this->m_format != Pack ) {
+        this->writeHeader( this->m_current );
+    }
+
+    lock.release( );
+}
+
+void Bundle::write( char const * data, unsigned long size )
+{
+    STATS_TIMER( timer, "write" );
+
+    // zlib takes 32 bits lengths
+
+    for ( unsigned long offset = 0; offset < size; ) {
+        unsigned long count = std::min( size - offset, 0x40000000UL );
+        this->m_current.crc = crc32( this->m_current.crc, reinterpret_cast< Bytef const * >( data + offset ), count );
+        offset += count;
+    }
+
+    if ( this->m_format == Pack ) {
+
+        for ( unsigned long offset = 0; offset < size; ) {
+
+            unsigned long count = std::min( size - offset, PACKEDFILE_BLOCK_LENGTH - this->m_block.size( ) );
+            this->m_block.insert( this->m_block.end( ), data + offset, data + offset + count );
+            offset += count;
+
+            if ( this->m_block.size( ) == PACKEDFILE_BLOCK_LENGTH ) {
+                this->writeBlock( );
+            }
+
+        }
+
+        this->m_packSize += size;
+
+    } else {
+
+        this->m_output.write( data, size );
+
+    }
+
+    this->m_current.size += size;
+
+    STATS_BYTES( timer, size );
+}
+
+void Bundle::end( void )
+{
+    std::unique_lock< std::mutex > lock( this->m_mutex, std::adopt_lock );
+
+    // The header is written again, now that the size and CRC are known
+
+    if ( this->m_format != Pack ) {
+
+        std::ofstream::pos_type end = this->m_output.tellp( );
+
+        this->m_output.seekp( this->m_current.headerOffset );
+        this->writeHeader( this->m_current );
+        this->m_output.seekp( end );
+
+    }
+
+    if ( this->m_format == Tar && this->m_current.size % TAR_BLOCK_LENGTH ) {
+        char padding[ TAR_BLOCK_LENGTH ] = { };
+        this->m_output.write( padding, TAR_BLOCK_LENGTH - this->m_current.size % TAR_BLOCK_LENGTH );
+    }
+
+    this->m_files.push_back( this->m_current );
+
+    STATS_COUNT( "files written", 1 );
+}
+
+// Deflates the pending bytes of the stream into the next block. The blocks
+// are independent, so that reading a file only inflates the blocks it
+// spans.
+
+void Bundle::writeBlock( void )
+{
+    STATS_TIMER( timer, "compress" );
+
+    uLongf compressedLength = compressBound( this->m_block.size( ) );
+    std::vector< Bytef > compressed( compressedLength );
+
+    if ( compress2( compressed.data( ), & compressedLength, this->m_block.data( ), this->m_block.size( ), Z_DEFAULT_COMPRESSION ) != Z_OK )
+        throw std::runtime_error( "Block compression failed." );
+
+    this->m_blockOffsets.push_back( this->m_output.tellp( ) );
+
+    // The blocks which deflate cannot shrink are stored as is ; their
+    // length tells them apart
+
+    if ( compressedLength < this->m_block.size( ) ) {
+        this->m_output.write( reinterpret_cast< char const * >( compressed.data( ) ), compressedLength );
+    } else {
+        this->m_output.write( reinterpret_cast< char const * >( this->m_block.data( ) ), this->m_block.size( ) );
+    }
+
+    STATS_BYTES( timer, this->m_block.size( ) );
+    STATS_COUNT( "compressed bytes", std::min< unsigned long >( compressedLength, this->m_block.size( ) ) );
+
+    this->m_block.clear( );
+}
+
+////////////
+// ZIP central directory : one 46 bytes record (+ name) for each file, then
+// the 22 bytes end of central directory record.
+//
+// TAR : two empty blocks.
+//
+// Pack : the index and the trailer described in packedfile.cpp.
+
+void Bundle::close( void )
+{
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    if ( this->m_format == Zip ) {
+
+        if ( this->m_files.size( ) > 0xFFFF )
+            throw std::runtime_error( "Too many files for the ZIP format (use --bundle tar)." );
+
+        boost::uint64_t directoryOffset = this->m_output.tellp( );
+
+        for ( File const & file : this->m_files ) {
+
+            char record[ 46 ] = { };
+
+            storeLittle( record +  0, 0x02014B50, 4 );
+            storeLittle( record +  4, 3 << 8 | 20, 2 );                            // made by Unix, 2.0
+            storeLittle( record +  6, 20, 2 );
+            storeLittle( record + 12, this->m_dosTime, 4 );
+            storeLittle( record + 16, file.crc, 4 );
+            storeLittle( record + 20, file.size, 4 );
+            storeLittle( record + 24, file.size, 4 );
+            storeLittle( record + 28, file.name.size( ), 2 );
+            storeLittle( record + 38, 0100644UL << 16, 4 );                        // regular file, rw-r--r--
+            storeLittle( record + 42, file.headerOffset, 4 );
+
+            this->m_output.write( record, sizeof( record ) );
+            this->m_output.write( file.name.data( ), file.name.size( ) );
+
+        }
+
+        boost::uint64_t directorySize = static_cast< boost::uint64_t >( this->m_output.tellp( ) ) - directoryOffset;
+
+        if ( directoryOffset > 0xFFFFFFFFUL )
+            throw std::runtime_error( "Archive too large for the ZIP format (use --bundle tar)." );
+
+        char end[ 22 ] = { };
+
+        storeLittle( end +  0, 0x06054B50, 4 );
+        storeLittle( end +  8, this->m_files.size( ), 2 );
+        storeLittle( end + 10, this->m_files.size( ), 2 );
+        storeLittle( end + 12, directorySize, 4 );
+        storeLittle( end + 16, directoryOffset, 4 );
+
+        this->m_output.write( end, sizeof( end ) );
+
+    } else if ( this->m_format == Tar ) {
+
+        char blocks[ TAR_BLOCK_LENGTH * 2 ] = { };
+        this->m_output.write( blocks, sizeof( blocks ) );
+
+    } else {
+
+        if ( ! this->m_block.empty( ) )
+            this->writeBlock( );
+
+        boost::uint64_t indexOffset = this->m_output.tellp( );
+        this->m_blockOffsets.push_back( indexOffset );
+
+        for ( boost::uint64_t blockOffset : this->m_blockOffsets ) {
+            char field[ 8 ];
+            storeLittle( field, blockOffset, 8 );
+            this->m_output.write( field, sizeof( field ) );
+        }
+
+        for ( File const & file : this->m_files ) {
+
+            if ( file.name.size( ) > 0xFFFF )
+                throw std::runtime_error( "Path too long for the pack format : " + file.name );
+
+            char record[ 22 ] = { };
+
+            storeLittle( record +  0, file.headerOffset, 8 );
+            storeLittle( record +  8, file.size, 8 );
+            storeLittle( record + 16, file.crc, 4 );
+            storeLittle( record + 20, file.name.size( ), 2 );
+
+            this->m_output.write( record, sizeof( record ) );
+            this->m_output.write( file.name.data( ), file.name.size( ) );
+
+        }
+
+        char trailer[ PACKEDFILE_TRAILER_LENGTH ] = { };
+
+        storeLittle( trailer +  0, indexOffset, 8 );
+        storeLittle( trailer +  8, this->m_packSize, 8 );
+        storeLittle( trailer + 16, PACKEDFILE_BLOCK_LENGTH, 4 );
+        storeLittle( trailer + 20, this->m_blockOffsets.size( ) - 1, 4 );
+        storeLittle( trailer + 24, this->m_files.size( ), 4 );
+        storeLittle( trailer + 28, PACKEDFILE_MAGIC, 4 );
+
+        this->m_output.write( trailer, sizeof( trailer ) );
+
+    }
+
+    this->m_output.close( );
+}
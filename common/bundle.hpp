@@ -0,0 +1,107 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+// Archive receiving the output files instead of the filesystem (--bundle).
+// The files are stored uncompressed, their CRC being computed while they
+// are written ; nothing is read back.
+//
+// The Pack format (.ff9pack) compresses the files instead, as a single
+// stream cut into independently deflated blocks, and lists them in an index
+// at the end of the archive. It is read back by PackedFile, which inflates
+// only the blocks it is asked for.
+//
+// Only one file can be written at a time : add() and begin() wait for the
+// file being written by another thread to be done.
+
+class Bundle
+{
+
+public:
+
+    enum Format {
+        Zip,
+        Tar,
+        Pack
+    };
+
+public:
+
+    // The files are named after their path relative to root.
+
+    Bundle( Format format, std::string const & path, std::string const & root );
+
+    ~Bundle( void );
+
+public:
+
+    // Parses a --bundle value (zip, tar or ff9pack), which is also the
+    // extension of the archive.
+
+    static Format format( std::string const & name );
+
+public:
+
+    void add( std::string const & path, char const * data, unsigned long size );
+
+public:
+
+    // Streamed files : the archive stays locked from begin() to end().
+
+    void begin( std::string const & path );
+
+    void write( char const * data, unsigned long size );
+
+    void end( void );
+
+public:
+
+    // Writes the archive index ; the archive cannot be written afterward.
+
+    void close( void );
+
+private:
+
+    struct File {
+        std::string name;
+        boost::uint64_t headerOffset;
+        boost::uint64_t size;
+        boost::uint32_t crc;
+    };
+
+private:
+
+    void writeHeader( File const & file );
+
+    void writeBlock( void );
+
+private:
+
+    Format m_format;
+
+    std::string m_root;
+
+    std::ofstream m_output;
+
+    std::vector< File > m_files;
+
+    std::vector< boost::uint8_t > m_block;
+
+    std::vector< boost::uint64_t > m_blockOffsets;
+
+    boost::uint64_t m_packSize;
+
+    File m_current;
+
+    boost::uint32_t m_dosTime;
+
+    boost::uint64_t m_unixTime;
+
+    std::mutex m_mutex;
+
+};
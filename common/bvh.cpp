@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "bvh.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+
+#define BVH_HEADER_LENGTH 16
+
+#define BVH_NODES_ALIGNMENT 64
+
+// Subtrees with more triangles than this have their children built on two
+// tasks ; the smaller ones are not worth it.
+
+#define BVH_PARALLEL_THRESHOLD 4096
+
+struct Bounds {
+
+    float min[ 3 ];
+    float max[ 3 ];
+
+    static Bounds empty( void )
+    {
+        Bounds bounds;
+
+        for ( int t = 0; t < 3; ++ t ) {
+            bounds.min[ t ] = std::numeric_limits< float >::max( );
+            bounds.max[ t ] = - std::numeric_limits< float >::max( );
+        }
+
+        return bounds;
+    }
+
+    void grow( Bounds const & other )
+    {
+        for ( int t = 0; t < 3; ++ t ) {
+            this->min[ t ] = std::min( this->min[ t ], other.min[ t ] );
+            this->max[ t ] = std::max( this->max[ t ], other.max[ t ] );
+        }
+    }
+
+    float area( void ) const
+    {
+        float x = this->max[ 0 ] - this->min[ 0 ], y = this->max[ 1 ] - this->min[ 1 ], z = this->max[ 2 ] - this->min[ 2 ];
+
+        return x < 0 ? 0 : 2 * ( x * y + y * z + z * x );
+    }
+
+};
+
+struct Primitive {
+    Bounds bounds;
+    float centroid[ 3 ];
+};
+
+struct BuildNode {
+    Bounds bounds;
+    unsigned long first;
+    unsigned long count;
+    std::unique_ptr< BuildNode > children[ 2 ];
+};
+
+static int binOf( Primitive const & primitive, int axis, float minimum, float extent )
+{
+    int bin = static_cast< int >( ( primitive.centroid[ axis ] - minimum ) / extent * BVH_BIN_COUNT );
+
+    return std::min( std::max( bin, 0 ), BVH_BIN_COUNT - 1 );
+}
+
+// Splits the references [first, first + count) on the cheapest plane of
+// the bins, unless making a leaf of them costs less (the traversal step
+// and the intersection test being given the same cost).
+
+static std::unique_ptr< BuildNode > build( std::vector< Primitive > const & primitives, std::vector< boost::uint32_t > & references, unsigned long first, unsigned long count, ThreadPool & pool )
+{
+    std::unique_ptr< BuildNode > node( new BuildNode( ) );
+
+    node->bounds = Bounds::empty( );
+    node->first = first;
+    node->count = count;
+
+    Bounds centroids = Bounds::empty( );
+
+    for ( unsigned long t = first; t < first + count; ++ t ) {
+        Primitive const & primitive = primitives[ references[ t ] ];
+        Bounds point = { { primitive.centroid[ 0 ], primitive.centroid[ 1 ], primitive.centroid[ 2 ] }, { primitive.centroid[ 0 ], primitive.centroid[ 1 ], primitive.centroid[ 2 ] } };
+        node->bounds.grow( primitive.bounds );
+        centroids.grow( point );
+    }
+
+    if ( count <= 1 )
+        return node;
+
+    int bestAxis = - 1, bestSplit = 0;
+    float bestCost = std::numeric_limits< float >::max( );
+
+    for ( int axis = 0; axis < 3; ++ axis ) {
+
+        float extent = centroids.max[ axis ] - centroids.min[ axis ];
+
+        if ( extent <= 0 )
+            continue ;
+
+        Bounds binBounds[ BVH_BIN_COUNT ];
+        unsigned long binCounts[ BVH_BIN_COUNT ] = { };
+
+        for ( int bin = 0; bin < BVH_BIN_COUNT; ++ bin )
+            binBounds[ bin ] = Bounds::empty( );
+
+        for ( unsigned long t = first; t < first + count; ++ t ) {
+            Primitive const & primitive = primitives[ references[ t ] ];
+            int bin = binOf( primitive, axis, centroids.min[ axis ], extent );
+            binBounds[ bin ].grow( primitive.bounds );
+            binCounts[ bin ] += 1;
+        }
+
+        // The cost of the split after each bin, from the areas swept from
+        // both ends
+
+        float rightCosts[ BVH_BIN_COUNT ];
+        Bounds right = Bounds::empty( );
+        unsigned long rightCount = 0;
+
+        for ( int bin = BVH_BIN_COUNT - 1; bin > 0; -- bin ) {
+            right.grow( binBounds[ bin ] );
+            rightCount += binCounts[ bin ];
+            rightCosts[ bin - 1 ] = right.area( ) * rightCount;
+        }
+
+        Bounds left = Bounds::empty( );
+        unsigned long leftCount = 0;
+
+        for ( int bin = 0; bin < BVH_BIN_COUNT - 1; ++ bin ) {
+
+            left.grow( binBounds[ bin ] );
+            leftCount += binCounts[ bin ];
+
+            float cost = left.area( ) * leftCount + rightCosts[ bin ];
+
+            if ( leftCount > 0 && leftCount < count && cost < bestCost ) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = bin;
+            }
+
+        }
+
+    }
+
+    float area = node->bounds.area( );
+    float splitCost = area > 0 ? 1 + bestCost / area : 1 + count;
+
+    if ( bestAxis < 0 || splitCost >= count ) {
+        if ( count <= BVH_MAX_LEAF_SIZE ) {
+            return node;
+        }
+    }
+
+    unsigned long middle;
+
+    if ( bestAxis >= 0 ) {
+
+        float extent = centroids.max[ bestAxis ] - centroids.min[ bestAxis ];
+
+        middle = std::partition( references.begin( ) + first, references.begin( ) + first + count, [ & ] ( boost::uint32_t reference ) {
+            return binOf( primitives[ reference ], bestAxis, centroids.min[ bestAxis ], extent ) <= bestSplit;
+        } ) - references.begin( );
+
+    } else {
+
+        // Every centroid is at the same place : any split will do
+
+        middle = first + count / 2;
+
+    }
+
+    unsigned long counts[ 2 ] = { middle - first, first + count - middle };
+    unsigned long firsts[ 2 ] = { first, middle };
+
+    if ( count > BVH_PARALLEL_THRESHOLD ) {
+        pool.parallelFor( 2, [ & ] ( unsigned long child ) {
+            node->children[ child ] = build( primitives, references, firsts[ child ], counts[ child ], pool );
+        } );
+    } else {
+        for ( int child = 0; child < 2; ++ child ) {
+            node->children[ child ] = build( primitives, references, firsts[ child ], counts[ child ], pool );
+        }
+    }
+
+    return node;
+}
+
+static void flatten( BuildNode const & node, std::vector< BVHNode > & nodes )
+{
+    unsigned long index = nodes.size( );
+
+    BVHNode flat;
+
+    std::copy( node.bounds.min, node.bounds.min + 3, flat.min );
+    std::copy( node.bounds.max, node.bounds.max + 3, flat.max );
+    flat.offset = node.first;
+    flat.count = node.count;
+
+    nodes.push_back( flat );
+
+    if ( node.children[ 0 ] ) {
+        flatten( * node.children[ 0 ], nodes );
+        nodes[ index ].offset = nodes.size( );
+        nodes[ index ].count = 0;
+        flatten( * node.children[ 1 ], nodes );
+    }
+}
+
+BVH buildBVH( std::vector< float > const & triangles, ThreadPool & pool )
+{
+    STATS_TIMER( timer, "build bvh" );
+
+    BVH bvh;
+
+    unsigned long triangleCount = triangles.size( ) / 9;
+
+    std::vector< Primitive > primitives( triangleCount );
+
+    for ( unsigned long triangle = 0; triangle < triangleCount; ++ triangle ) {
+
+        Primitive & primitive = primitives[ triangle ];
+        primitive.bounds = Bounds::empty( );
+
+        for ( int corner = 0; corner < 3; ++ corner ) {
+            float const * point = & triangles[ triangle * 9 + corner * 3 ];
+            Bounds bounds = { { point[ 0 ], point[ 1 ], point[ 2 ] }, { point[ 0 ], point[ 1 ], point[ 2 ] } };
+            primitive.bounds.grow( bounds );
+        }
+
+        for ( int t = 0; t < 3; ++ t )
+            primitive.centroid[ t ] = ( primitive.bounds.min[ t ] + primitive.bounds.max[ t ] ) / 2;
+
+    }
+
+    if ( triangleCount == 0 )
+        return bvh;
+
+    bvh.references.resize( triangleCount );
+
+    for ( unsigned long triangle = 0; triangle < triangleCount; ++ triangle )
+        bvh.references[ triangle ] = triangle;
+
+    std::unique_ptr< BuildNode > root = build( primitives, bvh.references, 0, triangleCount, pool );
+
+    flatten( * root, bvh.nodes );
+
+    STATS_COUNT( "bvh nodes", bvh.nodes.size( ) );
+
+    return bvh;
+}
+
+std::vector< BVH > buildSceneBVHs( std::vector< BattleScene::Object > const & objects, ThreadPool & pool )
+{
+    std::vector< std::vector< float > > triangles( objects.size( ) + 1 );
+
+    for ( unsigned long objectIndex = 0; objectIndex < objects.size( ); ++ objectIndex ) {
+
+        BattleScene::Object const & object = objects[ objectIndex ];
+
+        for ( BattleScene::Face const & face : object.faces ) {
+            for ( int corner = 0; corner < 3; ++ corner ) {
+
+                // Faces pointing outside of the object are kept (so that the
+                // numbering stays the OBJ one), at the origin
+
+                BattleScene::Vertex vertex = { 0, 0, 0 };
+
+                if ( face.vertices[ corner ] < object.vertices.size( ) )
+                    vertex = object.vertices[ face.vertices[ corner ] ];
+
+                triangles[ objectIndex ].push_back( + vertex.x / 100.0f );
+                triangles[ objectIndex ].push_back( - vertex.y / 100.0f );
+                triangles[ objectIndex ].push_back( + vertex.z / 100.0f );
+
+            }
+        }
+
+        triangles.back( ).insert( triangles.back( ).end( ), triangles[ objectIndex ].begin( ), triangles[ objectIndex ].end( ) );
+
+    }
+
+    std::vector< BVH > trees( triangles.size( ) );
+
+    pool.parallelFor( trees.size( ), [ & ] ( unsigned long treeIndex ) {
+        trees[ treeIndex ] = buildBVH( triangles[ treeIndex ], pool );
+    } );
+
+    return trees;
+}
+
+static void putLittle( std::vector< boost::uint8_t > & output, unsigned long offset, boost::uint32_t value )
+{
+    for ( int t = 0; t < 4; ++ t ) {
+        output[ offset + t ] = ( value >> ( t * 8 ) ) & 0xff;
+    }
+}
+
+static void putFloat( std::vector< boost::uint8_t > & output, unsigned long offset, float value )
+{
+    boost::uint32_t bits;
+    std::memcpy( & bits, & value, 4 );
+
+    putLittle( output, offset, bits );
+}
+
+////////////
+// 4 bytes : magic "FBVH"
+// 4 bytes : version
+// 4 bytes : tree count (one for each object, then the whole scene)
+// 4 bytes : - reserved - (0)
+//
+// for each tree (16 bytes) :
+//   4 bytes : nodes offset (from the start of the file, 64 bytes aligned)
+//   4 bytes : node count
+//   4 bytes : references offset (from the start of the file)
+//   4 bytes : reference count
+//
+// Then the nodes and the references of each tree. A node takes 32 bytes :
+// the minimum X, Y and Z, the maximum X, Y and Z (floats), the offset and
+// the count (see BVHNode) ; two of them fill a cache line. A reference
+// takes 4 bytes. Everything is little endian.
+
+std::vector< boost::uint8_t > encodeBVHs( std::vector< BVH > const & trees )
+{
+    std::vector< unsigned long > nodeOffsets, referenceOffsets;
+
+    unsigned long size = BVH_HEADER_LENGTH + 16 * trees.size( );
+
+    for ( BVH const & tree : trees ) {
+
+        size = ( size + BVH_NODES_ALIGNMENT - 1 ) / BVH_NODES_ALIGNMENT * BVH_NODES_ALIGNMENT;
+        nodeOffsets.push_back( size );
+        size += tree.nodes.size( ) * sizeof( BVHNode );
+
+        referenceOffsets.push_back( size );
+        size += tree.references.size( ) * 4;
+
+    }
+
+    std::vector< boost::uint8_t > output( size );
+
+    putLittle( output, 0, BVH_MAGIC );
+    putLittle( output, 4, BVH_VERSION );
+    putLittle( output, 8, trees.size( ) );
+
+    for ( unsigned long treeIndex = 0; treeIndex < trees.size( ); ++ treeIndex ) {
+
+        BVH const & tree = trees[ treeIndex ];
+        unsigned long entry = BVH_HEADER_LENGTH + 16 * treeIndex;
+
+        putLittle( output, entry + 0, nodeOffsets[ treeIndex ] );
+        putLittle( output, entry + 4, tree.nodes.size( ) );
+        putLittle( output, entry + 8, referenceOffsets[ treeIndex ] );
+        putLittle( output, entry + 12, tree.references.size( ) );
+
+        for ( unsigned long nodeIndex = 0; nodeIndex < tree.nodes.size( ); ++ nodeIndex ) {
+
+            BVHNode const & node = tree.nodes[ nodeIndex ];
+            unsigned long offset = nodeOffsets[ treeIndex ] + nodeIndex * sizeof( BVHNode );
+
+            for ( int t = 0; t < 3; ++ t ) {
+                putFloat( output, offset + t * 4, node.min[ t ] );
+                putFloat( output, offset + 12 + t * 4, node.max[ t ] );
+            }
+
+            putLittle( output, offset + 24, node.offset );
+            putLittle( output, offset + 28, node.count );
+
+        }
+
+        for ( unsigned long referenceIndex = 0; referenceIndex < tree.references.size( ); ++ referenceIndex )
+            putLittle( output, referenceOffsets[ treeIndex ] + referenceIndex * 4, tree.references[ referenceIndex ] );
+
+    }
+
+    return output;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "threadpool.hpp"
+
+// Bounding volume hierarchies over the triangles of a battle scene, built
+// with the surface area heuristic evaluated on BVH_BIN_COUNT bins per axis.
+// The trees are flattened depth first : the first child of an inner node
+// follows it, and the node tells where the second one is. The sidecar
+// file (.ff9bvh) stores them as they are in memory, so they can be used
+// straight from a mapping of the file (see bvh.cpp for the layout).
+//
+// The positions are the OBJ ones (see BattleScene::serializeObject).
+
+#define BVH_MAGIC 0x48564246 // "FBVH"
+
+#define BVH_VERSION 1
+
+#define BVH_BIN_COUNT 16
+
+#define BVH_MAX_LEAF_SIZE 8
+
+// An inner node has a count of 0 and the index of its second child as
+// offset ; a leaf has the index of its first reference as offset, and its
+// reference count.
+
+struct BVHNode {
+    float min[ 3 ];
+    float max[ 3 ];
+    boost::uint32_t offset;
+    boost::uint32_t count;
+};
+
+// The references are the indices of the triangles, as given to buildBVH.
+
+struct BVH {
+    std::vector< BVHNode > nodes;
+    std::vector< boost::uint32_t > references;
+};
+
+// Nine coordinates per triangle. The large subtrees are built
+// concurrently on the pool.
+
+BVH buildBVH( std::vector< float > const & triangles, ThreadPool & pool );
+
+// One tree for each object, in which the references are the indices of
+// its faces, then one for the whole scene, in which they are the indices
+// of the faces numbered object after object (as in the OBJ file).
+
+std::vector< BVH > buildSceneBVHs( std::vector< BattleScene::Object > const & objects, ThreadPool & pool );
+
+std::vector< boost::uint8_t > encodeBVHs( std::vector< BVH > const & trees );
@@ -5,6 +5,8 @@
 
 #define SECTOR_LENGTH 2048
 
+#define TIM_HEADER_LENGTH 20
+
 #define VRAM_WIDTH  1024
 #define VRAM_HEIGHT  512
 
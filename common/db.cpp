@@ -0,0 +1,196 @@
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include "db.hpp"
+#include "filetypes.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "parse.hpp"
+#include "stats.hpp"
+
+namespace qi = boost::spirit::qi;
+
+#define CEIL_FACTOR( N, F ) ( ( N ) % ( F ) == 0 ? ( N ) : ( N ) + ( F ) - ( ( N ) % ( F ) ) )
+
+////////////
+// 1 byte  : magic 0xDB
+// 1 byte  : pointers count
+// 2 bytes : padding (0x0000)
+//
+// Each pointer :
+//
+// 3 bytes : pointer
+// 1 byte  : data type
+
+DB::DB( MemoryRange range )
+    : m_range( range )
+{
+    STATS_TIMER( timer, "parse headers" );
+
+    boost::uint32_t magicNumber;
+    boost::uint32_t pointerCount;
+
+    parse( range, qi::byte_, magicNumber );
+    if ( magicNumber != 0xDB )
+        throw std::runtime_error( "Bad magic number." );
+
+    parse( range, qi::byte_, pointerCount );
+    parse( range, qi::word );
+
+    this->m_packCount = pointerCount;
+}
+
+std::string DB::extension( boost::uint32_t dataType )
+{
+    if ( FileTypes::Type const * type = FileTypes::fromDataType( dataType ) )
+        return type->extension;
+
+    std::ostringstream extensionBuilder;
+    extensionBuilder << ".raw" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << dataType;
+
+    return extensionBuilder.str( );
+}
+
+boost::uint32_t DB::dataType( std::string const & extension )
+{
+    if ( FileTypes::Type const * type = FileTypes::fromExtension( extension ) )
+        return type->dataType;
+
+    boost::uint32_t dataType;
+    std::istringstream dataTypeParser( extension.size( ) == 6 && extension.compare( 0, 4, ".raw" ) == 0 ? extension.substr( 4 ) : std::string( ) );
+
+    if ( ! ( dataTypeParser >> std::hex >> dataType ) || ! dataTypeParser.eof( ) )
+        throw std::runtime_error( "Unknown object extension : " + extension );
+
+    return dataType;
+}
+
+DB::Iterator::Iterator( DB const & db, unsigned long packIndex )
+    : m_db( & db )
+    , m_packIndex( packIndex )
+    , m_objectIndex( 0 )
+    , m_objectCount( 0 )
+    , m_dataType( 0 )
+    , m_pack( nullptr, nullptr )
+    , m_object( { std::string( ), 0, 0, 0, 0, MemoryRange( nullptr, nullptr ) } )
+{
+    this->load( );
+}
+
+DB::Iterator & DB::Iterator::operator++( void )
+{
+    ++ this->m_objectIndex;
+
+    this->load( );
+
+    return * this;
+}
+
+// Parses the current object, or the first object of the next packs when
+// the current one is exhausted (packs may be empty).
+
+void DB::Iterator::load( void )
+{
+    for ( ; this->m_packIndex < this->m_db->m_packCount; ++ this->m_packIndex, this->m_objectIndex = 0 ) {
+
+        if ( this->m_objectIndex == 0 )
+            this->enterPack( );
+
+        if ( this->m_objectIndex < this->m_objectCount ) {
+            this->parseObject( );
+            return ;
+        }
+
+    }
+}
+
+////////////
+// 1 byte  : data type
+// 1 byte  : object count
+// 2 bytes : padding (0x0000)
+
+void DB::Iterator::enterPack( void )
+{
+    STATS_TIMER( timer, "unpack" );
+
+    MemoryRange range( this->m_db->m_range );
+
+    boost::uint32_t pointer;
+    range.seek( MemoryRange::SeekSet, 4 + this->m_packIndex * 4 );
+    parse( range, qi::little_dword, pointer );
+    pointer = pointer & 0xFFFFFF;
+
+    range.seek( MemoryRange::SeekCur, pointer - 4 );
+
+    LOG( Verbose, " - Extracting #" << this->m_packIndex );
+
+    parse( range, qi::byte_, this->m_dataType );
+    parse( range, qi::byte_, this->m_objectCount );
+    parse( range, qi::word );
+
+    this->m_extension = DB::extension( this->m_dataType );
+    this->m_pack = range;
+
+    LOG( Verbose, "   Data type    : 0x" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << this->m_dataType << " (" << this->m_extension << ")" );
+    LOG( Verbose, "   Object count : " << this->m_objectCount );
+
+    STATS_COUNT( "packs", 1 );
+}
+
+void DB::Iterator::parseObject( void )
+{
+    STATS_TIMER( timer, "unpack" );
+
+    MemoryRange range( this->m_pack );
+    unsigned long objectIndex = this->m_objectIndex;
+
+    int identifiersByteLength = CEIL_FACTOR( this->m_objectCount * 2, 4 );
+    int pointersByteLength = CEIL_FACTOR( ( this->m_objectCount + 1 ) * 4, 4 );
+
+    MemoryRange identifiersRange( range );
+    identifiersRange.crop( MemoryRange::SeekCur, 0, identifiersByteLength );
+
+    MemoryRange pointersRange( range );
+    pointersRange.crop( MemoryRange::SeekCur, identifiersByteLength, pointersByteLength );
+
+    boost::uint32_t identifier, start, end;
+
+    identifiersRange.seek( MemoryRange::SeekSet, objectIndex * 2 );
+    parse( identifiersRange, qi::little_word, identifier );
+
+    pointersRange.seek( MemoryRange::SeekSet, objectIndex * 4 );
+    parse( pointersRange, qi::little_dword, start );
+    parse( pointersRange, qi::little_dword, end );
+    start += identifiersByteLength + objectIndex * 4;
+    end += identifiersByteLength + objectIndex * 4 + 4;
+
+    unsigned long size = end - start;
+
+    LOG( Verbose, "    - Unpacking #" << objectIndex );
+    LOG( Verbose, "      Identifier    : " << identifier );
+    LOG( Verbose, "      Start pointer : " << start );
+    LOG( Verbose, "      End pointer   : " << end );
+    LOG( Verbose, "      Size          : " << size << " byte(s)" );
+
+    MemoryRange dataRange( range );
+    dataRange.crop( MemoryRange::SeekCur, start, size );
+
+    std::ostringstream pathBuilder;
+    pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << this->m_packIndex << "/" << std::setw( 3 ) << objectIndex << this->m_extension;
+
+    this->m_object.path = pathBuilder.str( );
+    this->m_object.packIndex = this->m_packIndex;
+    this->m_object.objectIndex = objectIndex;
+    this->m_object.identifier = identifier;
+    this->m_object.dataType = this->m_dataType;
+    this->m_object.range = dataRange;
+
+    STATS_BYTES( timer, size );
+    STATS_COUNT( "objects", 1 );
+    STATS_COUNT( "bytes", size );
+}
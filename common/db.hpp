@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// A DB file (.ff9db) : a list of packs, each holding objects of a single
+// type. Iterating over the DB walks its objects in pack order ; each pack
+// header is only parsed once the iteration reaches it, and the objects are
+// views of the DB range (which must outlive them) :
+//
+//     for ( DB::Object const & object : DB( range ) )
+//         ... object.path, object.range ...
+
+class DB
+{
+
+public:
+
+    // The path of an object is relative to the DB root : "<pack index>/
+    // <object index><extension>" (as in "002/000.tim").
+
+    struct Object {
+        std::string path;
+        unsigned long packIndex;
+        unsigned long objectIndex;
+        boost::uint32_t identifier;
+        boost::uint32_t dataType;
+        MemoryRange range;
+    };
+
+    class Iterator
+    {
+
+    public:
+
+        Iterator( DB const & db, unsigned long packIndex );
+
+    public:
+
+        inline Object const & operator*( void ) const;
+
+        inline Object const * operator->( void ) const;
+
+        Iterator & operator++( void );
+
+        inline bool operator!=( Iterator const & other ) const;
+
+    private:
+
+        void load( void );
+
+        void enterPack( void );
+
+        void parseObject( void );
+
+    private:
+
+        DB const * m_db;
+
+        unsigned long m_packIndex;
+
+        unsigned long m_objectIndex;
+
+        boost::uint32_t m_objectCount;
+
+        boost::uint32_t m_dataType;
+
+        std::string m_extension;
+
+        MemoryRange m_pack;
+
+        Object m_object;
+
+    };
+
+public:
+
+    DB( MemoryRange range );
+
+public:
+
+    // Extension of the objects of the given data type (".tim", ...).
+
+    static std::string extension( boost::uint32_t dataType );
+
+    // The other way around (throws for the extensions no data type has).
+
+    static boost::uint32_t dataType( std::string const & extension );
+
+public:
+
+    inline unsigned long packCount( void ) const;
+
+public:
+
+    inline Iterator begin( void ) const;
+
+    inline Iterator end( void ) const;
+
+private:
+
+    MemoryRange m_range;
+
+    unsigned long m_packCount;
+
+};
+
+DB::Object const & DB::Iterator::operator*( void ) const
+{
+    return this->m_object;
+}
+
+DB::Object const * DB::Iterator::operator->( void ) const
+{
+    return & this->m_object;
+}
+
+bool DB::Iterator::operator!=( Iterator const & other ) const
+{
+    return this->m_packIndex != other.m_packIndex || this->m_objectIndex != other.m_objectIndex;
+}
+
+unsigned long DB::packCount( void ) const
+{
+    return this->m_packCount;
+}
+
+DB::Iterator DB::begin( void ) const
+{
+    return Iterator( * this, 0 );
+}
+
+DB::Iterator DB::end( void ) const
+{
+    return Iterator( * this, this->m_packCount );
+}
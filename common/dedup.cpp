@@ -0,0 +1,119 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <linux/fs.h>
+#endif
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "dedup.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+
+// Each fallback is only reported once, since it usually applies to the
+// whole output folder.
+
+static std::atomic< bool > s_reflinkFailed( false );
+static std::atomic< bool > s_hardlinkFailed( false );
+
+static bool reflink( std::string const & original, std::string const & path )
+{
+#ifdef FICLONE
+
+    int source = open( original.c_str( ), O_RDONLY );
+    if ( source < 0 )
+        return false;
+
+    int destination = open( path.c_str( ), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( destination < 0 ) {
+        close( source );
+        return false;
+    }
+
+    bool cloned = ioctl( destination, FICLONE, source ) == 0;
+    int error = errno;
+
+    close( destination );
+    close( source );
+
+    if ( ! cloned ) {
+        unlink( path.c_str( ) );
+        if ( ! s_reflinkFailed.exchange( true ) ) {
+            LOG( Warning, "Cannot clone " << original << " (" << std::strerror( error ) << "), using hardlinks instead" );
+        }
+    }
+
+    return cloned;
+
+#else
+
+    if ( ! s_reflinkFailed.exchange( true ) ) {
+        LOG( Warning, "Reflinks are not supported on this platform, using hardlinks instead" );
+    }
+
+    return false;
+
+#endif
+}
+
+static bool hardlink( std::string const & original, std::string const & path )
+{
+    boost::system::error_code error;
+    boost::filesystem::create_hard_link( original, path, error );
+
+    if ( error && ! s_hardlinkFailed.exchange( true ) ) {
+        LOG( Warning, "Cannot link " << original << " (" << error.message( ) << "), copying instead" );
+    }
+
+    return ! error;
+}
+
+Dedup::Dedup( Mode mode )
+    : m_mode( mode )
+{
+}
+
+std::string Dedup::claim( boost::uint64_t hash, unsigned long size, std::string const & path )
+{
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    std::pair< std::map< std::pair< boost::uint64_t, unsigned long >, std::string >::iterator, bool > result =
+        this->m_files.insert( std::make_pair( std::make_pair( hash, size ), path ) );
+
+    return result.second ? std::string( ) : result.first->second;
+}
+
+void Dedup::link( std::string const & original, std::string const & path ) const
+{
+    STATS_TIMER( timer, "link" );
+
+    boost::filesystem::path pathname( path );
+
+    std::string dirname = pathname.parent_path( ).string( );
+    if ( ! dirname.empty( ) )
+        boost::filesystem::create_directories( dirname );
+
+    boost::filesystem::remove( pathname );
+
+    if ( this->m_mode == Reflink && reflink( original, path ) )
+        return ;
+
+    if ( hardlink( original, path ) )
+        return ;
+
+    boost::filesystem::copy_file( original, path );
+}
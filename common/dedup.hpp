@@ -0,0 +1,47 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <boost/cstdint.hpp>
+
+// Keeps track of the content already written, so that the later copies of
+// an entry become links to the first one instead of full copies.
+
+class Dedup
+{
+
+public:
+
+    enum Mode {
+        Hardlink,
+        Reflink
+    };
+
+public:
+
+    Dedup( Mode mode );
+
+public:
+
+    // Returns the path of the first file registered with the same content,
+    // or an empty string if there is none (path then becomes this file).
+
+    std::string claim( boost::uint64_t hash, unsigned long size, std::string const & path );
+
+    // Replaces path by a link to original (or a clone of it, in reflink
+    // mode). Falls back on a plain copy when the filesystem cannot link.
+
+    void link( std::string const & original, std::string const & path ) const;
+
+private:
+
+    Mode m_mode;
+
+    std::map< std::pair< boost::uint64_t, unsigned long >, std::string > m_files;
+
+    std::mutex m_mutex;
+
+};
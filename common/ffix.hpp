@@ -0,0 +1,32 @@
+#pragma once
+
+// The parsers shared by the tools, for programs embedding them (the common
+// target builds libffix). Every decoder works on memory ranges and returns
+// its results in memory ; nothing is written to the disk.
+//
+// Image        : the FF9.IMG directory, and views of its entries
+// DB           : the objects of a .ff9db file
+// BattleScene  : the textures and the OBJ / MTL files of a .ff9bs scene
+// TIM          : the TIM images, and their upload into a VRAM
+// PackedFile   : the files of a .ff9pack archive
+// FileTypes    : the file types, recognized from their first bytes or data type
+// Scan         : structural checks of the above, which never throw
+// Mesh         : the compact binary geometry of a BattleScene (.ff9mesh)
+// renderScene  : a software rendered preview of a BattleScene
+// buildLevels  : levels of detail of the BattleScene objects
+// BVH          : bounding volume hierarchies of a BattleScene (.ff9bvh)
+
+#include "battlescene.hpp"
+#include "bvh.hpp"
+#include "db.hpp"
+#include "filetypes.hpp"
+#include "image.hpp"
+#include "memoryrange.hpp"
+#include "mesh.hpp"
+#include "packedfile.hpp"
+#include "raster.hpp"
+#include "scan.hpp"
+#include "simplify.hpp"
+#include "tim.hpp"
+#include "vram.hpp"
+#include "windowedfile.hpp"
@@ -0,0 +1,104 @@
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "filetypes.hpp"
+#include "memoryrange.hpp"
+
+static unsigned long little( MemoryRange const & range, unsigned long offset, int byteCount )
+{
+    unsigned long value = 0;
+
+    for ( int t = byteCount; t --; )
+        value = ( value << 8 ) | range.begin( )[ offset + t ];
+
+    return value;
+}
+
+// 1 byte : magic 0xDB (see db.cpp)
+
+static bool sniffDB( MemoryRange const & head )
+{
+    return head.size( ) >= 1 && head.begin( )[ 0 ] == 0xDB;
+}
+
+// 1 byte : magic 0x10, 1 byte : version 0, 2 bytes, 4 bytes : flags, of
+// which only 0x03 and 0x08 exist (see scan.cpp)
+
+static bool sniffTIM( MemoryRange const & head )
+{
+    return head.size( ) >= 8 && head.begin( )[ 0 ] == 0x10 && head.begin( )[ 1 ] == 0x00 && ! ( little( head, 4, 4 ) & ~ 0x0BUL );
+}
+
+// The magic numbers are checked in this order
+
+static FileTypes::Type const g_types[ ] = {
+    { FileTypes::DB, "DB", ".ff9db", 0x1B, & sniffDB },
+    { FileTypes::TIM, "TIM", ".tim", 0x04, & sniffTIM },
+    { FileTypes::BattleScene, "battle scene", ".ff9bs", 0x0C, nullptr },
+    { FileTypes::Model, "model", ".ff9md", 0x02, nullptr }
+};
+
+FileTypes::Type const * FileTypes::fromKind( Kind kind )
+{
+    for ( Type const & type : g_types )
+        if ( type.kind == kind )
+            return & type;
+
+    return nullptr;
+}
+
+FileTypes::Type const * FileTypes::fromDataType( boost::uint32_t dataType )
+{
+    for ( Type const & type : g_types )
+        if ( type.dataType == dataType )
+            return & type;
+
+    return nullptr;
+}
+
+FileTypes::Type const * FileTypes::fromExtension( std::string const & extension )
+{
+    for ( Type const & type : g_types )
+        if ( extension == type.extension )
+            return & type;
+
+    return nullptr;
+}
+
+FileTypes::Type const * FileTypes::classify( MemoryRange const & head, boost::uint32_t dataType )
+{
+    if ( dataType != FILE_TYPES_NO_DATA_TYPE ) {
+        if ( Type const * type = fromDataType( dataType ) ) {
+            return type;
+        }
+    }
+
+    for ( Type const & type : g_types )
+        if ( type.sniff && type.sniff( head ) )
+            return & type;
+
+    return nullptr;
+}
+
+void FileTypes::on( Kind kind, Handler const & handler )
+{
+    this->m_handlers[ kind ] = handler;
+}
+
+bool FileTypes::dispatch( std::string const & path, MemoryRange const & range, boost::uint32_t dataType ) const
+{
+    Type const * type = classify( range, dataType );
+
+    if ( ! type )
+        return false;
+
+    auto handler = this->m_handlers.find( type->kind );
+
+    if ( handler == this->m_handlers.end( ) )
+        return false;
+
+    handler->second( * type, path, range );
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// The types of the game files, in a single table : how each one is named,
+// the data type its objects have in the DB packs, and how it is recognized
+// from its first bytes (for the IMG entries, which are not typed). The
+// types have no format version : a file is one of them, or is unknown.
+//
+// An instance routes the classified files to the handlers registered for
+// their type, so that a tool can process them as they are extracted :
+//
+//     FileTypes types;
+//     types.on( FileTypes::DB, [ & ] ( ... ) { ... } );
+//     types.dispatch( path, range, dataType );
+
+#define FILE_TYPES_NO_DATA_TYPE 0xFFFFFFFF
+
+// Bytes the magic numbers are checked on.
+
+#define FILE_TYPES_HEAD_LENGTH 8
+
+class FileTypes
+{
+
+public:
+
+    enum Kind {
+        DB,
+        TIM,
+        BattleScene,
+        Model
+    };
+
+    struct Type {
+        Kind kind;
+        char const * name;
+        char const * extension;
+        boost::uint32_t dataType;
+        // Null for the types without a magic number, which are only known
+        // through their data type
+        bool ( * sniff )( MemoryRange const & head );
+    };
+
+    // The path is relative to the root of the extraction, as given to
+    // dispatch ; the range is the whole file.
+
+    typedef std::function< void ( Type const & type, std::string const & path, MemoryRange const & range ) > Handler;
+
+public:
+
+    // Null when no type matches.
+
+    static Type const * fromKind( Kind kind );
+
+    static Type const * fromDataType( boost::uint32_t dataType );
+
+    static Type const * fromExtension( std::string const & extension );
+
+    // The data type is authoritative when given and known ; the first
+    // bytes are checked otherwise. The head only needs to hold the first
+    // few bytes of the file (FILE_TYPES_HEAD_LENGTH).
+
+    static Type const * classify( MemoryRange const & head, boost::uint32_t dataType = FILE_TYPES_NO_DATA_TYPE );
+
+public:
+
+    // Replaces the handler of this type, if any.
+
+    void on( Kind kind, Handler const & handler );
+
+    // Calls the handler of the file type, and tells whether there was one.
+
+    bool dispatch( std::string const & path, MemoryRange const & range, boost::uint32_t dataType = FILE_TYPES_NO_DATA_TYPE ) const;
+
+private:
+
+    std::map< Kind, Handler > m_handlers;
+
+};
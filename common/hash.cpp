@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "hash.hpp"
+
+// The input is consumed by 32 bytes stripes, split on four independent
+// lanes. Each lane only depends on its own previous value, so the main loop
+// maps onto vector registers (or at least keeps the multipliers busy)
+// without platform specific intrinsics.
+
+static boost::uint64_t const PRIME1 = 11400714785074694791ULL;
+static boost::uint64_t const PRIME2 = 14029467366897019727ULL;
+static boost::uint64_t const PRIME3 =  1609587929392839161ULL;
+static boost::uint64_t const PRIME4 =  9650029242287828579ULL;
+static boost::uint64_t const PRIME5 =  2870177450012600261ULL;
+
+static inline boost::uint64_t rotateLeft( boost::uint64_t value, int count )
+{
+    return ( value << count ) | ( value >> ( 64 - count ) );
+}
+
+static inline boost::uint64_t readLittle64( boost::uint8_t const * data )
+{
+    boost::uint64_t value = 0;
+
+    for ( int t = 8; t --; )
+        value = ( value << 8 ) | data[ t ];
+
+    return value;
+}
+
+static inline boost::uint64_t readLittle32( boost::uint8_t const * data )
+{
+    return static_cast< boost::uint64_t >( data[ 0 ] ) | data[ 1 ] << 8 | data[ 2 ] << 16 | static_cast< boost::uint64_t >( data[ 3 ] ) << 24;
+}
+
+static inline boost::uint64_t round( boost::uint64_t lane, boost::uint64_t input )
+{
+    return rotateLeft( lane + input * PRIME2, 31 ) * PRIME1;
+}
+
+static inline boost::uint64_t mergeRound( boost::uint64_t hash, boost::uint64_t lane )
+{
+    return ( hash ^ round( 0, lane ) ) * PRIME1 + PRIME4;
+}
+
+static void consumeStripes( boost::uint64_t * lanes, boost::uint8_t const * data, unsigned long stripeCount )
+{
+    boost::uint64_t lane0 = lanes[ 0 ], lane1 = lanes[ 1 ], lane2 = lanes[ 2 ], lane3 = lanes[ 3 ];
+
+    for ( unsigned long s = 0; s < stripeCount; ++ s, data += 32 ) {
+        lane0 = round( lane0, readLittle64( data +  0 ) );
+        lane1 = round( lane1, readLittle64( data +  8 ) );
+        lane2 = round( lane2, readLittle64( data + 16 ) );
+        lane3 = round( lane3, readLittle64( data + 24 ) );
+    }
+
+    lanes[ 0 ] = lane0; lanes[ 1 ] = lane1; lanes[ 2 ] = lane2; lanes[ 3 ] = lane3;
+}
+
+Hash::Hash( boost::uint64_t seed )
+    : m_seed( seed )
+    , m_pendingSize( 0 )
+    , m_totalSize( 0 )
+{
+    this->m_lanes[ 0 ] = seed + PRIME1 + PRIME2;
+    this->m_lanes[ 1 ] = seed + PRIME2;
+    this->m_lanes[ 2 ] = seed;
+    this->m_lanes[ 3 ] = seed - PRIME1;
+}
+
+Hash & Hash::update( boost::uint8_t const * data, unsigned long size )
+{
+    this->m_totalSize += size;
+
+    // Completes the stripe left over by the previous call first
+
+    if ( this->m_pendingSize ) {
+
+        unsigned long count = std::min( size, 32 - this->m_pendingSize );
+        std::copy( data, data + count, this->m_pending + this->m_pendingSize );
+
+        this->m_pendingSize += count;
+        data += count;
+        size -= count;
+
+        if ( this->m_pendingSize < 32 )
+            return * this;
+
+        consumeStripes( this->m_lanes, this->m_pending, 1 );
+        this->m_pendingSize = 0;
+
+    }
+
+    consumeStripes( this->m_lanes, data, size / 32 );
+
+    std::copy( data + size / 32 * 32, data + size, this->m_pending );
+    this->m_pendingSize = size % 32;
+
+    return * this;
+}
+
+Hash & Hash::update( boost::uint64_t value )
+{
+    boost::uint8_t bytes[ 8 ];
+
+    for ( int t = 0; t < 8; ++ t )
+        bytes[ t ] = ( value >> ( t * 8 ) ) & 0xff;
+
+    return this->update( bytes, 8 );
+}
+
+boost::uint64_t Hash::digest( void ) const
+{
+    boost::uint64_t hash;
+
+    if ( this->m_totalSize >= 32 ) {
+
+        boost::uint64_t const * lanes = this->m_lanes;
+
+        hash = rotateLeft( lanes[ 0 ], 1 ) + rotateLeft( lanes[ 1 ], 7 ) + rotateLeft( lanes[ 2 ], 12 ) + rotateLeft( lanes[ 3 ], 18 );
+
+        for ( int t = 0; t < 4; ++ t ) {
+            hash = mergeRound( hash, lanes[ t ] );
+        }
+
+    } else {
+
+        hash = this->m_seed + PRIME5;
+
+    }
+
+    hash += this->m_totalSize;
+
+    boost::uint8_t const * data = this->m_pending;
+    boost::uint8_t const * end = data + this->m_pendingSize;
+
+    for ( ; data + 8 <= end; data += 8 )
+        hash = rotateLeft( hash ^ round( 0, readLittle64( data ) ), 27 ) * PRIME1 + PRIME4;
+
+    for ( ; data + 4 <= end; data += 4 )
+        hash = rotateLeft( hash ^ ( readLittle32( data ) * PRIME1 ), 23 ) * PRIME2 + PRIME3;
+
+    for ( ; data < end; data += 1 )
+        hash = rotateLeft( hash ^ ( * data * PRIME5 ), 11 ) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+std::string Hash::hex( boost::uint64_t hash )
+{
+    char buffer[ 17 ];
+    std::snprintf( buffer, sizeof( buffer ), "%016llx", static_cast< unsigned long long >( hash ) );
+
+    return buffer;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// 64 bits content hash (the XXH64 algorithm), used to find identical
+// entries. Data can be fed in several parts : the result only depends on
+// the concatenated bytes.
+//
+// Strings are fed with their terminating null byte, so that a sequence of
+// strings cannot be confused with another one.
+
+class Hash
+{
+
+public:
+
+    Hash( boost::uint64_t seed = 0 );
+
+public:
+
+    Hash & update( boost::uint8_t const * data, unsigned long size );
+
+    inline Hash & update( MemoryRange const & range );
+
+    inline Hash & update( std::string const & text );
+
+    Hash & update( boost::uint64_t value );
+
+    boost::uint64_t digest( void ) const;
+
+public:
+
+    static inline boost::uint64_t compute( MemoryRange const & range );
+
+    static std::string hex( boost::uint64_t hash );
+
+private:
+
+    boost::uint64_t m_seed;
+
+    boost::uint64_t m_lanes[ 4 ];
+
+    boost::uint8_t m_pending[ 32 ];
+
+    unsigned long m_pendingSize;
+
+    boost::uint64_t m_totalSize;
+
+};
+
+Hash & Hash::update( MemoryRange const & range )
+{
+    return this->update( range.begin( ), range.size( ) );
+}
+
+Hash & Hash::update( std::string const & text )
+{
+    return this->update( reinterpret_cast< boost::uint8_t const * >( text.data( ) ), text.size( ) + 1 );
+}
+
+boost::uint64_t Hash::compute( MemoryRange const & range )
+{
+    return Hash( ).update( range ).digest( );
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include "constants.hpp"
+#include "image.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "parse.hpp"
+#include "stats.hpp"
+#include "windowedfile.hpp"
+
+namespace qi = boost::spirit::qi;
+
+////////////
+// 2 bytes : file ID
+// 2 bytes : - unknown -
+// 4 bytes : first sector
+
+static void parseFile( MemoryRange range, Image::Entry entry, unsigned long & endSector, std::vector< Image::Entry > & entries )
+{
+    boost::uint32_t id;
+    boost::uint32_t beginSector;
+
+    parse( range, qi::little_word, id );
+    parse( range, qi::little_word );
+    parse( range, qi::little_dword, beginSector );
+
+    entry.beginSector = beginSector;
+    entry.endSector = endSector;
+    entries.push_back( entry );
+
+    endSector = beginSector;
+}
+
+////////////
+// 2 bytes : fragment sector, or 0xFFFF
+
+static void parseFragment( MemoryRange range, Image::Entry entry, unsigned long baseSector, unsigned long & endSector, std::vector< Image::Entry > & entries )
+{
+    boost::uint32_t fragmentSector;
+
+    parse( range, qi::little_word, fragmentSector );
+
+    if ( fragmentSector == 0xFFFF ) return ;
+
+    boost::uint32_t beginSector = baseSector + fragmentSector;
+
+    entry.beginSector = beginSector;
+    entry.endSector = endSector;
+    entries.push_back( entry );
+
+    endSector = beginSector;
+}
+
+////////////
+// 4 bytes : directory type [0x02 = file, 0x03 = fragment]
+// 4 bytes : entries count
+// 4 bytes : entries list sector
+// 4 bytes : base sector
+
+static void locateEntryList( MemoryRange range, unsigned long & offset, unsigned long & size )
+{
+    boost::uint32_t type;
+    boost::uint32_t entryCount;
+    boost::uint32_t entryListSector;
+
+    parse( range, qi::little_dword, type );
+    parse( range, qi::little_dword, entryCount );
+    parse( range, qi::little_dword, entryListSector );
+
+    unsigned long entryLength = type == 0x02 ? 8 : type == 0x03 ? 2 : 0;
+
+    offset = entryListSector * SECTOR_LENGTH;
+    size = entryCount * entryLength;
+}
+
+static void parseContainer( WindowedFile & image, MemoryRange range, MemoryRange listRange, std::string const & containerPath, unsigned long containerIndex, unsigned long & endSector, std::vector< Image::Entry > & entries )
+{
+    boost::uint32_t type;
+    boost::uint32_t entryCount;
+    boost::uint32_t entryListSector;
+    boost::uint32_t baseSector;
+
+    parse( range, qi::little_dword, type );
+    parse( range, qi::little_dword, entryCount );
+    parse( range, qi::little_dword, entryListSector );
+    parse( range, qi::little_dword, baseSector );
+
+    LOG( Verbose, "  Container type : 0x" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << type );
+    LOG( Verbose, "  Entry count    : " << entryCount );
+
+    for ( unsigned long entryIndex = entryCount; entryIndex --;  ) {
+
+        MemoryRange subRange( listRange );
+
+        std::stringstream pathBuilder;
+        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << entryIndex;
+
+        Image::Entry entry;
+        entry.path = containerPath + "/" + pathBuilder.str( );
+        entry.containerIndex = containerIndex;
+
+        switch ( type ) {
+
+            case 0x02:
+                subRange.seek( MemoryRange::SeekCur, 8 * entryIndex );
+                parseFile( subRange, entry, endSector, entries );
+            break;
+
+            case 0x03:
+                subRange.seek( MemoryRange::SeekCur, 2 * entryIndex );
+                parseFragment( subRange, entry, baseSector, endSector, entries );
+            break;
+
+        }
+
+    }
+
+    if ( type == 0x04 ) {
+        endSector = image.size( ) / SECTOR_LENGTH;
+    } else {
+        endSector = baseSector;
+    }
+}
+
+////////////
+// 4 bytes : magic 0x46463920
+// 4 bytes : - unknown -
+// 4 bytes : directories count
+// 4 bytes : - unknown -
+
+Image::Image( WindowedFile & image )
+    : m_file( image )
+{
+    STATS_TIMER( timer, "parse headers" );
+
+    boost::uint32_t magicNumber;
+    boost::uint32_t containerCount;
+
+    MemoryRange range = image.map( 0, 16 );
+
+    parse( range, qi::big_dword, magicNumber );
+    if ( magicNumber != 0x46463920 )
+        throw std::runtime_error( "Bad magic number." );
+
+    parse( range, qi::little_dword );
+    parse( range, qi::little_dword, containerCount );
+    parse( range, qi::little_dword );
+
+    LOG( Verbose, "Container count : " << containerCount );
+
+    // The directory sectors are read in disk order, so that a sequential
+    // input never has to go back.
+
+    std::vector< boost::uint8_t > descriptors;
+    MemoryRange descriptorsRange = image.map( 16, 16 * containerCount );
+    descriptors.assign( descriptorsRange.begin( ), descriptorsRange.end( ) );
+
+    std::vector< std::pair< unsigned long, unsigned long > > listOrder;
+    std::vector< std::vector< boost::uint8_t > > lists( containerCount );
+
+    for ( unsigned long containerIndex = 0; containerIndex < containerCount; ++ containerIndex ) {
+
+        unsigned long listOffset, listSize;
+        locateEntryList( MemoryRange( & descriptors[ 16 * containerIndex ], & descriptors[ 16 * containerIndex ] + 16 ), listOffset, listSize );
+
+        listOrder.push_back( std::make_pair( listOffset, containerIndex ) );
+
+    }
+
+    std::sort( listOrder.begin( ), listOrder.end( ) );
+
+    for ( std::pair< unsigned long, unsigned long > const & list : listOrder ) {
+
+        unsigned long listOffset, listSize;
+        locateEntryList( MemoryRange( & descriptors[ 16 * list.second ], & descriptors[ 16 * list.second ] + 16 ), listOffset, listSize );
+
+        MemoryRange listRange = image.map( listOffset, listSize );
+        lists[ list.second ].assign( listRange.begin( ), listRange.end( ) );
+
+    }
+
+    unsigned long endSector = image.size( ) / SECTOR_LENGTH;
+
+    for ( unsigned long containerIndex = containerCount; containerIndex --;  ) {
+
+        MemoryRange subRange( & descriptors[ 16 * containerIndex ], & descriptors[ 16 * containerIndex ] + 16 );
+        MemoryRange listRange( lists[ containerIndex ].data( ), lists[ containerIndex ].data( ) + lists[ containerIndex ].size( ) );
+
+        std::stringstream pathBuilder;
+        pathBuilder << std::setfill( '0' ) << std::setw( 2 ) << containerIndex;
+
+        LOG( Verbose, "* Container #" << containerIndex );
+        parseContainer( image, subRange, listRange, pathBuilder.str( ), containerIndex, endSector, this->m_entries );
+
+    }
+}
+
+MemoryRange Image::map( Entry const & entry )
+{
+    return this->m_file.map( entry.beginSector * SECTOR_LENGTH, ( entry.endSector - entry.beginSector ) * SECTOR_LENGTH );
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "memoryrange.hpp"
+#include "windowedfile.hpp"
+
+// The FF9.IMG directory. The directory tables are parsed on construction ;
+// the entries payloads are only read when asked for, either with map( ) or
+// by iterating over the image :
+//
+//     for ( Image::View view : image )
+//         ... view.entry.path, view.range ...
+//
+// Each payload is mapped as a whole, so it has to fit in a window of the
+// file (see WindowedFile) ; large entries can be read with
+// WindowedFile::stream( ) instead.
+
+class Image
+{
+
+public:
+
+    // The path of an entry is relative to the image root, without any
+    // extension : "<container index>/<entry index>" (as in "03/012").
+
+    struct Entry {
+        std::string path;
+        unsigned long containerIndex;
+        unsigned long beginSector;
+        unsigned long endSector;
+    };
+
+    struct View {
+        Entry const & entry;
+        MemoryRange range;
+    };
+
+    class Iterator
+    {
+
+    public:
+
+        inline Iterator( Image & image, unsigned long index );
+
+    public:
+
+        inline View operator*( void ) const;
+
+        inline Iterator & operator++( void );
+
+        inline bool operator!=( Iterator const & other ) const;
+
+    private:
+
+        Image * m_image;
+
+        unsigned long m_index;
+
+    };
+
+public:
+
+    Image( WindowedFile & file );
+
+public:
+
+    inline std::vector< Entry > const & entries( void ) const;
+
+    MemoryRange map( Entry const & entry );
+
+public:
+
+    inline Iterator begin( void );
+
+    inline Iterator end( void );
+
+private:
+
+    WindowedFile & m_file;
+
+    std::vector< Entry > m_entries;
+
+};
+
+Image::Iterator::Iterator( Image & image, unsigned long index )
+    : m_image( & image )
+    , m_index( index )
+{
+}
+
+Image::View Image::Iterator::operator*( void ) const
+{
+    Entry const & entry = this->m_image->m_entries[ this->m_index ];
+
+    return View{ entry, this->m_image->map( entry ) };
+}
+
+Image::Iterator & Image::Iterator::operator++( void )
+{
+    ++ this->m_index;
+
+    return * this;
+}
+
+bool Image::Iterator::operator!=( Iterator const & other ) const
+{
+    return this->m_index != other.m_index;
+}
+
+std::vector< Image::Entry > const & Image::entries( void ) const
+{
+    return this->m_entries;
+}
+
+Image::Iterator Image::begin( void )
+{
+    return Iterator( * this, 0 );
+}
+
+Image::Iterator Image::end( void )
+{
+    return Iterator( * this, this->m_entries.size( ) );
+}
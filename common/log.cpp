@@ -0,0 +1,264 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <boost/program_options/variables_map.hpp>
+
+#include "log.hpp"
+
+#define LOG_RING_SIZE 4096
+
+namespace
+{
+
+    // Bounded multi-producer ring ; each slot carries a sequence number
+    // telling whether it is free for the producer or ready for the sink.
+
+    struct Slot {
+        std::atomic< unsigned long > sequence;
+        Log::Level level;
+        std::string message;
+    };
+
+    Slot g_ring[ LOG_RING_SIZE ];
+
+    std::atomic< unsigned long > g_head( 0 );
+
+    unsigned long g_tail = 0;
+
+    Log::Format g_format = Log::Text;
+
+    std::thread g_sink;
+
+    std::atomic< bool > g_running( false );
+
+    std::atomic< bool > g_sleeping( false );
+
+    std::mutex g_mutex;
+
+    std::condition_variable g_condition;
+
+    char const * levelName( Log::Level level )
+    {
+        switch ( level ) {
+            case Log::Error   : return "error";
+            case Log::Warning : return "warning";
+            case Log::Info    : return "info";
+            default           : return "verbose";
+        }
+    }
+
+    void appendJsonString( std::string & output, std::string const & text )
+    {
+        output += '"';
+
+        for ( char c : text ) {
+            switch ( c ) {
+                case '"'  : output += "\\\""; break ;
+                case '\\' : output += "\\\\"; break ;
+                case '\n' : output += "\\n";  break ;
+                case '\t' : output += "\\t";  break ;
+                default :
+                    if ( static_cast< unsigned char >( c ) < 0x20 ) {
+                        char escaped[ 8 ];
+                        std::snprintf( escaped, sizeof( escaped ), "\\u%04x", c );
+                        output += escaped;
+                    } else {
+                        output += c;
+                    }
+                break ;
+            }
+        }
+
+        output += '"';
+    }
+
+    void format( std::string & output, Log::Level level, std::string const & message )
+    {
+        if ( g_format == Log::JsonLines ) {
+
+            double time = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::system_clock::now( ).time_since_epoch( ) ).count( ) / 1e6;
+
+            char timeBuffer[ 32 ];
+            std::snprintf( timeBuffer, sizeof( timeBuffer ), "%.6f", time );
+
+            output += "{\"time\":";
+            output += timeBuffer;
+            output += ",\"level\":\"";
+            output += levelName( level );
+            output += "\",\"message\":";
+            appendJsonString( output, message );
+            output += "}\n";
+
+        } else {
+
+            if ( level <= Log::Warning ) {
+                output += levelName( level );
+                output += ": ";
+            }
+
+            output += message;
+            output += '\n';
+
+        }
+    }
+
+    bool drain( std::string & output )
+    {
+        bool drained = false;
+
+        for ( ;; ) {
+
+            Slot & slot = g_ring[ g_tail % LOG_RING_SIZE ];
+
+            if ( slot.sequence.load( std::memory_order_acquire ) != g_tail + 1 )
+                break ;
+
+            format( output, slot.level, slot.message );
+            slot.message.clear( );
+
+            slot.sequence.store( g_tail + LOG_RING_SIZE, std::memory_order_release );
+            ++ g_tail;
+
+            drained = true;
+
+        }
+
+        return drained;
+    }
+
+    void sink( void )
+    {
+        std::string output;
+
+        for ( ;; ) {
+
+            bool running = g_running.load( );
+
+            if ( drain( output ) ) {
+                std::fwrite( output.data( ), 1, output.size( ), stdout );
+                output.clear( );
+                continue ;
+            }
+
+            std::fflush( stdout );
+
+            if ( ! running )
+                break ;
+
+            // Producers only notify when they see the sink sleeping, so the
+            // ring has to be checked again once the flag is raised
+
+            std::unique_lock< std::mutex > lock( g_mutex );
+            g_sleeping = true;
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+
+            if ( g_ring[ g_tail % LOG_RING_SIZE ].sequence.load( ) != g_tail + 1 && g_running )
+                g_condition.wait_for( lock, std::chrono::milliseconds( 100 ) );
+
+            g_sleeping = false;
+
+        }
+    }
+
+}
+
+Log::Level Log::s_level = Log::Info;
+
+void Log::start( Level level, Format format )
+{
+    for ( unsigned long t = 0; t < LOG_RING_SIZE; ++ t )
+        g_ring[ t ].sequence.store( t );
+
+    s_level = level;
+    g_format = format;
+
+    g_running = true;
+    g_sink = std::thread( & sink );
+
+    std::atexit( & Log::stop );
+}
+
+void Log::start( boost::program_options::variables_map const & options )
+{
+    std::string format = options[ "log-format" ].as< std::string >( );
+
+    if ( format != "text" && format != "jsonl" )
+        throw std::runtime_error( "Invalid log format (text or jsonl expected)." );
+
+    Level level = options.count( "quiet" ) ? Warning : options.count( "verbose" ) ? Verbose : Info;
+
+    start( level, format == "jsonl" ? JsonLines : Text );
+}
+
+void Log::stop( void )
+{
+    if ( ! g_running.exchange( false ) )
+        return ;
+
+    {
+        std::unique_lock< std::mutex > lock( g_mutex );
+        g_condition.notify_one( );
+    }
+
+    g_sink.join( );
+}
+
+void Log::write( Level level, std::string const & message )
+{
+    if ( ! g_running ) {
+        std::string output;
+        format( output, level, message );
+        std::fwrite( output.data( ), 1, output.size( ), stdout );
+        return ;
+    }
+
+    unsigned long position = g_head.load( std::memory_order_relaxed );
+
+    for ( ;; ) {
+
+        Slot & slot = g_ring[ position % LOG_RING_SIZE ];
+        unsigned long sequence = slot.sequence.load( std::memory_order_acquire );
+
+        if ( sequence == position ) {
+
+            if ( g_head.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) ) {
+                slot.level = level;
+                slot.message = message;
+                slot.sequence.store( position + 1, std::memory_order_release );
+                break ;
+            }
+
+        } else if ( sequence < position ) {
+
+            // The ring is full ; let the sink catch up
+
+            if ( g_sleeping ) {
+                std::unique_lock< std::mutex > lock( g_mutex );
+                g_condition.notify_one( );
+            }
+
+            std::this_thread::yield( );
+            position = g_head.load( std::memory_order_relaxed );
+
+        } else {
+
+            position = g_head.load( std::memory_order_relaxed );
+
+        }
+
+    }
+
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+
+    if ( g_sleeping ) {
+        std::unique_lock< std::mutex > lock( g_mutex );
+        g_condition.notify_one( );
+    }
+}
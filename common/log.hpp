@@ -0,0 +1,65 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+namespace boost { namespace program_options { class variables_map; } }
+
+// Messages are pushed into a lock-free ring buffer, and written to the
+// standard output by a background thread. Producers never wait for the
+// output, unless the buffer is full.
+
+class Log
+{
+
+public:
+
+    enum Level {
+        Error,
+        Warning,
+        Info,
+        Verbose
+    };
+
+    enum Format {
+        Text,
+        JsonLines
+    };
+
+public:
+
+    static void start( Level level, Format format );
+
+    // Same thing, from the --quiet, --verbose and --log-format options
+    // shared by the tools (throws for an unknown format).
+
+    static void start( boost::program_options::variables_map const & options );
+
+    static void stop( void );
+
+public:
+
+    inline static bool enabled( Level level );
+
+    static void write( Level level, std::string const & message );
+
+private:
+
+    static Level s_level;
+
+};
+
+bool Log::enabled( Level level )
+{
+    return level <= s_level;
+}
+
+// The message is only built when its level is enabled.
+
+#define LOG( LEVEL, MESSAGE ) do {                                       \
+    if ( Log::enabled( Log::LEVEL ) ) {                                  \
+        std::ostringstream logBuilder;                                   \
+        logBuilder << MESSAGE;                                           \
+        Log::write( Log::LEVEL, logBuilder.str( ) );                     \
+    }                                                                    \
+} while ( 0 )
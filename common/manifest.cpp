@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "hash.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "path.hpp"
+
+Manifest::Manifest( std::string const & root )
+    : m_root( root )
+{
+}
+
+std::string Manifest::relative( std::string const & path ) const
+{
+    if ( path.compare( 0, this->m_root.size( ), this->m_root ) == 0 && path.size( ) > this->m_root.size( ) && path[ this->m_root.size( ) ] == '/' )
+        return path.substr( this->m_root.size( ) + 1 );
+
+    return path;
+}
+
+void Manifest::add( std::string const & path, boost::uint64_t hash, unsigned long size, boost::uint64_t inputs, std::string const & original )
+{
+    Record record = { this->relative( path ), hash, size, inputs, original.empty( ) ? original : this->relative( original ) };
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+    this->m_records.push_back( record );
+}
+
+void Manifest::write( std::string const & path )
+{
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    std::sort( this->m_records.begin( ), this->m_records.end( ), [ ] ( Record const & a, Record const & b ) {
+        return a.path < b.path;
+    } );
+
+    std::ofstream output;
+    Path( path ).open( output );
+
+    for ( Record const & record : this->m_records ) {
+
+        output << Hash::hex( record.hash ) << " " << record.size << " " << Hash::hex( record.inputs ) << " " << record.path;
+
+        if ( ! record.original.empty( ) )
+            output << " = " << record.original;
+
+        output << "\n";
+
+    }
+
+    output.close( );
+}
+
+static bool parseRecord( std::string const & line, Manifest::Record & record )
+{
+    std::istringstream fields( line );
+
+    fields >> std::hex >> record.hash >> std::dec >> record.size >> std::hex >> record.inputs;
+    fields.ignore( 1 );
+    std::getline( fields, record.path );
+
+    if ( ! fields || record.path.empty( ) )
+        return false;
+
+    std::string::size_type separator = record.path.find( " = " );
+    if ( separator != std::string::npos ) {
+        record.original = record.path.substr( separator + 3 );
+        record.path.erase( separator );
+    }
+
+    return true;
+}
+
+void Manifest::read( std::string const & path )
+{
+    std::ifstream input( path.c_str( ) );
+    std::string line;
+
+    while ( std::getline( input, line ) ) {
+
+        Record record;
+
+        if ( parseRecord( line, record ) ) {
+            this->m_previousRecords[ record.path ] = record;
+        }
+
+    }
+}
+
+void Manifest::merge( std::string const & path )
+{
+    std::ifstream input( path.c_str( ) );
+    std::string line;
+
+    if ( ! input )
+        throw std::runtime_error( "Cannot read the manifest " + path + "." );
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    std::set< std::string > paths;
+    for ( Record const & record : this->m_records )
+        paths.insert( record.path );
+
+    while ( std::getline( input, line ) ) {
+
+        Record record;
+
+        if ( ! parseRecord( line, record ) )
+            continue ;
+
+        if ( ! paths.insert( record.path ).second ) {
+            LOG( Warning, record.path << " is recorded twice (last in " << path << ")" );
+            continue ;
+        }
+
+        this->m_records.push_back( record );
+
+    }
+}
+
+unsigned long Manifest::compare( std::string const & path )
+{
+    std::ifstream input( path.c_str( ) );
+    std::string line;
+
+    if ( ! input )
+        throw std::runtime_error( "Cannot read the manifest " + path + "." );
+
+    std::map< std::string, Record > expected;
+
+    while ( std::getline( input, line ) ) {
+
+        Record record;
+
+        if ( parseRecord( line, record ) ) {
+            expected[ record.path ] = record;
+        }
+
+    }
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+
+    std::sort( this->m_records.begin( ), this->m_records.end( ), [ ] ( Record const & a, Record const & b ) {
+        return a.path < b.path;
+    } );
+
+    unsigned long differenceCount = 0;
+
+    for ( Record const & record : this->m_records ) {
+
+        std::map< std::string, Record >::iterator it = expected.find( record.path );
+
+        if ( it == expected.end( ) ) {
+            LOG( Warning, record.path << " : unexpected" );
+        } else if ( it->second.hash != record.hash ) {
+            LOG( Warning, record.path << " : content changed (" << Hash::hex( it->second.hash ) << " expected, " << Hash::hex( record.hash ) << " found)" );
+        } else if ( it->second.size != record.size ) {
+            LOG( Warning, record.path << " : size changed (" << it->second.size << " expected, " << record.size << " found)" );
+        } else if ( it->second.original != record.original ) {
+            LOG( Warning, record.path << " : link changed (" << ( it->second.original.empty( ) ? "none" : it->second.original ) << " expected, " << ( record.original.empty( ) ? "none" : record.original ) << " found)" );
+        } else {
+            expected.erase( it );
+            continue ;
+        }
+
+        differenceCount += 1;
+
+        if ( it != expected.end( ) ) {
+            expected.erase( it );
+        }
+
+    }
+
+    for ( std::pair< std::string const, Record > const & missing : expected ) {
+        LOG( Warning, missing.first << " : missing" );
+        differenceCount += 1;
+    }
+
+    return differenceCount;
+}
+
+Manifest::Record const * Manifest::previous( std::string const & path ) const
+{
+    std::map< std::string, Record >::const_iterator it = this->m_previousRecords.find( this->relative( path ) );
+
+    if ( it == this->m_previousRecords.end( ) )
+        return nullptr;
+
+    boost::system::error_code error;
+    if ( boost::filesystem::file_size( path, error ) != it->second.size || error )
+        return nullptr;
+
+    return & it->second;
+}
+
+bool Manifest::keep( std::string const & path, boost::uint64_t inputs )
+{
+    Record const * record = this->previous( path );
+
+    if ( ! record || record->inputs != inputs )
+        return false;
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+    this->m_records.push_back( * record );
+
+    return true;
+}
+
+bool Manifest::keep( std::string const & path, boost::uint64_t hash, unsigned long size, boost::uint64_t inputs )
+{
+    Record const * record = this->previous( path );
+
+    if ( ! record || record->hash != hash || record->size != size )
+        return false;
+
+    Record updated = * record;
+    updated.inputs = inputs;
+
+    std::unique_lock< std::mutex > lock( this->m_mutex );
+    this->m_records.push_back( updated );
+
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+// List of the files written by a tool, with the hash of the data they were
+// extracted from (the whole entry sectors for the image entries, even when
+// the padding is trimmed), their size, and the hash of everything they
+// were computed from (tool version, options, source data, TIM set).
+//
+// The manifest is written as text, one file per line, sorted by path :
+//
+//     <hash> <size> <inputs> <path>
+//     <hash> <size> <inputs> <path> = <original path>
+//
+// The second form is used for the files which are links to (or clones of)
+// an identical file written earlier. Paths are relative to the output
+// folder of the tool.
+//
+// The manifest of a previous run can be loaded back, so that the files
+// whose inputs did not change are not written again (--incremental).
+
+class Manifest
+{
+
+public:
+
+    struct Record {
+        std::string path;
+        boost::uint64_t hash;
+        unsigned long size;
+        boost::uint64_t inputs;
+        std::string original;
+    };
+
+public:
+
+    Manifest( std::string const & root );
+
+public:
+
+    // Can be called from several threads at once.
+
+    void add( std::string const & path, boost::uint64_t hash, unsigned long size, boost::uint64_t inputs, std::string const & original = "" );
+
+    void write( std::string const & path );
+
+public:
+
+    // Loads the manifest written by a previous run, if there is one.
+
+    void read( std::string const & path );
+
+    // Returns the previous record of a file, or null if the file has not
+    // been recorded or does not have the recorded size anymore.
+
+    Record const * previous( std::string const & path ) const;
+
+    // Records the file again and returns true if the previous run made it
+    // from the same inputs ; it can then be left untouched.
+
+    bool keep( std::string const & path, boost::uint64_t inputs );
+
+    // Same thing, for a content computed in memory : returns true if the
+    // file already holds it, even if it was made from other inputs.
+
+    bool keep( std::string const & path, boost::uint64_t hash, unsigned long size, boost::uint64_t inputs );
+
+public:
+
+    // Adds the records of another manifest (written by another shard of
+    // the same run), without checking the files. The paths recorded twice
+    // are only kept once.
+
+    void merge( std::string const & path );
+
+    inline std::vector< Record > const & records( void ) const;
+
+public:
+
+    // Compares the records with those of a reference manifest (--verify),
+    // logging every file whose content, size or link differs, which is
+    // missing, or which the reference does not have. The inputs are not
+    // compared, since they change with the tool version. Returns the
+    // number of differences.
+
+    unsigned long compare( std::string const & path );
+
+private:
+
+    std::string relative( std::string const & path ) const;
+
+private:
+
+    std::string m_root;
+
+    std::vector< Record > m_records;
+
+    std::map< std::string, Record > m_previousRecords;
+
+    std::mutex m_mutex;
+
+};
+
+std::vector< Manifest::Record > const & Manifest::records( void ) const
+{
+    return this->m_records;
+}
@@ -0,0 +1,364 @@
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "memoryrange.hpp"
+#include "mesh.hpp"
+#include "stats.hpp"
+
+#define MESH_HEADER_LENGTH 28
+
+// Signed deltas are zigzag coded (0, -1, 1, -2, 2 ... become 0, 1, 2, 3,
+// 4 ...), then stored as LEB128 varints : small deltas, whatever their
+// sign, take a single byte.
+
+static boost::uint32_t zigzag( boost::int32_t value )
+{
+    return ( static_cast< boost::uint32_t >( value ) << 1 ) ^ static_cast< boost::uint32_t >( value >> 31 );
+}
+
+static boost::int32_t unzigzag( boost::uint32_t value )
+{
+    return static_cast< boost::int32_t >( value >> 1 ) ^ - static_cast< boost::int32_t >( value & 1 );
+}
+
+static void putVarint( std::vector< boost::uint8_t > & output, boost::uint32_t value )
+{
+    while ( value >= 0x80 ) {
+        output.push_back( ( value & 0x7f ) | 0x80 );
+        value >>= 7;
+    }
+
+    output.push_back( value );
+}
+
+static void putLittle( boost::uint8_t * output, boost::uint32_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t ) {
+        output[ t ] = ( value >> ( t * 8 ) ) & 0xff;
+    }
+}
+
+static boost::uint32_t getLittle( boost::uint8_t const * input, int byteCount )
+{
+    boost::uint32_t value = 0;
+
+    for ( int t = byteCount; t --; )
+        value = ( value << 8 ) | input[ t ];
+
+    return value;
+}
+
+// A cursor over the inflated payload ; every read is bounds checked.
+
+struct Reader {
+
+    boost::uint8_t const * current;
+
+    boost::uint8_t const * end;
+
+    boost::uint8_t byte( void )
+    {
+        if ( this->current == this->end )
+            throw std::runtime_error( "Truncated mesh." );
+
+        return * this->current ++;
+    }
+
+    boost::uint32_t varint( void )
+    {
+        boost::uint32_t value = 0;
+
+        for ( int shift = 0; shift < 35; shift += 7 ) {
+            boost::uint8_t part = this->byte( );
+            value |= static_cast< boost::uint32_t >( part & 0x7f ) << shift;
+            if ( ! ( part & 0x80 ) )
+                return value;
+        }
+
+        throw std::runtime_error( "Invalid mesh : varint too long." );
+    }
+
+};
+
+////////////
+// 4 bytes : magic "FF9M"
+// 2 bytes : version
+// 2 bytes : object count (in each level)
+// 2 bytes : level count
+// 2 bytes : - reserved - (0)
+// 4 bytes : X scale (float)
+// 4 bytes : Y scale (float)
+// 4 bytes : Z scale (float)
+// 4 bytes : payload length (once inflated)
+// then the deflated payload, up to the end of the file :
+//
+// The objects below are those of every level, one level after the other.
+//
+// for each object : vertex, texture coordinate and face counts (varints)
+// for each object : the X deltas, then the Y deltas, then the Z deltas
+//                   between consecutive vertices (zigzag varints)
+// for each object : the U deltas, then the V deltas between consecutive
+//                   texture coordinates (bytes, modulo 256)
+// for each object : the deltas between consecutive vertex indices of the
+//                   faces (zigzag varints)
+// for each object : the deltas between consecutive texture coordinate
+//                   indices, minus one (zigzag varints ; they mostly follow
+//                   each other, so this is mostly zeros)
+// for each object : the texture of each face (bytes)
+
+std::vector< boost::uint8_t > encodeMesh( Mesh const & mesh )
+{
+    STATS_TIMER( timer, "encode mesh" );
+
+    if ( mesh.levelCount == 0 || mesh.levelCount > 0xFFFF || mesh.objects.size( ) % mesh.levelCount )
+        throw std::runtime_error( "Every level of a mesh has to hold the same objects." );
+
+    if ( mesh.objects.size( ) / mesh.levelCount > 0xFFFF )
+        throw std::runtime_error( "Too many objects for a mesh." );
+
+    std::vector< boost::uint8_t > payload;
+
+    for ( BattleScene::Object const & object : mesh.objects ) {
+        putVarint( payload, object.vertices.size( ) );
+        putVarint( payload, object.texCoords.size( ) );
+        putVarint( payload, object.faces.size( ) );
+    }
+
+    for ( BattleScene::Object const & object : mesh.objects ) {
+
+        boost::int32_t previous;
+
+        previous = 0;
+        for ( BattleScene::Vertex const & vertex : object.vertices ) {
+            putVarint( payload, zigzag( vertex.x - previous ) );
+            previous = vertex.x;
+        }
+
+        previous = 0;
+        for ( BattleScene::Vertex const & vertex : object.vertices ) {
+            putVarint( payload, zigzag( vertex.y - previous ) );
+            previous = vertex.y;
+        }
+
+        previous = 0;
+        for ( BattleScene::Vertex const & vertex : object.vertices ) {
+            putVarint( payload, zigzag( vertex.z - previous ) );
+            previous = vertex.z;
+        }
+
+    }
+
+    for ( BattleScene::Object const & object : mesh.objects ) {
+
+        boost::uint8_t previous;
+
+        previous = 0;
+        for ( BattleScene::TexCoord const & texCoord : object.texCoords ) {
+            payload.push_back( static_cast< boost::uint8_t >( texCoord.u - previous ) );
+            previous = texCoord.u;
+        }
+
+        previous = 0;
+        for ( BattleScene::TexCoord const & texCoord : object.texCoords ) {
+            payload.push_back( static_cast< boost::uint8_t >( texCoord.v - previous ) );
+            previous = texCoord.v;
+        }
+
+    }
+
+    for ( BattleScene::Object const & object : mesh.objects ) {
+
+        boost::int32_t previous = 0;
+
+        for ( BattleScene::Face const & face : object.faces ) {
+            for ( int t = 0; t < 3; ++ t ) {
+                putVarint( payload, zigzag( face.vertices[ t ] - previous ) );
+                previous = face.vertices[ t ];
+            }
+        }
+
+    }
+
+    for ( BattleScene::Object const & object : mesh.objects ) {
+
+        boost::int32_t previous = - 1;
+
+        for ( BattleScene::Face const & face : object.faces ) {
+            for ( int t = 0; t < 3; ++ t ) {
+                putVarint( payload, zigzag( face.texCoords[ t ] - previous - 1 ) );
+                previous = face.texCoords[ t ];
+            }
+        }
+
+    }
+
+    for ( BattleScene::Object const & object : mesh.objects )
+        for ( BattleScene::Face const & face : object.faces )
+            payload.push_back( face.texture );
+
+    uLongf compressedLength = compressBound( payload.size( ) );
+    std::vector< boost::uint8_t > output( MESH_HEADER_LENGTH + compressedLength );
+
+    if ( compress2( output.data( ) + MESH_HEADER_LENGTH, & compressedLength, payload.data( ), payload.size( ), Z_BEST_COMPRESSION ) != Z_OK )
+        throw std::runtime_error( "Mesh compression failed." );
+
+    output.resize( MESH_HEADER_LENGTH + compressedLength );
+
+    putLittle( output.data( ) + 0, MESH_MAGIC, 4 );
+    putLittle( output.data( ) + 4, MESH_VERSION, 2 );
+    putLittle( output.data( ) + 6, mesh.objects.size( ) / mesh.levelCount, 2 );
+    putLittle( output.data( ) + 8, mesh.levelCount, 2 );
+
+    for ( int t = 0; t < 3; ++ t ) {
+        boost::uint32_t bits;
+        std::memcpy( & bits, & mesh.scale[ t ], 4 );
+        putLittle( output.data( ) + 12 + t * 4, bits, 4 );
+    }
+
+    putLittle( output.data( ) + 24, payload.size( ), 4 );
+
+    STATS_BYTES( timer, payload.size( ) );
+
+    return output;
+}
+
+Mesh decodeMesh( MemoryRange const & range )
+{
+    STATS_TIMER( timer, "decode mesh" );
+
+    if ( range.size( ) < MESH_HEADER_LENGTH || getLittle( range.begin( ), 4 ) != MESH_MAGIC )
+        throw std::runtime_error( "Not a mesh file." );
+
+    if ( getLittle( range.begin( ) + 4, 2 ) != MESH_VERSION )
+        throw std::runtime_error( "Unsupported mesh version." );
+
+    Mesh mesh;
+
+    mesh.levelCount = getLittle( range.begin( ) + 8, 2 );
+
+    if ( mesh.levelCount == 0 )
+        throw std::runtime_error( "Invalid mesh : no level." );
+
+    unsigned long objectCount = getLittle( range.begin( ) + 6, 2 ) * mesh.levelCount;
+
+    for ( int t = 0; t < 3; ++ t ) {
+        boost::uint32_t bits = getLittle( range.begin( ) + 12 + t * 4, 4 );
+        std::memcpy( & mesh.scale[ t ], & bits, 4 );
+    }
+
+    uLongf payloadLength = getLittle( range.begin( ) + 24, 4 );
+
+    // Deflate cannot shrink data more than about a thousand times
+
+    if ( payloadLength / 1024 > range.size( ) )
+        throw std::runtime_error( "Invalid mesh : wrong payload length." );
+
+    std::vector< boost::uint8_t > payload( payloadLength );
+
+    if ( uncompress( payload.data( ), & payloadLength, range.begin( ) + MESH_HEADER_LENGTH, range.size( ) - MESH_HEADER_LENGTH ) != Z_OK || payloadLength != payload.size( ) )
+        throw std::runtime_error( "Invalid mesh : the payload cannot be inflated." );
+
+    Reader reader = { payload.data( ), payload.data( ) + payload.size( ) };
+
+    // The counts are checked against the payload length before anything is
+    // allocated, each element taking at least one byte
+
+    if ( objectCount * 3 > payload.size( ) )
+        throw std::runtime_error( "Invalid mesh : too many objects." );
+
+    mesh.objects.resize( objectCount );
+
+    for ( BattleScene::Object & object : mesh.objects ) {
+
+        boost::uint32_t vertexCount = reader.varint( );
+        boost::uint32_t texCoordCount = reader.varint( );
+        boost::uint32_t faceCount = reader.varint( );
+
+        if ( vertexCount > 0x10000 || texCoordCount > 0x10000 || faceCount > payload.size( ) )
+            throw std::runtime_error( "Invalid mesh : too many elements." );
+
+        object.vertices.resize( vertexCount );
+        object.texCoords.resize( texCoordCount );
+        object.faces.resize( faceCount );
+
+    }
+
+    for ( BattleScene::Object & object : mesh.objects ) {
+
+        boost::int32_t previous;
+
+        previous = 0;
+        for ( BattleScene::Vertex & vertex : object.vertices )
+            previous = vertex.x = previous + unzigzag( reader.varint( ) );
+
+        previous = 0;
+        for ( BattleScene::Vertex & vertex : object.vertices )
+            previous = vertex.y = previous + unzigzag( reader.varint( ) );
+
+        previous = 0;
+        for ( BattleScene::Vertex & vertex : object.vertices )
+            previous = vertex.z = previous + unzigzag( reader.varint( ) );
+
+    }
+
+    for ( BattleScene::Object & object : mesh.objects ) {
+
+        boost::uint8_t previous;
+
+        previous = 0;
+        for ( BattleScene::TexCoord & texCoord : object.texCoords )
+            previous = texCoord.u = previous + reader.byte( );
+
+        previous = 0;
+        for ( BattleScene::TexCoord & texCoord : object.texCoords )
+            previous = texCoord.v = previous + reader.byte( );
+
+    }
+
+    for ( BattleScene::Object & object : mesh.objects ) {
+
+        boost::int32_t previous = 0;
+
+        for ( BattleScene::Face & face : object.faces ) {
+            for ( int t = 0; t < 3; ++ t ) {
+                previous += unzigzag( reader.varint( ) );
+                if ( previous < 0 || static_cast< boost::uint32_t >( previous ) >= object.vertices.size( ) )
+                    throw std::runtime_error( "Invalid mesh : vertex index out of range." );
+                face.vertices[ t ] = previous;
+            }
+        }
+
+    }
+
+    for ( BattleScene::Object & object : mesh.objects ) {
+
+        boost::int32_t previous = - 1;
+
+        for ( BattleScene::Face & face : object.faces ) {
+            for ( int t = 0; t < 3; ++ t ) {
+                previous += unzigzag( reader.varint( ) ) + 1;
+                if ( previous < 0 || static_cast< boost::uint32_t >( previous ) >= object.texCoords.size( ) )
+                    throw std::runtime_error( "Invalid mesh : texture coordinate index out of range." );
+                face.texCoords[ t ] = previous;
+            }
+        }
+
+    }
+
+    for ( BattleScene::Object & object : mesh.objects )
+        for ( BattleScene::Face & face : object.faces )
+            face.texture = reader.byte( );
+
+    if ( reader.current != reader.end )
+        throw std::runtime_error( "Invalid mesh : trailing data." );
+
+    STATS_BYTES( timer, payload.size( ) );
+
+    return mesh;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "memoryrange.hpp"
+
+// The geometry of a battle scene in a compact binary form (.ff9mesh), which
+// keeps the quantization of the scene : 16 bits positions, with the scale
+// turning them into OBJ units stored once, and 8 bits texture coordinates.
+// The streams are stored one after the other (positions, texture
+// coordinates, indices, textures), delta and zigzag coded, then deflated as
+// a whole.
+//
+// A position ( x, y, z ) is ( x * scale[ 0 ], y * scale[ 1 ], z * scale[ 2 ] )
+// in the OBJ file, and a texture coordinate ( u, v ) is ( u / 255,
+// 1 - v / 255 ). The face textures are the indices of the scene textures.
+//
+// A mesh may hold several levels of detail of the same objects (see
+// simplify.hpp) : the objects of the first level (the full one), then
+// those of the second one, and so on.
+
+#define MESH_MAGIC 0x4D394646 // "FF9M"
+
+#define MESH_VERSION 2
+
+struct Mesh {
+    float scale[ 3 ];
+    unsigned long levelCount;
+    std::vector< BattleScene::Object > objects;
+};
+
+std::vector< boost::uint8_t > encodeMesh( Mesh const & mesh );
+
+// Throws when the data is not a valid mesh.
+
+Mesh decodeMesh( MemoryRange const & range );
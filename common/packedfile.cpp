@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include "memoryrange.hpp"
+#include "packedfile.hpp"
+#include "parse.hpp"
+#include "stats.hpp"
+
+namespace qi = boost::spirit::qi;
+
+////////////
+// Trailer (the last 32 bytes of the archive) :
+//
+// 8 bytes : index offset
+// 8 bytes : uncompressed stream size
+// 4 bytes : block length
+// 4 bytes : block count
+// 4 bytes : file count
+// 4 bytes : magic "FPAK"
+//
+// Index :
+//
+// ( block count + 1 ) * 8 bytes : block offsets, the last one being the
+//                                 index offset
+// for each file :
+//   8 bytes : offset in the uncompressed stream
+//   8 bytes : size
+//   4 bytes : CRC32
+//   2 bytes : name length
+//   n bytes : name
+
+PackedFile::PackedFile( std::string const & path )
+    : m_input( path.c_str( ), std::ios::binary )
+    , m_nextBuffer( 0 )
+{
+    if ( ! this->m_input )
+        throw std::runtime_error( "Cannot open " + path );
+
+    this->m_input.seekg( 0, std::ios::end );
+    boost::uint64_t fileSize = this->m_input.tellg( );
+
+    if ( fileSize < PACKEDFILE_TRAILER_LENGTH )
+        throw std::runtime_error( "Not a pack file : " + path );
+
+    std::vector< boost::uint8_t > trailer( PACKEDFILE_TRAILER_LENGTH );
+
+    this->m_input.seekg( fileSize - PACKEDFILE_TRAILER_LENGTH );
+    this->m_input.read( reinterpret_cast< char * >( trailer.data( ) ), trailer.size( ) );
+
+    MemoryRange trailerRange( trailer );
+
+    boost::uint64_t indexOffset, size;
+    boost::uint32_t blockLength, blockCount, fileCount, magic;
+
+    parse( trailerRange, qi::little_qword, indexOffset );
+    parse( trailerRange, qi::little_qword, size );
+    parse( trailerRange, qi::little_dword, blockLength );
+    parse( trailerRange, qi::little_dword, blockCount );
+    parse( trailerRange, qi::little_dword, fileCount );
+    parse( trailerRange, qi::little_dword, magic );
+
+    if ( magic != PACKEDFILE_MAGIC )
+        throw std::runtime_error( "Not a pack file : " + path );
+
+    if ( blockLength == 0 || indexOffset > fileSize - PACKEDFILE_TRAILER_LENGTH || ( size + blockLength - 1 ) / blockLength != blockCount )
+        throw std::runtime_error( "Corrupted pack index : " + path );
+
+    this->m_size = size;
+    this->m_blockLength = blockLength;
+
+    std::vector< boost::uint8_t > index( fileSize - PACKEDFILE_TRAILER_LENGTH - indexOffset );
+
+    this->m_input.seekg( indexOffset );
+    this->m_input.read( reinterpret_cast< char * >( index.data( ) ), index.size( ) );
+
+    MemoryRange indexRange( index );
+
+    this->m_blockOffsets.resize( blockCount + 1 );
+
+    for ( boost::uint64_t & blockOffset : this->m_blockOffsets )
+        parse( indexRange, qi::little_qword, blockOffset );
+
+    for ( unsigned long blockIndex = 0; blockIndex < blockCount; ++ blockIndex ) {
+        if ( this->m_blockOffsets[ blockIndex ] > this->m_blockOffsets[ blockIndex + 1 ] || this->m_blockOffsets[ blockIndex + 1 ] > indexOffset ) {
+            throw std::runtime_error( "Corrupted pack index : " + path );
+        }
+    }
+
+    for ( unsigned long fileIndex = 0; fileIndex < fileCount; ++ fileIndex ) {
+
+        Entry entry;
+        boost::uint16_t nameLength;
+
+        parse( indexRange, qi::little_qword, entry.offset );
+        parse( indexRange, qi::little_qword, entry.size );
+        parse( indexRange, qi::little_dword, entry.crc );
+        parse( indexRange, qi::little_word, nameLength );
+
+        if ( nameLength > static_cast< unsigned long >( indexRange.end( ) - indexRange.current( ) ) || entry.offset > size || entry.size > size - entry.offset )
+            throw std::runtime_error( "Corrupted pack index : " + path );
+
+        entry.name.assign( indexRange.current( ), indexRange.current( ) + nameLength );
+        indexRange.seek( MemoryRange::SeekCur, nameLength );
+
+        this->m_entries.push_back( entry );
+
+    }
+
+    this->m_buffers.resize( PACKEDFILE_BUFFER_COUNT );
+}
+
+PackedFile::Entry const * PackedFile::find( std::string const & name ) const
+{
+    for ( Entry const & entry : this->m_entries )
+        if ( entry.name == name )
+            return & entry;
+
+    return nullptr;
+}
+
+void PackedFile::inflateBlock( unsigned long blockIndex, boost::uint8_t * output )
+{
+    STATS_TIMER( timer, "inflate" );
+
+    unsigned long blockOffset = blockIndex * this->m_blockLength;
+    uLongf length = std::min( this->m_blockLength, this->m_size - blockOffset );
+
+    std::vector< boost::uint8_t > compressed( this->m_blockOffsets[ blockIndex + 1 ] - this->m_blockOffsets[ blockIndex ] );
+
+    this->m_input.seekg( this->m_blockOffsets[ blockIndex ] );
+    this->m_input.read( reinterpret_cast< char * >( compressed.data( ) ), compressed.size( ) );
+
+    if ( ! this->m_input )
+        throw std::runtime_error( "Read failed." );
+
+    // The blocks which deflate could not shrink are stored as is
+
+    if ( compressed.size( ) >= length ) {
+        std::copy( compressed.begin( ), compressed.begin( ) + length, output );
+    } else if ( uncompress( output, & length, compressed.data( ), compressed.size( ) ) != Z_OK || length != std::min( this->m_blockLength, this->m_size - blockOffset ) ) {
+        throw std::runtime_error( "Corrupted pack block." );
+    }
+
+    STATS_BYTES( timer, length );
+}
+
+MemoryRange PackedFile::map( unsigned long offset, unsigned long size )
+{
+    if ( offset > this->m_size || size > this->m_size - offset )
+        throw std::runtime_error( "Out of bounds pack read." );
+
+    if ( size == 0 )
+        return MemoryRange( nullptr, nullptr );
+
+    unsigned long firstBlock = offset / this->m_blockLength;
+    unsigned long blockCount = ( offset + size - 1 ) / this->m_blockLength - firstBlock + 1;
+
+    // The blocks may still be inflated from a previous call
+
+    for ( Buffer const & buffer : this->m_buffers ) {
+        if ( buffer.blockCount && buffer.firstBlock <= firstBlock && firstBlock + blockCount <= buffer.firstBlock + buffer.blockCount ) {
+            boost::uint8_t const * begin = buffer.data.data( ) + ( offset - buffer.firstBlock * this->m_blockLength );
+            return MemoryRange( begin, begin + size );
+        }
+    }
+
+    Buffer & buffer = this->m_buffers[ this->m_nextBuffer ];
+    this->m_nextBuffer = ( this->m_nextBuffer + 1 ) % this->m_buffers.size( );
+
+    buffer.firstBlock = firstBlock;
+    buffer.blockCount = 0;
+    buffer.data.resize( blockCount * this->m_blockLength );
+
+    for ( unsigned long t = 0; t < blockCount; ++ t )
+        this->inflateBlock( firstBlock + t, buffer.data.data( ) + t * this->m_blockLength );
+
+    buffer.blockCount = blockCount;
+
+    boost::uint8_t const * begin = buffer.data.data( ) + ( offset - firstBlock * this->m_blockLength );
+    return MemoryRange( begin, begin + size );
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// Read-only access to a .ff9pack archive (see Bundle) : the files it holds
+// are byte ranges of a single stream, cut into independently deflated
+// blocks. Only the blocks covering the requested range are read and
+// inflated, so random accesses stay cheap.
+//
+// The ranges returned by map( ) stay valid until the ring wraps around to
+// their buffer, that is for at least PACKEDFILE_BUFFER_COUNT - 1 calls.
+
+#define PACKEDFILE_BLOCK_LENGTH ( 64 * 1024 )
+
+#define PACKEDFILE_TRAILER_LENGTH 32
+
+#define PACKEDFILE_MAGIC 0x4B415046 // "FPAK"
+
+#define PACKEDFILE_BUFFER_COUNT 4
+
+class PackedFile
+{
+
+public:
+
+    struct Entry {
+        std::string name;
+        boost::uint64_t offset;
+        boost::uint64_t size;
+        boost::uint32_t crc;
+    };
+
+public:
+
+    PackedFile( std::string const & path );
+
+public:
+
+    inline unsigned long size( void ) const;
+
+    inline std::vector< Entry > const & entries( void ) const;
+
+    // Returns nullptr when no file has this name.
+
+    Entry const * find( std::string const & name ) const;
+
+public:
+
+    MemoryRange map( unsigned long offset, unsigned long size );
+
+    inline MemoryRange map( Entry const & entry );
+
+private:
+
+    struct Buffer {
+        unsigned long firstBlock;
+        unsigned long blockCount;
+        std::vector< boost::uint8_t > data;
+    };
+
+    void inflateBlock( unsigned long blockIndex, boost::uint8_t * output );
+
+private:
+
+    std::ifstream m_input;
+
+    unsigned long m_size;
+
+    unsigned long m_blockLength;
+
+    std::vector< boost::uint64_t > m_blockOffsets;
+
+    std::vector< Entry > m_entries;
+
+    std::vector< Buffer > m_buffers;
+
+    unsigned int m_nextBuffer;
+
+};
+
+unsigned long PackedFile::size( void ) const
+{
+    return this->m_size;
+}
+
+std::vector< PackedFile::Entry > const & PackedFile::entries( void ) const
+{
+    return this->m_entries;
+}
+
+MemoryRange PackedFile::map( Entry const & entry )
+{
+    return this->map( entry.offset, entry.size );
+}
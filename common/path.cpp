@@ -1,5 +1,8 @@
 #include <algorithm>
 #include <fstream>
+#include <functional>
+#include <ostream>
+#include <sstream>
 #include <string>
 #include <utility>
 
@@ -9,8 +12,10 @@
 #include <boost/tokenizer.hpp>
 #include <boost/cstdint.hpp>
 
+#include "bundle.hpp"
 #include "memoryrange.hpp"
 #include "path.hpp"
+#include "stats.hpp"
 
 static boost::uint16_t native_to_little_u16( boost::uint16_t n ) {
     // todo if someone ask for it.
@@ -24,6 +29,8 @@ static boost::uint32_t native_to_little_u32( boost::uint32_t n ) {
     return n;
 }
 
+Bundle * Path::s_bundle = nullptr;
+
 Path::Path( std::string const & orig )
 {
     typedef boost::char_separator< char > separator;
@@ -39,6 +46,8 @@ Path::Path( std::string const & orig )
 
 std::vector< boost::uint8_t > Path::read( void ) const
 {
+    STATS_TIMER( timer, "read" );
+
     boost::filesystem::path pathname( this->string( ) );
 
     std::ifstream file( pathname.string( ).c_str( ), std::ios::in | std::ios::binary | std::ios::ate );
@@ -49,10 +58,30 @@ std::vector< boost::uint8_t > Path::read( void ) const
     file.read( reinterpret_cast< char * >( & data[ 0 ] ), size );
     file.close( );
 
-    return std::move( data );
+    STATS_BYTES( timer, data.size( ) );
+
+    return data;
 }
 
-Path const & Path::dump( char const * data, unsigned int size ) const
+std::vector< boost::uint8_t > Path::read( unsigned long maxSize ) const
+{
+    STATS_TIMER( timer, "read" );
+
+    boost::filesystem::path pathname( this->string( ) );
+
+    std::ifstream file( pathname.string( ).c_str( ), std::ios::in | std::ios::binary );
+
+    std::vector< boost::uint8_t > data( maxSize );
+    file.read( reinterpret_cast< char * >( & data[ 0 ] ), maxSize );
+    data.resize( file.gcount( ) );
+    file.close( );
+
+    STATS_BYTES( timer, data.size( ) );
+
+    return data;
+}
+
+Path const & Path::open( std::ofstream & output ) const
 {
     boost::filesystem::path pathname( this->string( ) );
 
@@ -60,15 +89,61 @@ Path const & Path::dump( char const * data, unsigned int size ) const
     if ( ! dirname.empty( ) )
         boost::filesystem::create_directories( dirname );
 
-    std::ofstream output;
     output.exceptions( std::ios_base::failbit | std::ios_base::badbit );
     output.open( pathname.string( ).c_str( ), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
-    output.write( data, size );
+
+    return * this;
+}
+
+void Path::bundle( Bundle * bundle )
+{
+    s_bundle = bundle;
+}
+
+Bundle * Path::bundle( void )
+{
+    return s_bundle;
+}
+
+Path const & Path::dump( std::function< void ( std::ostream & ) > const & writer ) const
+{
+    if ( s_bundle ) {
+
+        std::ostringstream buffer;
+        writer( buffer );
+
+        std::string const & data = buffer.str( );
+        s_bundle->add( this->string( ), data.data( ), data.size( ) );
+
+        return * this;
+
+    }
+
+    STATS_TIMER( timer, "write" );
+
+    std::ofstream output;
+    this->open( output );
+    writer( output );
+    STATS_BYTES( timer, output.tellp( ) );
+    STATS_COUNT( "files written", 1 );
+
     output.close( );
 
     return * this;
 }
 
+Path const & Path::dump( char const * data, unsigned int size ) const
+{
+    if ( s_bundle ) {
+        s_bundle->add( this->string( ), data, size );
+        return * this;
+    }
+
+    return this->dump( [ data, size ] ( std::ostream & output ) {
+            output.write( data, size );
+    } );
+}
+
 Path const & Path::dump( MemoryRange const & range ) const
 {
     return this->dump( reinterpret_cast< char const * >( range.current( ) ), range.end( ) - range.current( ) );
@@ -81,85 +156,92 @@ Path const & Path::dump( std::string const & text ) const
 
 Path const & Path::dumpBmp( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data ) const
 {
-    boost::filesystem::path pathname( this->string( ) );
+    return this->dump( [ width, height, & data ] ( std::ostream & output ) {
+
+        boost::uint32_t rowByteCount = width * 3;
+        if ( rowByteCount % 4 )
+            rowByteCount += 4 - width % 4;
+
+        boost::uint16_t littleEndianSize = native_to_little_u32( 14 + 12 + rowByteCount * height );
+
+        output.write( "\x42\x4d", 2 );
+        output.write( reinterpret_cast< char const * >( & littleEndianSize ), 4 );
+        output.write( "\x00\x00", 2 );
+        output.write( "\x00\x00", 2 );
+        output.write( "\x00\x00\x00\x00", 4 );
+
+        boost::uint16_t littleEndianWidth = native_to_little_u32( width );
+        boost::uint16_t littleEndianHeight = native_to_little_u32( height );
+
+        output.write( "\x0c\x00\x00\x00", 4 );
+        output.write( reinterpret_cast< char const * >( & littleEndianWidth ), 2 );
+        output.write( reinterpret_cast< char const * >( & littleEndianHeight ), 2 );
+        output.write( "\x01\x00", 2 );
+        output.write( "\x18\x00", 2 );
+
+        boost::uint8_t * bmpdata = new boost::uint8_t[ rowByteCount * height ];
+        for ( boost::uint16_t y = 0; y < height; ++ y ) {
+            for ( boost::uint16_t x = 0; x < width; ++ x ) {
+                boost::uint32_t color = data[ ( height - y - 1 ) * width + x ];
+                bmpdata[ y * rowByteCount + x * 3 + 0 ] = ( color >>  0 ) & 0xFF;
+                bmpdata[ y * rowByteCount + x * 3 + 1 ] = ( color >>  8 ) & 0xFF;
+                bmpdata[ y * rowByteCount + x * 3 + 2 ] = ( color >> 16 ) & 0xFF;
+            }
+        }
 
-    std::string dirname = pathname.parent_path( ).string( );
-    if ( ! dirname.empty( ) )
-        boost::filesystem::create_directories( dirname );
+        output.write( reinterpret_cast< char const * >( bmpdata ), rowByteCount * height );
+        delete[] bmpdata;
 
-    std::ofstream output;
-    output.exceptions( std::ios_base::failbit | std::ios_base::badbit );
-    output.open( pathname.string( ).c_str( ), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+    } );
+}
 
-    boost::uint32_t rowByteCount = width * 3;
-    if ( rowByteCount % 4 )
-        rowByteCount += 4 - width % 4;
-
-    boost::uint16_t littleEndianSize = native_to_little_u32( 14 + 12 + rowByteCount * height );
-
-    output.write( "\x42\x4d", 2 );
-    output.write( reinterpret_cast< char const * >( & littleEndianSize ), 4 );
-    output.write( "\x00\x00", 2 );
-    output.write( "\x00\x00", 2 );
-    output.write( "\x00\x00\x00\x00", 4 );
-
-    boost::uint16_t littleEndianWidth = native_to_little_u32( width );
-    boost::uint16_t littleEndianHeight = native_to_little_u32( height );
-
-    output.write( "\x0c\x00\x00\x00", 4 );
-    output.write( reinterpret_cast< char const * >( & littleEndianWidth ), 2 );
-    output.write( reinterpret_cast< char const * >( & littleEndianHeight ), 2 );
-    output.write( "\x01\x00", 2 );
-    output.write( "\x18\x00", 2 );
-
-    boost::uint8_t * bmpdata = new boost::uint8_t[ rowByteCount * height ];
-    for ( boost::uint16_t y = 0; y < height; ++ y ) {
-        for ( boost::uint16_t x = 0; x < width; ++ x ) {
-            boost::uint32_t color = data[ ( height - y - 1 ) * width + x ];
-            bmpdata[ y * rowByteCount + x * 3 + 0 ] = ( color >>  0 ) & 0xFF;
-            bmpdata[ y * rowByteCount + x * 3 + 1 ] = ( color >>  8 ) & 0xFF;
-            bmpdata[ y * rowByteCount + x * 3 + 2 ] = ( color >> 16 ) & 0xFF;
-        }
-    }
+Path const & Path::dumpTga( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data ) const
+{
+    return this->dump( [ width, height, & data ] ( std::ostream & output ) {
 
-    output.write( reinterpret_cast< char const * >( bmpdata ), rowByteCount * height );
-    delete[] bmpdata;
+        boost::uint16_t littleEndianWidth = native_to_little_u16( width );
+        boost::uint16_t littleEndianHeight = native_to_little_u16( height );
 
-    output.close( );
+        output.write( "\x00\x00\x02", 3 );                                           // no ID field, no color map, uncompressed true-color
+        output.write( "\x00\x00\x00\x00\x00", 5 );                                   // color palette (no)
+        output.write( "\x00\x00\x00\x00", 4 );                                       // image origin (x:0 & y:0)
+        output.write( reinterpret_cast< char const * >( & littleEndianWidth ), 2 );  // image width
+        output.write( reinterpret_cast< char const * >( & littleEndianHeight ), 2 ); // image height
+        output.write( "\x20", 1 );                                                   // bpp (32)
+        output.write( "\x20", 1 );                                                   // descriptor (origin in upper left-hand)
 
-    return * this;
+        boost::uint32_t littleEndianData[ width * height ];
+        std::transform( data.begin( ), data.end( ), littleEndianData, & native_to_little_u32 );
+        output.write( reinterpret_cast< char const * >( & littleEndianData ), sizeof( littleEndianData ) );
+
+    } );
 }
 
-Path const & Path::dumpTga( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data ) const
+Path const & Path::dumpDds( boost::uint16_t width, boost::uint16_t height, char const * fourCC, std::vector< std::vector< boost::uint8_t > > const & levels ) const
 {
-    boost::filesystem::path pathname( this->string( ) );
+    return this->dump( [ width, height, fourCC, & levels ] ( std::ostream & output ) {
 
-    std::string dirname = pathname.parent_path( ).string( );
-    if ( ! dirname.empty( ) )
-        boost::filesystem::create_directories( dirname );
-
-    std::ofstream output;
-    output.exceptions( std::ios_base::failbit | std::ios_base::badbit );
-    output.open( pathname.string( ).c_str( ), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+        boost::uint32_t header[ 31 ] = { };
 
-    boost::uint16_t littleEndianWidth = native_to_little_u16( width );
-    boost::uint16_t littleEndianHeight = native_to_little_u16( height );
+        header[  0 ] = native_to_little_u32( 124 );                                  // header size
+        header[  1 ] = native_to_little_u32( 0x000A1007 );                           // caps, height, width, pixel format, mipmap count, linear size
+        header[  2 ] = native_to_little_u32( height );
+        header[  3 ] = native_to_little_u32( width );
+        header[  4 ] = native_to_little_u32( levels.empty( ) ? 0 : levels[ 0 ].size( ) );
+        header[  6 ] = native_to_little_u32( levels.size( ) );
+        header[ 18 ] = native_to_little_u32( 32 );                                   // pixel format size
+        header[ 19 ] = native_to_little_u32( 0x00000004 );                           // fourcc
+        header[ 26 ] = native_to_little_u32( 0x00401008 );                           // texture, complex, mipmap
 
-    output.write( "\x00\x00\x02", 3 );                                           // no ID field, no color map, uncompressed true-color
-    output.write( "\x00\x00\x00\x00\x00", 5 );                                   // color palette (no)
-    output.write( "\x00\x00\x00\x00", 4 );                                       // image origin (x:0 & y:0)
-    output.write( reinterpret_cast< char const * >( & littleEndianWidth ), 2 );  // image width
-    output.write( reinterpret_cast< char const * >( & littleEndianHeight ), 2 ); // image height
-    output.write( "\x20", 1 );                                                   // bpp (32)
-    output.write( "\x20", 1 );                                                   // descriptor (origin in upper left-hand)
+        std::copy( fourCC, fourCC + 4, reinterpret_cast< char * >( & header[ 20 ] ) );
 
-    boost::uint32_t littleEndianData[ width * height ];
-    std::transform( data.begin( ), data.end( ), littleEndianData, & native_to_little_u32 );
-    output.write( reinterpret_cast< char const * >( & littleEndianData ), sizeof( littleEndianData ) );
+        output.write( "DDS ", 4 );
+        output.write( reinterpret_cast< char const * >( header ), sizeof( header ) );
 
-    output.close( );
+        for ( std::vector< boost::uint8_t > const & level : levels )
+            output.write( reinterpret_cast< char const * >( & level[ 0 ] ), level.size( ) );
 
-    return * this;
+    } );
 }
 
 std::string Path::filename( void ) const
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <fstream>
+#include <functional>
 #include <list>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -8,6 +11,8 @@
 
 #include "memoryrange.hpp"
 
+class Bundle;
+
 class Path
 {
 
@@ -35,6 +40,14 @@ public:
 
     std::vector< boost::uint8_t > read( void ) const;
 
+    std::vector< boost::uint8_t > read( unsigned long maxSize ) const;
+
+public:
+
+    // Creates the parent directories, then opens the file for writing.
+
+    Path const & open( std::ofstream & output ) const;
+
 public:
 
     Path const & dump( char const * data, unsigned int size ) const;
@@ -47,8 +60,25 @@ public:
 
     Path const & dumpTga( boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data ) const;
 
+    Path const & dumpDds( boost::uint16_t width, boost::uint16_t height, char const * fourCC, std::vector< std::vector< boost::uint8_t > > const & levels ) const;
+
+public:
+
+    // Sends the dumped files into an archive rather than to the filesystem
+    // (or back to the filesystem, with a null bundle).
+
+    static void bundle( Bundle * bundle );
+
+    static Bundle * bundle( void );
+
 private:
 
+    Path const & dump( std::function< void ( std::ostream & ) > const & writer ) const;
+
+private:
+
+    static Bundle * s_bundle;
+
     std::list< std::string > m_partList;
 
 };
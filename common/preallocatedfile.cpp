@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "preallocatedfile.hpp"
+#include "stats.hpp"
+
+PreallocatedFile::PreallocatedFile( std::string const & path, unsigned long long size )
+    : m_path( path )
+    , m_size( size )
+{
+    boost::filesystem::path parent = boost::filesystem::path( path ).parent_path( );
+
+    if ( ! parent.empty( ) )
+        boost::filesystem::create_directories( parent );
+
+    this->m_fd = open( path.c_str( ), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    if ( this->m_fd < 0 )
+        throw std::runtime_error( "Cannot create " + path + " (" + std::strerror( errno ) + ")" );
+
+    // The blocks are reserved when the filesystem supports it, so that the
+    // parallel writes don't fragment the file ; the size is set anyway
+
+    posix_fallocate( this->m_fd, 0, size );
+
+    if ( ftruncate( this->m_fd, size ) < 0 ) {
+        ::close( this->m_fd );
+        throw std::runtime_error( "Cannot resize " + path + " (" + std::strerror( errno ) + ")" );
+    }
+}
+
+PreallocatedFile::~PreallocatedFile( void )
+{
+    if ( this->m_fd >= 0 ) {
+        ::close( this->m_fd );
+    }
+}
+
+void PreallocatedFile::write( unsigned long long offset, void const * data, unsigned long size )
+{
+    STATS_TIMER( timer, "write" );
+
+    if ( offset + size > this->m_size )
+        throw std::runtime_error( "Write past the end of " + this->m_path );
+
+    char const * current = static_cast< char const * >( data );
+
+    while ( size ) {
+
+        ssize_t written = pwrite( this->m_fd, current, size, offset );
+
+        if ( written < 0 && errno == EINTR )
+            continue ;
+
+        if ( written <= 0 )
+            throw std::runtime_error( "Cannot write " + this->m_path + " (" + std::strerror( errno ) + ")" );
+
+        current += written;
+        offset += written;
+        size -= written;
+
+    }
+
+    STATS_BYTES( timer, current - static_cast< char const * >( data ) );
+}
+
+void PreallocatedFile::copy( unsigned long long offset, std::string const & path, unsigned long long size )
+{
+    int source = open( path.c_str( ), O_RDONLY );
+
+    if ( source < 0 )
+        throw std::runtime_error( "Cannot open " + path + " (" + std::strerror( errno ) + ")" );
+
+    std::vector< char > chunk( PREALLOCATEDFILE_CHUNK_LENGTH );
+
+    for ( unsigned long long copied = 0; copied < size; ) {
+
+        ssize_t length;
+
+        {
+            STATS_TIMER( timer, "read" );
+            length = pread( source, chunk.data( ), std::min< unsigned long long >( chunk.size( ), size - copied ), copied );
+            STATS_BYTES( timer, length > 0 ? length : 0 );
+        }
+
+        if ( length < 0 && errno == EINTR )
+            continue ;
+
+        if ( length <= 0 ) {
+            ::close( source );
+            throw std::runtime_error( "Cannot read " + path + " (" + ( length < 0 ? std::strerror( errno ) : "file shrunk" ) + ")" );
+        }
+
+        this->write( offset + copied, chunk.data( ), length );
+        copied += length;
+
+    }
+
+    ::close( source );
+}
+
+void PreallocatedFile::close( void )
+{
+    if ( ::close( this->m_fd ) < 0 )
+        throw std::runtime_error( "Cannot write " + this->m_path + " (" + std::strerror( errno ) + ")" );
+
+    this->m_fd = -1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+// Output file whose final size is set on creation, then written at
+// arbitrary offsets, from several threads at once : each write goes
+// straight to its offset (pwrite), and the areas never written read back
+// as zeros. Used by the repackers, which plan the whole layout first.
+
+#define PREALLOCATEDFILE_CHUNK_LENGTH ( 1024 * 1024 )
+
+class PreallocatedFile
+{
+
+public:
+
+    PreallocatedFile( std::string const & path, unsigned long long size );
+
+    ~PreallocatedFile( void );
+
+public:
+
+    inline unsigned long long size( void ) const;
+
+public:
+
+    void write( unsigned long long offset, void const * data, unsigned long size );
+
+    // Copies the first size bytes of a file at offset, by chunks of
+    // PREALLOCATEDFILE_CHUNK_LENGTH bytes.
+
+    void copy( unsigned long long offset, std::string const & path, unsigned long long size );
+
+    void close( void );
+
+private:
+
+    std::string m_path;
+
+    unsigned long long m_size;
+
+    int m_fd;
+
+};
+
+unsigned long long PreallocatedFile::size( void ) const
+{
+    return this->m_size;
+}
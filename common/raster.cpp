@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "constants.hpp"
+#include "raster.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "vram.hpp"
+
+#define RASTER_TILE_SIZE     32
+#define RASTER_SUBPIXEL_BITS  4
+
+#define RASTER_FIELD_OF_VIEW 50.0f
+#define RASTER_AZIMUTH       45.0f
+#define RASTER_ELEVATION     30.0f
+
+#define RADIANS( DEGREES ) ( ( DEGREES ) * 3.14159265f / 180.0f )
+
+// Color of the faces whose texture is not part of the scene (opaque, as
+// its STP bit is clear).
+
+#define RASTER_MISSING_TEXEL 0x00808080
+
+// A vertex once projected : its position in the image, in pixels, and the
+// inverse of its depth.
+
+struct Projected {
+    float x, y;
+    float inverseDepth;
+};
+
+// A triangle ready to be rasterized. The edge equations are evaluated at
+// the pixel centers, in fixed point ; the texture coordinates are divided
+// by the depth, so that they can be interpolated linearly in the image.
+
+struct Triangle {
+    int minX, minY, maxX, maxY;
+    long long a[ 3 ], b[ 3 ], c[ 3 ];
+    float inverseArea;
+    float inverseDepth[ 3 ];
+    float u[ 3 ];
+    float v[ 3 ];
+    boost::uint32_t const * texture;
+};
+
+static bool setupTriangle( Projected const * corners[ 3 ], BattleScene::TexCoord const * texCoords[ 3 ], boost::uint32_t const * texture, int width, int height, Triangle & triangle )
+{
+    long long x[ 3 ], y[ 3 ];
+
+    for ( int t = 0; t < 3; ++ t ) {
+        x[ t ] = std::llround( corners[ t ]->x * ( 1 << RASTER_SUBPIXEL_BITS ) );
+        y[ t ] = std::llround( corners[ t ]->y * ( 1 << RASTER_SUBPIXEL_BITS ) );
+    }
+
+    long long area = ( x[ 2 ] - x[ 1 ] ) * ( y[ 0 ] - y[ 1 ] ) - ( y[ 2 ] - y[ 1 ] ) * ( x[ 0 ] - x[ 1 ] );
+
+    if ( area == 0 )
+        return false;
+
+    // Both windings are drawn : the second one is turned into the first
+
+    if ( area < 0 ) {
+        std::swap( corners[ 1 ], corners[ 2 ] );
+        std::swap( texCoords[ 1 ], texCoords[ 2 ] );
+        std::swap( x[ 1 ], x[ 2 ] );
+        std::swap( y[ 1 ], y[ 2 ] );
+        area = - area;
+    }
+
+    float minX = std::min( corners[ 0 ]->x, std::min( corners[ 1 ]->x, corners[ 2 ]->x ) );
+    float maxX = std::max( corners[ 0 ]->x, std::max( corners[ 1 ]->x, corners[ 2 ]->x ) );
+    float minY = std::min( corners[ 0 ]->y, std::min( corners[ 1 ]->y, corners[ 2 ]->y ) );
+    float maxY = std::max( corners[ 0 ]->y, std::max( corners[ 1 ]->y, corners[ 2 ]->y ) );
+
+    triangle.minX = std::max( 0, static_cast< int >( std::floor( minX ) ) );
+    triangle.maxX = std::min( width - 1, static_cast< int >( std::ceil( maxX ) ) );
+    triangle.minY = std::max( 0, static_cast< int >( std::floor( minY ) ) );
+    triangle.maxY = std::min( height - 1, static_cast< int >( std::ceil( maxY ) ) );
+
+    if ( triangle.minX > triangle.maxX || triangle.minY > triangle.maxY )
+        return false;
+
+    // The edge i is the one facing the corner i. Pixels lying exactly on an
+    // edge only belong to the triangle if the edge is a top or a left one,
+    // so that the pixels shared by two triangles are only drawn once.
+
+    for ( int t = 0; t < 3; ++ t ) {
+
+        int j = ( t + 1 ) % 3, k = ( t + 2 ) % 3;
+
+        triangle.a[ t ] = y[ j ] - y[ k ];
+        triangle.b[ t ] = x[ k ] - x[ j ];
+        triangle.c[ t ] = - triangle.a[ t ] * x[ j ] - triangle.b[ t ] * y[ j ];
+
+        if ( ! ( triangle.a[ t ] > 0 || ( triangle.a[ t ] == 0 && triangle.b[ t ] > 0 ) ) )
+            triangle.c[ t ] -= 1;
+
+        triangle.inverseDepth[ t ] = corners[ t ]->inverseDepth;
+        triangle.u[ t ] = texCoords[ t ]->u * corners[ t ]->inverseDepth;
+        triangle.v[ t ] = texCoords[ t ]->v * corners[ t ]->inverseDepth;
+
+    }
+
+    triangle.inverseArea = 1.0f / static_cast< float >( area );
+    triangle.texture = texture;
+
+    return true;
+}
+
+static boost::uint32_t sample( Triangle const & triangle, float w0, float w1, float w2, float inverseDepth )
+{
+    if ( ! triangle.texture )
+        return RASTER_MISSING_TEXEL;
+
+    float u = ( w0 * triangle.u[ 0 ] + w1 * triangle.u[ 1 ] + w2 * triangle.u[ 2 ] ) / inverseDepth;
+    float v = ( w0 * triangle.v[ 0 ] + w1 * triangle.v[ 1 ] + w2 * triangle.v[ 2 ] ) / inverseDepth;
+
+    int x = std::min( std::max( static_cast< int >( u ), 0 ), BATTLESCENE_TEXTURE_WIDTH - 1 );
+    int y = std::min( std::max( static_cast< int >( v ), 0 ), BATTLESCENE_TEXTURE_HEIGHT - 1 );
+
+    return triangle.texture[ y * BATTLESCENE_TEXTURE_WIDTH + x ];
+}
+
+static boost::uint32_t blend( boost::uint32_t back, boost::uint32_t front )
+{
+    if ( ( back >> 24 ) == 0 )
+        return 0x80000000 | ( front & 0xffffff );
+
+    return ( back & 0xff000000 ) | ( ( ( back & 0xfefefe ) >> 1 ) + ( ( front & 0xfefefe ) >> 1 ) );
+}
+
+// The opaque texels are drawn first, writing the depth ; the blended ones
+// are drawn over them, in the scene order, only testing it.
+//
+// The edge equations of a whole row span are evaluated at once, into
+// plain arrays, so that the compiler can vectorize the coverage test ; the
+// covered pixels are then shaded one by one.
+
+static void renderTile( std::vector< Triangle > const & triangles, std::vector< unsigned long > const & bin, int left, int top, int width, int height, boost::uint32_t * image, int imageWidth )
+{
+    boost::uint32_t color[ RASTER_TILE_SIZE * RASTER_TILE_SIZE ] = { };
+    float depth[ RASTER_TILE_SIZE * RASTER_TILE_SIZE ] = { };
+
+    long long e0[ RASTER_TILE_SIZE ], e1[ RASTER_TILE_SIZE ], e2[ RASTER_TILE_SIZE ];
+    int covered[ RASTER_TILE_SIZE ];
+
+    for ( int pass = 0; pass < 2; ++ pass ) {
+
+        for ( unsigned long triangleIndex : bin ) {
+
+            Triangle const & triangle = triangles[ triangleIndex ];
+
+            int x0 = std::max( triangle.minX, left ), x1 = std::min( triangle.maxX, left + width - 1 );
+            int y0 = std::max( triangle.minY, top ), y1 = std::min( triangle.maxY, top + height - 1 );
+
+            int span = x1 - x0 + 1;
+
+            for ( int y = y0; y <= y1 && span > 0; ++ y ) {
+
+                long long px = ( static_cast< long long >( x0 ) << RASTER_SUBPIXEL_BITS ) + ( 1 << ( RASTER_SUBPIXEL_BITS - 1 ) );
+                long long py = ( static_cast< long long >( y ) << RASTER_SUBPIXEL_BITS ) + ( 1 << ( RASTER_SUBPIXEL_BITS - 1 ) );
+
+                long long row0 = triangle.a[ 0 ] * px + triangle.b[ 0 ] * py + triangle.c[ 0 ], step0 = triangle.a[ 0 ] << RASTER_SUBPIXEL_BITS;
+                long long row1 = triangle.a[ 1 ] * px + triangle.b[ 1 ] * py + triangle.c[ 1 ], step1 = triangle.a[ 1 ] << RASTER_SUBPIXEL_BITS;
+                long long row2 = triangle.a[ 2 ] * px + triangle.b[ 2 ] * py + triangle.c[ 2 ], step2 = triangle.a[ 2 ] << RASTER_SUBPIXEL_BITS;
+
+                int any = 0;
+
+                for ( int t = 0; t < span; ++ t ) {
+                    e0[ t ] = row0 + step0 * t;
+                    e1[ t ] = row1 + step1 * t;
+                    e2[ t ] = row2 + step2 * t;
+                    covered[ t ] = ( e0[ t ] | e1[ t ] | e2[ t ] ) >= 0;
+                    any |= covered[ t ];
+                }
+
+                if ( ! any )
+                    continue ;
+
+                for ( int t = 0; t < span; ++ t ) {
+
+                    if ( ! covered[ t ] )
+                        continue ;
+
+                    float w0 = e0[ t ] * triangle.inverseArea;
+                    float w1 = e1[ t ] * triangle.inverseArea;
+                    float w2 = e2[ t ] * triangle.inverseArea;
+
+                    float inverseDepth = w0 * triangle.inverseDepth[ 0 ] + w1 * triangle.inverseDepth[ 1 ] + w2 * triangle.inverseDepth[ 2 ];
+                    int pixel = ( y - top ) * RASTER_TILE_SIZE + ( x0 + t - left );
+
+                    if ( inverseDepth <= depth[ pixel ] )
+                        continue ;
+
+                    boost::uint32_t texel = sample( triangle, w0, w1, w2, inverseDepth );
+
+                    if ( texel == 0 || ( ( texel >> 24 ) != 0 ) != ( pass == 1 ) )
+                        continue ;
+
+                    if ( pass == 0 ) {
+                        color[ pixel ] = texel | 0xff000000;
+                        depth[ pixel ] = inverseDepth;
+                    } else {
+                        color[ pixel ] = blend( color[ pixel ], texel );
+                    }
+
+                }
+
+            }
+
+        }
+
+    }
+
+    for ( int y = 0; y < height; ++ y ) {
+        std::copy( color + y * RASTER_TILE_SIZE, color + y * RASTER_TILE_SIZE + width, image + ( top + y ) * imageWidth + left );
+    }
+}
+
+std::vector< boost::uint32_t > renderScene( BattleScene const & scene, VRAM const & vram, boost::uint16_t width, boost::uint16_t height, ThreadPool & pool )
+{
+    STATS_TIMER( timer, "render" );
+
+    std::vector< boost::uint32_t > image( width * height );
+
+    std::vector< BattleScene::Object > objects( scene.objectCount( ) );
+
+    pool.parallelFor( objects.size( ), [ & ] ( unsigned long objectIndex ) {
+        objects[ objectIndex ] = scene.decodeObject( objectIndex );
+    } );
+
+    // Only the textures used by a face are decoded
+
+    std::vector< std::vector< boost::uint32_t > > textures( scene.textureCount( ) );
+    std::vector< unsigned long > usedTextures;
+
+    for ( BattleScene::Object const & object : objects )
+        for ( BattleScene::Face const & face : object.faces )
+            if ( face.texture < textures.size( ) && std::find( usedTextures.begin( ), usedTextures.end( ), face.texture ) == usedTextures.end( ) )
+                usedTextures.push_back( face.texture );
+
+    pool.parallelFor( usedTextures.size( ), [ & ] ( unsigned long usedIndex ) {
+        textures[ usedTextures[ usedIndex ] ] = scene.decodeTexture( vram, usedTextures[ usedIndex ] );
+    } );
+
+    // The camera looks at the center of the scene bounding box, from far
+    // enough for the bounding sphere to fit in the field of view. The
+    // vertices are taken as in the OBJ file (Y up).
+
+    float minimum[ 3 ] = { HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    float maximum[ 3 ] = { - HUGE_VALF, - HUGE_VALF, - HUGE_VALF };
+
+    for ( BattleScene::Object const & object : objects ) {
+        for ( BattleScene::Vertex const & vertex : object.vertices ) {
+            float position[ 3 ] = { static_cast< float >( vertex.x ), - static_cast< float >( vertex.y ), static_cast< float >( vertex.z ) };
+            for ( int t = 0; t < 3; ++ t ) {
+                minimum[ t ] = std::min( minimum[ t ], position[ t ] );
+                maximum[ t ] = std::max( maximum[ t ], position[ t ] );
+            }
+        }
+    }
+
+    if ( minimum[ 0 ] > maximum[ 0 ] )
+        return image;
+
+    float center[ 3 ], diagonal = 0.0f;
+
+    for ( int t = 0; t < 3; ++ t ) {
+        center[ t ] = ( minimum[ t ] + maximum[ t ] ) / 2.0f;
+        diagonal += ( maximum[ t ] - minimum[ t ] ) * ( maximum[ t ] - minimum[ t ] );
+    }
+
+    float radius = std::max( std::sqrt( diagonal ) / 2.0f, 1.0f );
+    float distance = radius / std::sin( RADIANS( RASTER_FIELD_OF_VIEW ) / 2.0f );
+
+    float forward[ 3 ] = {
+        - std::cos( RADIANS( RASTER_ELEVATION ) ) * std::sin( RADIANS( RASTER_AZIMUTH ) ),
+        - std::sin( RADIANS( RASTER_ELEVATION ) ),
+        - std::cos( RADIANS( RASTER_ELEVATION ) ) * std::cos( RADIANS( RASTER_AZIMUTH ) )
+    };
+
+    float eye[ 3 ] = { center[ 0 ] - forward[ 0 ] * distance, center[ 1 ] - forward[ 1 ] * distance, center[ 2 ] - forward[ 2 ] * distance };
+
+    float rightLength = std::sqrt( forward[ 0 ] * forward[ 0 ] + forward[ 2 ] * forward[ 2 ] );
+    float right[ 3 ] = { - forward[ 2 ] / rightLength, 0.0f, forward[ 0 ] / rightLength };
+    float up[ 3 ] = {
+        right[ 1 ] * forward[ 2 ] - right[ 2 ] * forward[ 1 ],
+        right[ 2 ] * forward[ 0 ] - right[ 0 ] * forward[ 2 ],
+        right[ 0 ] * forward[ 1 ] - right[ 1 ] * forward[ 0 ]
+    };
+
+    float focal = std::min( width, height ) / 2.0f / std::tan( RADIANS( RASTER_FIELD_OF_VIEW ) / 2.0f );
+
+    std::vector< std::vector< Projected > > projections( objects.size( ) );
+
+    pool.parallelFor( objects.size( ), [ & ] ( unsigned long objectIndex ) {
+        for ( BattleScene::Vertex const & vertex : objects[ objectIndex ].vertices ) {
+
+            float relative[ 3 ] = { vertex.x - eye[ 0 ], - vertex.y - eye[ 1 ], vertex.z - eye[ 2 ] };
+
+            float x = relative[ 0 ] * right[ 0 ] + relative[ 1 ] * right[ 1 ] + relative[ 2 ] * right[ 2 ];
+            float y = relative[ 0 ] * up[ 0 ] + relative[ 1 ] * up[ 1 ] + relative[ 2 ] * up[ 2 ];
+            float z = relative[ 0 ] * forward[ 0 ] + relative[ 1 ] * forward[ 1 ] + relative[ 2 ] * forward[ 2 ];
+
+            Projected projected = { width / 2.0f + x / z * focal, height / 2.0f - y / z * focal, 1.0f / z };
+            projections[ objectIndex ].push_back( projected );
+
+        }
+    } );
+
+    // Setup, then binning : each tile gets the list of the triangles which
+    // may overlap it, in the scene order
+
+    std::vector< Triangle > triangles;
+
+    for ( unsigned long objectIndex = 0; objectIndex < objects.size( ); ++ objectIndex ) {
+
+        BattleScene::Object const & object = objects[ objectIndex ];
+
+        for ( BattleScene::Face const & face : object.faces ) {
+
+            Projected const * corners[ 3 ];
+            BattleScene::TexCoord const * texCoords[ 3 ];
+
+            bool isValid = true;
+
+            for ( int t = 0; t < 3 && isValid; ++ t ) {
+                isValid = face.vertices[ t ] < object.vertices.size( ) && face.texCoords[ t ] < object.texCoords.size( );
+                corners[ t ] = isValid ? & projections[ objectIndex ][ face.vertices[ t ] ] : nullptr;
+                texCoords[ t ] = isValid ? & object.texCoords[ face.texCoords[ t ] ] : nullptr;
+            }
+
+            boost::uint32_t const * texture = face.texture < textures.size( ) ? textures[ face.texture ].data( ) : nullptr;
+
+            Triangle triangle;
+
+            if ( isValid && setupTriangle( corners, texCoords, texture, width, height, triangle ) ) {
+                triangles.push_back( triangle );
+            }
+
+        }
+
+    }
+
+    int columnCount = ( width + RASTER_TILE_SIZE - 1 ) / RASTER_TILE_SIZE;
+    int rowCount = ( height + RASTER_TILE_SIZE - 1 ) / RASTER_TILE_SIZE;
+
+    std::vector< std::vector< unsigned long > > bins( columnCount * rowCount );
+
+    for ( unsigned long triangleIndex = 0; triangleIndex < triangles.size( ); ++ triangleIndex ) {
+
+        Triangle const & triangle = triangles[ triangleIndex ];
+
+        for ( int row = triangle.minY / RASTER_TILE_SIZE; row <= triangle.maxY / RASTER_TILE_SIZE; ++ row ) {
+            for ( int column = triangle.minX / RASTER_TILE_SIZE; column <= triangle.maxX / RASTER_TILE_SIZE; ++ column ) {
+                bins[ row * columnCount + column ].push_back( triangleIndex );
+            }
+        }
+
+    }
+
+    pool.parallelFor( bins.size( ), [ & ] ( unsigned long tileIndex ) {
+
+        int left = ( tileIndex % columnCount ) * RASTER_TILE_SIZE;
+        int top = ( tileIndex / columnCount ) * RASTER_TILE_SIZE;
+
+        renderTile( triangles, bins[ tileIndex ], left, top, std::min( RASTER_TILE_SIZE, width - left ), std::min( RASTER_TILE_SIZE, height - top ), image.data( ), width );
+
+    } );
+
+    STATS_COUNT( "rendered triangles", triangles.size( ) );
+
+    return image;
+}
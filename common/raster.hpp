@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "battlescene.hpp"
+#include "threadpool.hpp"
+#include "vram.hpp"
+
+// Software rendering of a battle scene, for its preview : the scene is seen
+// from above, at an angle, and framed so that it fits the image. Textures
+// are decoded from the VRAM and sampled with perspective correct
+// coordinates ; as on the PlayStation, the texels whose value is 0 are
+// transparent, and those whose STP bit is set are blended half and half
+// with what lies behind them. The background is left transparent.
+//
+// The image is split into tiles, which are rendered concurrently on the
+// pool, each one from the list of the triangles overlapping it.
+
+std::vector< boost::uint32_t > renderScene( BattleScene const & scene, VRAM const & vram, boost::uint16_t width, boost::uint16_t height, ThreadPool & pool );
@@ -0,0 +1,290 @@
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "constants.hpp"
+#include "memoryrange.hpp"
+#include "scan.hpp"
+
+#define CEIL_FACTOR( N, F ) ( ( N ) % ( F ) == 0 ? ( N ) : ( N ) + ( F ) - ( ( N ) % ( F ) ) )
+
+// Offsets and lengths are summed on 64 bits, so that a huge count cannot
+// wrap around and pass the bounds check.
+
+static bool fits( MemoryRange const & range, unsigned long long offset, unsigned long long length )
+{
+    return offset + length <= range.size( );
+}
+
+static boost::uint32_t little( MemoryRange const & range, unsigned long offset, int byteCount )
+{
+    boost::uint32_t value = 0;
+
+    for ( int t = byteCount; t --; )
+        value = ( value << 8 ) | range.begin( )[ offset + t ];
+
+    return value;
+}
+
+static Scan::Report report( Scan::Status status, char const * field = nullptr, unsigned long offset = 0 )
+{
+    Scan::Report report = { status, field, offset };
+
+    return report;
+}
+
+char const * Scan::describe( Status status )
+{
+    switch ( status ) {
+        case Valid      : return "valid";
+        case Truncated  : return "truncated";
+        case BadMagic   : return "bad magic number";
+        case BadVersion : return "unsupported version";
+        case BadFlags   : return "unknown flags";
+        case BadOffset  : return "offset out of range";
+        case BadIndex   : return "index out of range";
+        case BadArea    : return "outside of the VRAM";
+    }
+
+    return "unknown";
+}
+
+////////////
+// See image.cpp for the layout. The entries of each container end where
+// the next one begins (the containers and their entries being walked
+// backward), so their sectors have to be decreasing.
+
+Scan::Report Scan::image( MemoryRange const & range )
+{
+    if ( ! fits( range, 0, 16 ) )
+        return report( Truncated, "header" );
+
+    if ( little( range, 0, 4 ) != 0x20394646 )
+        return report( BadMagic, "header" );
+
+    unsigned long containerCount = little( range, 8, 4 );
+
+    if ( ! fits( range, 16, 16ULL * containerCount ) )
+        return report( Truncated, "container descriptors", 16 );
+
+    unsigned long long sectorCount = range.size( ) / SECTOR_LENGTH;
+    unsigned long long endSector = sectorCount;
+
+    for ( unsigned long containerIndex = containerCount; containerIndex --; ) {
+
+        unsigned long descriptor = 16 + 16 * containerIndex;
+
+        boost::uint32_t type = little( range, descriptor, 4 );
+        boost::uint32_t entryCount = little( range, descriptor + 4, 4 );
+        boost::uint32_t entryListSector = little( range, descriptor + 8, 4 );
+        boost::uint32_t baseSector = little( range, descriptor + 12, 4 );
+
+        if ( type < 0x02 || type > 0x04 )
+            return report( BadFlags, "container type", descriptor );
+
+        unsigned long entryLength = type == 0x02 ? 8 : type == 0x03 ? 2 : 0;
+        unsigned long long listOffset = static_cast< unsigned long long >( entryListSector ) * SECTOR_LENGTH;
+
+        if ( ! fits( range, listOffset, static_cast< unsigned long long >( entryCount ) * entryLength ) )
+            return report( Truncated, "entry list", descriptor + 8 );
+
+        for ( unsigned long entryIndex = entryCount; entryLength && entryIndex --; ) {
+
+            unsigned long entry = listOffset + entryIndex * entryLength;
+            unsigned long long beginSector;
+
+            if ( type == 0x02 ) {
+                beginSector = little( range, entry + 4, 4 );
+            } else if ( little( range, entry, 2 ) != 0xFFFF ) {
+                beginSector = static_cast< unsigned long long >( baseSector ) + little( range, entry, 2 );
+            } else {
+                continue ;
+            }
+
+            if ( beginSector > endSector || endSector > sectorCount )
+                return report( BadOffset, "entry sector", entry );
+
+            endSector = beginSector;
+
+        }
+
+        endSector = type == 0x04 ? sectorCount : baseSector;
+
+    }
+
+    return report( Valid );
+}
+
+////////////
+// See db.cpp for the layout. Object pointers are relative to their own
+// position in the pointer table, and wrap around on 32 bits as they do in
+// the parser.
+
+Scan::Report Scan::db( MemoryRange const & range, std::vector< Object > & objects )
+{
+    std::vector< Object > located;
+
+    if ( ! fits( range, 0, 4 ) )
+        return report( Truncated, "header" );
+
+    if ( range.begin( )[ 0 ] != 0xDB )
+        return report( BadMagic, "header" );
+
+    unsigned long packCount = range.begin( )[ 1 ];
+
+    if ( ! fits( range, 4, 4ULL * packCount ) )
+        return report( Truncated, "pack pointers", 4 );
+
+    for ( unsigned long packIndex = 0; packIndex < packCount; ++ packIndex ) {
+
+        unsigned long long packOffset = 4 + packIndex * 4 + ( little( range, 4 + packIndex * 4, 4 ) & 0xFFFFFF );
+
+        if ( ! fits( range, packOffset, 4 ) )
+            return report( BadOffset, "pack pointer", 4 + packIndex * 4 );
+
+        boost::uint32_t dataType = range.begin( )[ packOffset ];
+        unsigned long objectCount = range.begin( )[ packOffset + 1 ];
+
+        unsigned long base = packOffset + 4;
+        unsigned long identifiersByteLength = CEIL_FACTOR( objectCount * 2, 4 );
+        unsigned long pointersByteLength = ( objectCount + 1 ) * 4;
+
+        if ( ! fits( range, base, identifiersByteLength + pointersByteLength ) )
+            return report( Truncated, "object tables", packOffset );
+
+        for ( unsigned long objectIndex = 0; objectIndex < objectCount; ++ objectIndex ) {
+
+            unsigned long pointer = base + identifiersByteLength + objectIndex * 4;
+
+            boost::uint32_t start = little( range, pointer, 4 ) + identifiersByteLength + objectIndex * 4;
+            boost::uint32_t end = little( range, pointer + 4, 4 ) + identifiersByteLength + objectIndex * 4 + 4;
+
+            if ( end < start || ! fits( range, base + start, end - start ) )
+                return report( BadOffset, "object pointer", pointer );
+
+            Object object = { packIndex, objectIndex, dataType, MemoryRange( range.begin( ) + base + start, range.begin( ) + base + end ) };
+            located.push_back( object );
+
+        }
+
+    }
+
+    objects.swap( located );
+
+    return report( Valid );
+}
+
+////////////
+// See battlescene.cpp for the layout. Besides the tables bounds, the face
+// indices are checked against the vertice count of their object.
+
+Scan::Report Scan::battleScene( MemoryRange const & range )
+{
+    if ( ! fits( range, 0, 24 ) )
+        return report( Truncated, "header" );
+
+    unsigned long objectCount = little( range, 4, 2 );
+    unsigned long textureCount = little( range, 8, 2 );
+    unsigned long texturesOffset = little( range, 10, 2 );
+    unsigned long verticesOffset = little( range, 14, 2 );
+
+    if ( ! fits( range, 24, 16ULL * objectCount ) )
+        return report( Truncated, "object headers", 24 );
+
+    if ( ! fits( range, texturesOffset, 4ULL * textureCount ) )
+        return report( Truncated, "texture packets", 10 );
+
+    unsigned long long verticesEnd = verticesOffset;
+
+    for ( unsigned long objectIndex = 0; objectIndex < objectCount; ++ objectIndex ) {
+
+        unsigned long header = 24 + 16 * objectIndex;
+
+        unsigned long verticeCount = little( range, header + 2, 2 );
+        unsigned long texidxOffset = header + little( range, header + 6, 2 );
+        unsigned long facesOffset = header + little( range, header + 8, 2 );
+        unsigned long texmapOffset = header + little( range, header + 10, 2 );
+        unsigned long rectangleCount = little( range, header + 12, 2 );
+        unsigned long triangleCount = little( range, header + 14, 2 );
+
+        unsigned long cornerCount = rectangleCount * 4 + triangleCount * 3;
+
+        verticesEnd += verticeCount * 6;
+
+        if ( ! fits( range, texidxOffset, ( rectangleCount + triangleCount ) * 4ULL ) )
+            return report( Truncated, "texture indices", header + 6 );
+
+        if ( ! fits( range, facesOffset, cornerCount * 2ULL ) )
+            return report( Truncated, "faces", header + 8 );
+
+        if ( ! fits( range, texmapOffset, cornerCount * 2ULL ) )
+            return report( Truncated, "texture coordinates", header + 10 );
+
+        for ( unsigned long cornerIndex = 0; cornerIndex < cornerCount; ++ cornerIndex )
+            if ( little( range, facesOffset + cornerIndex * 2, 2 ) / 4 >= verticeCount )
+                return report( BadIndex, "face vertex", facesOffset + cornerIndex * 2 );
+
+    }
+
+    if ( verticesEnd > range.size( ) )
+        return report( Truncated, "vertices", 14 );
+
+    return report( Valid );
+}
+
+////////////
+// 1 byte  : magic 0x10
+// 1 byte  : version (0x00)
+// 2 bytes : - unknown -
+// 4 bytes : flags (0x03 = bpp, 0x08 = CLUT block)
+//
+// Then the CLUT block (if any) and the image block, each one being :
+//
+// 4 bytes : block length, header included
+// 2 bytes : X, 2 bytes : Y (in VRAM units)
+// 2 bytes : width (in VRAM units), 2 bytes : height
+// data
+
+Scan::Report Scan::tim( MemoryRange const & range )
+{
+    if ( ! fits( range, 0, 8 ) )
+        return report( Truncated, "header" );
+
+    if ( range.begin( )[ 0 ] != 0x10 )
+        return report( BadMagic, "header" );
+
+    if ( range.begin( )[ 1 ] != 0x00 )
+        return report( BadVersion, "header", 1 );
+
+    boost::uint32_t flags = little( range, 4, 4 );
+
+    if ( flags & ~ 0x0BUL )
+        return report( BadFlags, "header", 4 );
+
+    unsigned long long block = 8;
+
+    for ( int blockIndex = flags & 0x08 ? 0 : 1; blockIndex < 2; ++ blockIndex ) {
+
+        char const * field = blockIndex ? "image block" : "CLUT block";
+
+        if ( ! fits( range, block, 12 ) )
+            return report( Truncated, field, block );
+
+        unsigned long length = little( range, block, 4 );
+        unsigned long x = little( range, block + 4, 2 );
+        unsigned long y = little( range, block + 6, 2 );
+        unsigned long width = little( range, block + 8, 2 );
+        unsigned long height = little( range, block + 10, 2 );
+
+        if ( length < 12 + width * height * 2 || ! fits( range, block, length ) )
+            return report( Truncated, field, block );
+
+        if ( x + width > VRAM_WIDTH || y + height > VRAM_HEIGHT )
+            return report( BadArea, field, block + 4 );
+
+        block += length;
+
+    }
+
+    return report( Valid );
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// Structural checks of the game files, which never throw : every count and
+// offset is checked against the bounds of its range before being followed,
+// and the first problem found is returned along with the field and the
+// offset where it was found. Nothing is decoded nor copied, so a whole
+// image can be checked much faster than it can be extracted ; a range
+// passing these checks can be given to the parsers (Image, DB,
+// BattleScene, TIM) without them throwing.
+
+class Scan
+{
+
+public:
+
+    enum Status {
+        Valid,
+        Truncated,
+        BadMagic,
+        BadVersion,
+        BadFlags,
+        BadOffset,
+        BadIndex,
+        BadArea
+    };
+
+    struct Report {
+        Status status;
+        char const * field;
+        unsigned long offset;
+    };
+
+    // An object of a DB, as located by the pack tables.
+
+    struct Object {
+        unsigned long packIndex;
+        unsigned long objectIndex;
+        boost::uint32_t dataType;
+        MemoryRange range;
+    };
+
+public:
+
+    static char const * describe( Status status );
+
+public:
+
+    // The whole FF9.IMG : header, container descriptors, entry lists, and
+    // the sectors of every entry.
+
+    static Report image( MemoryRange const & range );
+
+    // The objects are only filled when the DB is valid.
+
+    static Report db( MemoryRange const & range, std::vector< Object > & objects );
+
+    static Report battleScene( MemoryRange const & range );
+
+    static Report tim( MemoryRange const & range );
+
+};
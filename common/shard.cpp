@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "log.hpp"
+#include "manifest.hpp"
+#include "shard.hpp"
+
+Shard::Shard( void )
+    : m_index( 0 )
+    , m_count( 1 )
+{
+}
+
+Shard::Shard( std::string const & specification )
+{
+    std::istringstream fields( specification );
+    unsigned long index = 0, count = 0;
+    char separator = 0;
+
+    fields >> index >> separator >> count;
+
+    if ( ! fields || ! fields.eof( ) || separator != '/' || index < 1 || index > count )
+        throw std::runtime_error( "Invalid shard (<index>/<count> expected, the index starting at 1)." );
+
+    this->m_index = index - 1;
+    this->m_count = count;
+}
+
+std::string Shard::name( void ) const
+{
+    std::ostringstream nameBuilder;
+    nameBuilder << this->m_index + 1 << "/" << this->m_count;
+
+    return nameBuilder.str( );
+}
+
+std::vector< unsigned long > Shard::partition( std::vector< unsigned long > const & sizes, unsigned long count )
+{
+    std::vector< unsigned long > order( sizes.size( ) );
+    for ( unsigned long itemIndex = 0; itemIndex < order.size( ); ++ itemIndex )
+        order[ itemIndex ] = itemIndex;
+
+    std::stable_sort( order.begin( ), order.end( ), [ & ] ( unsigned long a, unsigned long b ) {
+        return sizes[ a ] > sizes[ b ];
+    } );
+
+    std::vector< unsigned long > shards( sizes.size( ) );
+    std::vector< unsigned long long > loads( count );
+
+    for ( unsigned long itemIndex : order ) {
+        unsigned long shard = std::min_element( loads.begin( ), loads.end( ) ) - loads.begin( );
+        shards[ itemIndex ] = shard;
+        loads[ shard ] += sizes[ itemIndex ];
+    }
+
+    return shards;
+}
+
+std::vector< unsigned long > Shard::select( std::vector< unsigned long > const & sizes ) const
+{
+    std::vector< unsigned long > shards = Shard::partition( sizes, this->m_count );
+    std::vector< unsigned long > selection;
+
+    unsigned long long load = 0, total = 0;
+
+    for ( unsigned long itemIndex = 0; itemIndex < shards.size( ); ++ itemIndex ) {
+        total += sizes[ itemIndex ];
+        if ( shards[ itemIndex ] == this->m_index ) {
+            selection.push_back( itemIndex );
+            load += sizes[ itemIndex ];
+        }
+    }
+
+    if ( this->m_count > 1 ) {
+        LOG( Info, "Shard " << this->name( ) << " : " << selection.size( ) << " of " << sizes.size( ) << " item(s), " << load << " of " << total << " byte(s)" );
+    }
+
+    return selection;
+}
+
+static std::string stem( std::string const & path )
+{
+    std::string::size_type dot = path.rfind( '.' );
+    std::string::size_type slash = path.rfind( '/' );
+
+    if ( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+        return path;
+
+    return path.substr( 0, dot );
+}
+
+void Shard::merge( std::vector< std::string > const & manifests, std::vector< std::string > const & paths, Manifest & merged )
+{
+    for ( std::string const & manifest : manifests )
+        merged.merge( manifest );
+
+    std::set< std::string > recorded;
+    for ( Manifest::Record const & record : merged.records( ) )
+        recorded.insert( stem( record.path ) );
+
+    unsigned long missingCount = 0;
+
+    for ( std::string const & path : paths ) {
+        if ( ! recorded.count( stem( path ) ) ) {
+            LOG( Error, path << " is not recorded by any shard" );
+            ++ missingCount;
+        }
+    }
+
+    if ( missingCount ) {
+        std::ostringstream messageBuilder;
+        messageBuilder << missingCount << " file(s) missing from the shard manifests (" << manifests.size( ) << " merged).";
+        throw std::runtime_error( messageBuilder.str( ) );
+    }
+
+    LOG( Info, "Merged " << manifests.size( ) << " shard manifest(s) : " << merged.records( ).size( ) << " file(s), all " << paths.size( ) << " expected present" );
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Manifest;
+
+// A slice of the work of a tool, for the runs split across several
+// machines (--shard <index>/<count>, the index starting at 1). Every shard
+// computes the same partition from the same input, so they don't have to
+// communicate : the items (image entries, DB objects, scene textures) are
+// only known by their byte size, taken from the directory tables.
+//
+// Once every shard is done, their manifests are merged back, which checks
+// that no item has been forgotten (--merge).
+
+class Shard
+{
+
+public:
+
+    // The whole work, as a single shard.
+
+    Shard( void );
+
+    Shard( std::string const & specification );
+
+public:
+
+    // Starts at 0 (unlike the specification, which starts at 1).
+
+    inline unsigned long index( void ) const;
+
+    inline unsigned long count( void ) const;
+
+    // As given on the command line ("2/4").
+
+    std::string name( void ) const;
+
+public:
+
+    // Shard of each item. The items are taken by decreasing size, each one
+    // going to the least loaded shard so far (ties are broken by index, so
+    // the result only depends on the sizes) ; the loads then differ by at
+    // most one item, however skewed the sizes are.
+
+    static std::vector< unsigned long > partition( std::vector< unsigned long > const & sizes, unsigned long count );
+
+    // Indices of the items of this shard, in increasing order.
+
+    std::vector< unsigned long > select( std::vector< unsigned long > const & sizes ) const;
+
+public:
+
+    // Merges the manifests written by the shards, and throws if one of the
+    // expected files is recorded by none of them. Paths are compared
+    // without their extension ("00/012" matches "00/012.ff9db"), since the
+    // extension of an image entry depends on its content.
+
+    static void merge( std::vector< std::string > const & manifests, std::vector< std::string > const & paths, Manifest & merged );
+
+private:
+
+    unsigned long m_index;
+
+    unsigned long m_count;
+
+};
+
+unsigned long Shard::index( void ) const
+{
+    return this->m_index;
+}
+
+unsigned long Shard::count( void ) const
+{
+    return this->m_count;
+}
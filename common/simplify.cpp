@@ -0,0 +1,463 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <queue>
+#include <set>
+#include <vector>
+
+#include "battlescene.hpp"
+#include "simplify.hpp"
+#include "stats.hpp"
+
+// A symmetric 4x4 matrix, storing the sum of the squared distances to a set
+// of planes : a2 ab ac ad b2 bc bd c2 cd d2.
+
+struct Quadric {
+
+    double m[ 10 ];
+
+    void addPlane( double a, double b, double c, double d, double weight )
+    {
+        double plane[ 4 ] = { a, b, c, d };
+
+        for ( int row = 0, t = 0; row < 4; ++ row )
+            for ( int column = row; column < 4; ++ column )
+                this->m[ t ++ ] += weight * plane[ row ] * plane[ column ];
+    }
+
+    void add( Quadric const & other )
+    {
+        for ( int t = 0; t < 10; ++ t )
+            this->m[ t ] += other.m[ t ];
+    }
+
+    double error( double const * p ) const
+    {
+        return this->m[ 0 ] * p[ 0 ] * p[ 0 ] + 2 * this->m[ 1 ] * p[ 0 ] * p[ 1 ] + 2 * this->m[ 2 ] * p[ 0 ] * p[ 2 ] + 2 * this->m[ 3 ] * p[ 0 ]
+             + this->m[ 4 ] * p[ 1 ] * p[ 1 ] + 2 * this->m[ 5 ] * p[ 1 ] * p[ 2 ] + 2 * this->m[ 6 ] * p[ 1 ]
+             + this->m[ 7 ] * p[ 2 ] * p[ 2 ] + 2 * this->m[ 8 ] * p[ 2 ]
+             + this->m[ 9 ];
+    }
+
+};
+
+// A face being simplified : its texture coordinates are stored by value,
+// since a collapse gives new ones to the corners it moves.
+
+struct WorkFace {
+    unsigned long vertices[ 3 ];
+    BattleScene::TexCoord texCoords[ 3 ];
+    boost::uint8_t texture;
+    bool removed;
+};
+
+// A collapse of from into to, valid as long as none of both vertices has
+// been touched since it was evaluated.
+
+struct Candidate {
+
+    double cost;
+    unsigned long from, to;
+    unsigned long fromStamp, toStamp;
+    BattleScene::TexCoord texCoord;
+
+    bool operator>( Candidate const & other ) const
+    {
+        return this->cost > other.cost;
+    }
+
+};
+
+class EdgeCollapse
+{
+
+public:
+
+    EdgeCollapse( BattleScene::Object const & object );
+
+public:
+
+    void run( unsigned long targetFaceCount );
+
+    BattleScene::Object result( void ) const;
+
+private:
+
+    static void cross( double const * a, double const * b, double const * c, double * normal );
+
+    static bool sameTexCoord( BattleScene::TexCoord const & a, BattleScene::TexCoord const & b );
+
+    static int cornerOf( WorkFace const & face, unsigned long vertex );
+
+    std::set< unsigned long > neighbours( unsigned long vertex ) const;
+
+    bool evaluate( unsigned long from, unsigned long to, Candidate & candidate ) const;
+
+    void push( unsigned long from, unsigned long to );
+
+    void collapse( Candidate const & candidate );
+
+private:
+
+    std::vector< boost::int16_t > m_positions;
+
+    std::vector< double > m_points;
+
+    std::vector< WorkFace > m_faces;
+
+    std::vector< std::vector< unsigned long > > m_vertexFaces;
+
+    std::vector< Quadric > m_quadrics;
+
+    std::vector< unsigned long > m_stamps;
+
+    std::vector< bool > m_removed;
+
+    unsigned long m_faceCount;
+
+    std::priority_queue< Candidate, std::vector< Candidate >, std::greater< Candidate > > m_queue;
+
+};
+
+EdgeCollapse::EdgeCollapse( BattleScene::Object const & object )
+    : m_positions( object.vertices.size( ) * 3 )
+    , m_points( object.vertices.size( ) * 3 )
+    , m_vertexFaces( object.vertices.size( ) )
+    , m_quadrics( object.vertices.size( ), Quadric( ) )
+    , m_stamps( object.vertices.size( ) )
+    , m_removed( object.vertices.size( ) )
+    , m_faceCount( 0 )
+{
+    for ( unsigned long vertex = 0; vertex < object.vertices.size( ); ++ vertex ) {
+        this->m_positions[ vertex * 3 + 0 ] = object.vertices[ vertex ].x;
+        this->m_positions[ vertex * 3 + 1 ] = object.vertices[ vertex ].y;
+        this->m_positions[ vertex * 3 + 2 ] = object.vertices[ vertex ].z;
+        for ( int t = 0; t < 3; ++ t )
+            this->m_points[ vertex * 3 + t ] = this->m_positions[ vertex * 3 + t ];
+    }
+
+    // The degenerate faces, and those pointing outside of the object, are
+    // not part of the levels
+
+    for ( BattleScene::Face const & face : object.faces ) {
+
+        bool isValid = face.vertices[ 0 ] != face.vertices[ 1 ] && face.vertices[ 1 ] != face.vertices[ 2 ] && face.vertices[ 2 ] != face.vertices[ 0 ];
+
+        for ( int t = 0; t < 3; ++ t )
+            isValid = isValid && face.vertices[ t ] < object.vertices.size( ) && face.texCoords[ t ] < object.texCoords.size( );
+
+        if ( ! isValid )
+            continue ;
+
+        WorkFace work;
+
+        for ( int t = 0; t < 3; ++ t ) {
+            work.vertices[ t ] = face.vertices[ t ];
+            work.texCoords[ t ] = object.texCoords[ face.texCoords[ t ] ];
+        }
+
+        work.texture = face.texture;
+        work.removed = false;
+
+        // Each face adds its plane to the quadrics of its vertices, weighted
+        // by its area
+
+        double normal[ 3 ];
+        cross( & this->m_points[ work.vertices[ 0 ] * 3 ], & this->m_points[ work.vertices[ 1 ] * 3 ], & this->m_points[ work.vertices[ 2 ] * 3 ], normal );
+
+        double length = std::sqrt( normal[ 0 ] * normal[ 0 ] + normal[ 1 ] * normal[ 1 ] + normal[ 2 ] * normal[ 2 ] );
+
+        if ( length > 0 ) {
+
+            double const * point = & this->m_points[ work.vertices[ 0 ] * 3 ];
+            double a = normal[ 0 ] / length, b = normal[ 1 ] / length, c = normal[ 2 ] / length;
+            double d = - ( a * point[ 0 ] + b * point[ 1 ] + c * point[ 2 ] );
+
+            for ( int t = 0; t < 3; ++ t ) {
+                this->m_quadrics[ work.vertices[ t ] ].addPlane( a, b, c, d, length / 2 );
+            }
+
+        }
+
+        for ( int t = 0; t < 3; ++ t )
+            this->m_vertexFaces[ work.vertices[ t ] ].push_back( this->m_faces.size( ) );
+
+        this->m_faces.push_back( work );
+        ++ this->m_faceCount;
+
+    }
+}
+
+void EdgeCollapse::cross( double const * a, double const * b, double const * c, double * normal )
+{
+    double u[ 3 ] = { b[ 0 ] - a[ 0 ], b[ 1 ] - a[ 1 ], b[ 2 ] - a[ 2 ] };
+    double v[ 3 ] = { c[ 0 ] - a[ 0 ], c[ 1 ] - a[ 1 ], c[ 2 ] - a[ 2 ] };
+
+    normal[ 0 ] = u[ 1 ] * v[ 2 ] - u[ 2 ] * v[ 1 ];
+    normal[ 1 ] = u[ 2 ] * v[ 0 ] - u[ 0 ] * v[ 2 ];
+    normal[ 2 ] = u[ 0 ] * v[ 1 ] - u[ 1 ] * v[ 0 ];
+}
+
+bool EdgeCollapse::sameTexCoord( BattleScene::TexCoord const & a, BattleScene::TexCoord const & b )
+{
+    return a.u == b.u && a.v == b.v;
+}
+
+int EdgeCollapse::cornerOf( WorkFace const & face, unsigned long vertex )
+{
+    for ( int t = 0; t < 3; ++ t )
+        if ( face.vertices[ t ] == vertex )
+            return t;
+
+    return - 1;
+}
+
+std::set< unsigned long > EdgeCollapse::neighbours( unsigned long vertex ) const
+{
+    std::set< unsigned long > neighbours;
+
+    for ( unsigned long faceIndex : this->m_vertexFaces[ vertex ] ) {
+        WorkFace const & face = this->m_faces[ faceIndex ];
+        if ( ! face.removed )
+            for ( int t = 0; t < 3; ++ t )
+                if ( face.vertices[ t ] != vertex )
+                    neighbours.insert( face.vertices[ t ] );
+    }
+
+    return neighbours;
+}
+
+// A collapse is only allowed when :
+//
+// - every face around from uses the same texture, with the same texture
+//   coordinates at from (it lies inside a single chart) ;
+// - every edge around from is shared by exactly two faces (from is neither
+//   on the border of the object, nor on a non manifold edge) ;
+// - from and to only share the two neighbours opposite to their edge (the
+//   surface stays manifold) ;
+// - the two faces being removed agree on the texture coordinates at to,
+//   which the moved corners take ;
+// - none of the moved faces is flipped.
+
+bool EdgeCollapse::evaluate( unsigned long from, unsigned long to, Candidate & candidate ) const
+{
+    std::map< unsigned long, int > edgeFaceCounts;
+
+    WorkFace const * reference = nullptr;
+    bool hasTexCoord = false;
+
+    for ( unsigned long faceIndex : this->m_vertexFaces[ from ] ) {
+
+        WorkFace const & face = this->m_faces[ faceIndex ];
+
+        if ( face.removed )
+            continue ;
+
+        int corner = cornerOf( face, from );
+
+        if ( reference && ( face.texture != reference->texture || ! sameTexCoord( face.texCoords[ corner ], reference->texCoords[ cornerOf( * reference, from ) ] ) ) )
+            return false;
+
+        reference = & face;
+
+        edgeFaceCounts[ face.vertices[ ( corner + 1 ) % 3 ] ] += 1;
+        edgeFaceCounts[ face.vertices[ ( corner + 2 ) % 3 ] ] += 1;
+
+        int toCorner = cornerOf( face, to );
+
+        if ( toCorner >= 0 ) {
+            if ( hasTexCoord && ! sameTexCoord( candidate.texCoord, face.texCoords[ toCorner ] ) )
+                return false;
+            candidate.texCoord = face.texCoords[ toCorner ];
+            hasTexCoord = true;
+        }
+
+    }
+
+    if ( ! hasTexCoord )
+        return false;
+
+    for ( std::pair< unsigned long const, int > const & edge : edgeFaceCounts )
+        if ( edge.second != 2 )
+            return false;
+
+    std::set< unsigned long > toNeighbours = this->neighbours( to );
+    unsigned long sharedCount = 0;
+
+    for ( std::pair< unsigned long const, int > const & edge : edgeFaceCounts )
+        sharedCount += toNeighbours.count( edge.first );
+
+    if ( sharedCount != 2 )
+        return false;
+
+    for ( unsigned long faceIndex : this->m_vertexFaces[ from ] ) {
+
+        WorkFace const & face = this->m_faces[ faceIndex ];
+
+        if ( face.removed || cornerOf( face, to ) >= 0 )
+            continue ;
+
+        double const * corners[ 3 ];
+        double before[ 3 ], after[ 3 ];
+
+        for ( int t = 0; t < 3; ++ t )
+            corners[ t ] = & this->m_points[ face.vertices[ t ] * 3 ];
+
+        cross( corners[ 0 ], corners[ 1 ], corners[ 2 ], before );
+        corners[ cornerOf( face, from ) ] = & this->m_points[ to * 3 ];
+        cross( corners[ 0 ], corners[ 1 ], corners[ 2 ], after );
+
+        if ( before[ 0 ] * after[ 0 ] + before[ 1 ] * after[ 1 ] + before[ 2 ] * after[ 2 ] <= 0 )
+            return false;
+
+    }
+
+    Quadric quadric = this->m_quadrics[ from ];
+    quadric.add( this->m_quadrics[ to ] );
+
+    candidate.cost = quadric.error( & this->m_points[ to * 3 ] );
+    candidate.from = from;
+    candidate.to = to;
+    candidate.fromStamp = this->m_stamps[ from ];
+    candidate.toStamp = this->m_stamps[ to ];
+
+    return true;
+}
+
+void EdgeCollapse::push( unsigned long from, unsigned long to )
+{
+    Candidate candidate;
+
+    if ( this->evaluate( from, to, candidate ) ) {
+        this->m_queue.push( candidate );
+    }
+}
+
+void EdgeCollapse::collapse( Candidate const & candidate )
+{
+    unsigned long from = candidate.from, to = candidate.to;
+
+    for ( unsigned long faceIndex : this->m_vertexFaces[ from ] ) {
+
+        WorkFace & face = this->m_faces[ faceIndex ];
+
+        if ( face.removed )
+            continue ;
+
+        if ( cornerOf( face, to ) >= 0 ) {
+            face.removed = true;
+            -- this->m_faceCount;
+        } else {
+            int corner = cornerOf( face, from );
+            face.vertices[ corner ] = to;
+            face.texCoords[ corner ] = candidate.texCoord;
+            this->m_vertexFaces[ to ].push_back( faceIndex );
+        }
+
+    }
+
+    this->m_vertexFaces[ from ].clear( );
+    this->m_removed[ from ] = true;
+    this->m_quadrics[ to ].add( this->m_quadrics[ from ] );
+
+    // Every collapse involving to or one of its neighbours has to be
+    // evaluated again
+
+    std::set< unsigned long > touched = this->neighbours( to );
+    touched.insert( to );
+
+    for ( unsigned long vertex : touched )
+        ++ this->m_stamps[ vertex ];
+
+    for ( unsigned long vertex : touched ) {
+        for ( unsigned long neighbour : this->neighbours( vertex ) ) {
+            this->push( vertex, neighbour );
+            this->push( neighbour, vertex );
+        }
+    }
+}
+
+void EdgeCollapse::run( unsigned long targetFaceCount )
+{
+    for ( unsigned long vertex = 0; vertex < this->m_vertexFaces.size( ); ++ vertex )
+        for ( unsigned long neighbour : this->neighbours( vertex ) )
+            this->push( vertex, neighbour );
+
+    while ( this->m_faceCount > targetFaceCount && ! this->m_queue.empty( ) ) {
+
+        Candidate candidate = this->m_queue.top( );
+        this->m_queue.pop( );
+
+        if ( this->m_removed[ candidate.from ] || this->m_removed[ candidate.to ] )
+            continue ;
+
+        if ( candidate.fromStamp != this->m_stamps[ candidate.from ] || candidate.toStamp != this->m_stamps[ candidate.to ] )
+            continue ;
+
+        this->collapse( candidate );
+
+    }
+}
+
+// The vertices left are renumbered, and each corner gets its own texture
+// coordinates, as the triangles of the scene do.
+
+BattleScene::Object EdgeCollapse::result( void ) const
+{
+    BattleScene::Object object;
+
+    std::vector< long > indices( this->m_removed.size( ), - 1 );
+
+    for ( WorkFace const & face : this->m_faces ) {
+
+        if ( face.removed )
+            continue ;
+
+        BattleScene::Face output;
+
+        for ( int t = 0; t < 3; ++ t ) {
+
+            unsigned long vertex = face.vertices[ t ];
+
+            if ( indices[ vertex ] < 0 ) {
+                BattleScene::Vertex position = { this->m_positions[ vertex * 3 + 0 ], this->m_positions[ vertex * 3 + 1 ], this->m_positions[ vertex * 3 + 2 ] };
+                indices[ vertex ] = object.vertices.size( );
+                object.vertices.push_back( position );
+            }
+
+            output.vertices[ t ] = indices[ vertex ];
+            output.texCoords[ t ] = object.texCoords.size( );
+            object.texCoords.push_back( face.texCoords[ t ] );
+
+        }
+
+        output.texture = face.texture;
+        object.faces.push_back( output );
+
+    }
+
+    return object;
+}
+
+BattleScene::Object simplifyObject( BattleScene::Object const & object, unsigned long targetFaceCount )
+{
+    STATS_TIMER( timer, "simplify" );
+
+    EdgeCollapse collapse( object );
+    collapse.run( targetFaceCount );
+
+    return collapse.result( );
+}
+
+std::vector< BattleScene::Object > buildLevels( BattleScene::Object const & object, unsigned int levelCount )
+{
+    std::vector< BattleScene::Object > levels( 1, object );
+
+    for ( unsigned int level = 1; level <= levelCount; ++ level ) {
+        unsigned long targetFaceCount = static_cast< unsigned long >( levels.back( ).faces.size( ) * SIMPLIFY_LEVEL_RATIO );
+        levels.push_back( simplifyObject( levels.back( ), targetFaceCount ) );
+    }
+
+    return levels;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include "battlescene.hpp"
+
+// Levels of detail of the battle scene objects, built by quadric error
+// edge collapses (Garland and Heckbert). The collapses are half-edge ones :
+// a vertex is merged into one of its neighbours, so the positions stay the
+// 16 bits ones of the scene. Only the vertices lying inside a single
+// texture chart can be removed : those on a UV seam, on a boundary between
+// two textures, or on the border of the object are kept, so that the
+// textures still map the same way on every level.
+
+// Each level has SIMPLIFY_LEVEL_RATIO times the triangle count of the
+// previous one (when there is enough to remove).
+
+#define SIMPLIFY_LEVEL_RATIO 0.5
+
+BattleScene::Object simplifyObject( BattleScene::Object const & object, unsigned long targetFaceCount );
+
+// The object itself, followed by levelCount simplified levels.
+
+std::vector< BattleScene::Object > buildLevels( BattleScene::Object const & object, unsigned int levelCount );
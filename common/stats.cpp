@@ -0,0 +1,139 @@
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+
+#include <boost/cstdint.hpp>
+
+#include "path.hpp"
+#include "stats.hpp"
+
+namespace
+{
+
+    std::mutex g_mutex;
+
+    std::map< std::string, std::unique_ptr< Stats::Stage > > g_stages;
+
+    std::map< std::string, std::unique_ptr< Stats::Counter > > g_counters;
+
+    boost::uint64_t g_startTime = 0;
+
+    boost::uint64_t now( clockid_t clock )
+    {
+        struct timespec time;
+        clock_gettime( clock, & time );
+
+        return static_cast< boost::uint64_t >( time.tv_sec ) * 1000000000 + time.tv_nsec;
+    }
+
+}
+
+Stats::Timer::Timer( Stage & stage )
+    : m_stage( stage )
+    , m_wallStart( now( CLOCK_MONOTONIC ) )
+    , m_cpuStart( now( CLOCK_THREAD_CPUTIME_ID ) )
+{
+}
+
+Stats::Timer::~Timer( void )
+{
+    this->m_stage.calls += 1;
+    this->m_stage.wallNanoseconds += now( CLOCK_MONOTONIC ) - this->m_wallStart;
+    this->m_stage.cpuNanoseconds += now( CLOCK_THREAD_CPUTIME_ID ) - this->m_cpuStart;
+}
+
+void Stats::start( void )
+{
+    g_startTime = now( CLOCK_MONOTONIC );
+}
+
+Stats::Stage & Stats::stage( std::string const & name )
+{
+    std::unique_lock< std::mutex > lock( g_mutex );
+
+    std::unique_ptr< Stage > & stage = g_stages[ name ];
+
+    if ( ! stage ) {
+        stage.reset( new Stage( ) );
+        stage->calls = stage->wallNanoseconds = stage->cpuNanoseconds = stage->bytes = 0;
+    }
+
+    return * stage;
+}
+
+Stats::Counter & Stats::counter( std::string const & name )
+{
+    std::unique_lock< std::mutex > lock( g_mutex );
+
+    std::unique_ptr< Counter > & counter = g_counters[ name ];
+
+    if ( ! counter )
+        counter.reset( new Counter( 0 ) );
+
+    return * counter;
+}
+
+void Stats::write( std::string const & path, std::string const & tool )
+{
+    std::unique_lock< std::mutex > lock( g_mutex );
+
+    double wallSeconds = ( now( CLOCK_MONOTONIC ) - g_startTime ) / 1e9;
+    double cpuSeconds = now( CLOCK_PROCESS_CPUTIME_ID ) / 1e9;
+
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, & usage );
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision( 6 );
+
+    json << "{" << std::endl;
+    json << "  \"tool\": \"" << tool << "\"," << std::endl;
+    json << "  \"wall_seconds\": " << wallSeconds << "," << std::endl;
+    json << "  \"cpu_seconds\": " << cpuSeconds << "," << std::endl;
+    json << "  \"peak_rss_bytes\": " << usage.ru_maxrss * 1024L << "," << std::endl;
+
+    json << "  \"stages\": {";
+
+    for ( auto it = g_stages.begin( ); it != g_stages.end( ); ++ it ) {
+
+        Stage const & stage = * it->second;
+
+        double stageWallSeconds = stage.wallNanoseconds / 1e9;
+
+        json << ( it == g_stages.begin( ) ? "" : "," ) << std::endl;
+        json << "    \"" << it->first << "\": { ";
+        json << "\"calls\": " << stage.calls << ", ";
+        json << "\"wall_seconds\": " << stageWallSeconds << ", ";
+        json << "\"cpu_seconds\": " << stage.cpuNanoseconds / 1e9;
+
+        if ( stage.bytes ) {
+            json << ", \"bytes\": " << stage.bytes;
+            json << ", \"bytes_per_second\": " << ( stageWallSeconds > 0 ? stage.bytes / stageWallSeconds : 0 );
+        }
+
+        json << " }";
+
+    }
+
+    json << std::endl << "  }," << std::endl;
+
+    json << "  \"counters\": {";
+
+    for ( auto it = g_counters.begin( ); it != g_counters.end( ); ++ it ) {
+        json << ( it == g_counters.begin( ) ? "" : "," ) << std::endl;
+        json << "    \"" << it->first << "\": " << * it->second;
+    }
+
+    json << std::endl << "  }" << std::endl;
+    json << "}" << std::endl;
+
+    lock.unlock( );
+
+    Path( path ).dump( json.str( ) );
+}
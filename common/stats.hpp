@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+// Stage timers and counters, reported as JSON by the --stats option.
+//
+// The STATS_* macros are the only way the tools touch this class : when
+// the project is configured with FFIX_STATS=OFF they expand to nothing,
+// and the report only contains the process wide figures.
+
+class Stats
+{
+
+public:
+
+    struct Stage {
+        std::atomic< boost::uint64_t > calls;
+        std::atomic< boost::uint64_t > wallNanoseconds;
+        std::atomic< boost::uint64_t > cpuNanoseconds;
+        std::atomic< boost::uint64_t > bytes;
+    };
+
+    typedef std::atomic< boost::uint64_t > Counter;
+
+    class Timer
+    {
+
+    public:
+
+        Timer( Stage & stage );
+
+        ~Timer( void );
+
+    public:
+
+        inline void bytes( boost::uint64_t count );
+
+    private:
+
+        Stage & m_stage;
+
+        boost::uint64_t m_wallStart;
+
+        boost::uint64_t m_cpuStart;
+
+    };
+
+public:
+
+    static void start( void );
+
+    static void write( std::string const & path, std::string const & tool );
+
+public:
+
+    static Stage & stage( std::string const & name );
+
+    static Counter & counter( std::string const & name );
+
+};
+
+void Stats::Timer::bytes( boost::uint64_t count )
+{
+    this->m_stage.bytes += count;
+}
+
+#ifdef FFIX_STATS
+
+// Literal stage names are only looked up once per call site.
+
+# define STATS_TIMER( VARIABLE, NAME ) static Stats::Stage & VARIABLE##Stage = Stats::stage( NAME ); Stats::Timer VARIABLE( VARIABLE##Stage )
+# define STATS_TIMER_DYNAMIC( VARIABLE, NAME ) Stats::Timer VARIABLE( Stats::stage( NAME ) )
+# define STATS_BYTES( VARIABLE, COUNT ) VARIABLE.bytes( COUNT )
+# define STATS_COUNT( NAME, VALUE ) do { static Stats::Counter & counter = Stats::counter( NAME ); counter += ( VALUE ); } while ( 0 )
+
+#else
+
+# define STATS_TIMER( VARIABLE, NAME )
+# define STATS_TIMER_DYNAMIC( VARIABLE, NAME )
+# define STATS_BYTES( VARIABLE, COUNT )
+# define STATS_COUNT( NAME, VALUE )
+
+#endif
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool( unsigned int threadCount )
+    : m_stopping( false )
+{
+    if ( threadCount == 0 )
+        threadCount = std::thread::hardware_concurrency( );
+
+    if ( threadCount == 0 )
+        threadCount = 1;
+
+    for ( unsigned int t = 0; t < threadCount; ++ t ) {
+        this->m_threads.push_back( std::thread( & ThreadPool::work, this ) );
+    }
+}
+
+ThreadPool::~ThreadPool( void )
+{
+    {
+        std::unique_lock< std::mutex > lock( this->m_mutex );
+        this->m_stopping = true;
+    }
+
+    this->m_condition.notify_all( );
+
+    for ( std::thread & thread : this->m_threads ) {
+        thread.join( );
+    }
+}
+
+void ThreadPool::enqueue( std::function< void ( void ) > const & task )
+{
+    {
+        std::unique_lock< std::mutex > lock( this->m_mutex );
+        this->m_tasks.push_back( task );
+    }
+
+    this->m_condition.notify_one( );
+}
+
+void ThreadPool::work( void )
+{
+    for ( ;; ) {
+
+        std::function< void ( void ) > task;
+
+        {
+            std::unique_lock< std::mutex > lock( this->m_mutex );
+            this->m_condition.wait( lock, [ this ] ( ) { return this->m_stopping || ! this->m_tasks.empty( ); } );
+
+            if ( this->m_tasks.empty( ) )
+                return ;
+
+            task = std::move( this->m_tasks.front( ) );
+            this->m_tasks.pop_front( );
+        }
+
+        task( );
+
+    }
+}
+
+void ThreadPool::parallelFor( unsigned long count, std::function< void ( unsigned long ) > const & function )
+{
+    // Helpers which start after all the indices have been taken simply
+    // return, so the shared state has to outlive this call.
+
+    struct State {
+        std::atomic< unsigned long > next;
+        unsigned long done;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+
+    std::shared_ptr< State > state = std::make_shared< State >( );
+    state->next = 0;
+    state->done = 0;
+
+    auto run = [ state, count, & function ] ( ) {
+        for ( unsigned long index; ( index = state->next++ ) < count; ) {
+
+            try {
+                function( index );
+            } catch ( ... ) {
+                std::unique_lock< std::mutex > lock( state->mutex );
+                if ( ! state->error ) state->error = std::current_exception( );
+            }
+
+            std::unique_lock< std::mutex > lock( state->mutex );
+            if ( ++ state->done == count ) {
+                state->condition.notify_all( );
+            }
+
+        }
+    };
+
+    unsigned long helperCount = std::min< unsigned long >( this->m_threads.size( ), count ) - ( count ? 1 : 0 );
+    for ( unsigned long h = 0; h < helperCount; ++ h )
+        this->enqueue( run );
+
+    run( );
+
+    std::unique_lock< std::mutex > lock( state->mutex );
+    state->condition.wait( lock, [ & state, count ] ( ) { return state->done == count; } );
+
+    if ( state->error ) {
+        std::rethrow_exception( state->error );
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+
+public:
+
+    ThreadPool( unsigned int threadCount = 0 );
+
+    ~ThreadPool( void );
+
+public:
+
+    inline unsigned int size( void ) const;
+
+public:
+
+    template < typename Function >
+    std::future< typename std::result_of< Function ( ) >::type > submit( Function function );
+
+    // Runs function( 0 ) ... function( count - 1 ) on the pool. The calling
+    // thread takes part in the work, so it is safe to call from a task.
+
+    void parallelFor( unsigned long count, std::function< void ( unsigned long ) > const & function );
+
+private:
+
+    void enqueue( std::function< void ( void ) > const & task );
+
+    void work( void );
+
+private:
+
+    std::vector< std::thread > m_threads;
+
+    std::deque< std::function< void ( void ) > > m_tasks;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_condition;
+
+    bool m_stopping;
+
+};
+
+unsigned int ThreadPool::size( void ) const
+{
+    return this->m_threads.size( );
+}
+
+template < typename Function >
+std::future< typename std::result_of< Function ( ) >::type > ThreadPool::submit( Function function )
+{
+    typedef typename std::result_of< Function ( ) >::type Result;
+
+    std::shared_ptr< std::packaged_task< Result ( ) > > task = std::make_shared< std::packaged_task< Result ( ) > >( function );
+    std::future< Result > future = task->get_future( );
+
+    this->enqueue( [ task ] ( ) { ( * task )( ); } );
+
+    return future;
+}
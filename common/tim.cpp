@@ -8,6 +8,7 @@
 #include "memoryrange.hpp"
 #include "parse.hpp"
 #include "path.hpp"
+#include "stats.hpp"
 #include "tim.hpp"
 #include "vram.hpp"
 
@@ -61,8 +62,19 @@ TIM TIM::fromFile( std::string const & path )
     return TIM::fromRange( range );
 }
 
+TIM TIM::headerFromFile( std::string const & path )
+{
+    Path file( path );
+    std::vector< boost::uint8_t > content = file.read( TIM_HEADER_LENGTH );
+
+    MemoryRange range( content );
+    return TIM::fromRange( range );
+}
+
 TIM const & TIM::apply( VRAM & vram ) const
 {
+    STATS_TIMER( timer, "apply tim" );
+
     #define CEIL( n, factor ) ( ( n ) + ( ( n ) % ( factor ) ? ( factor ) - ( n ) % ( factor ) : 0 ) )
     unsigned char bytes = CEIL( m_bpp, 8 ) / 8;
     unsigned int byteWidth = CEIL( m_width * m_bpp, 8 ) / 8;
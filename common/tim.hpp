@@ -16,6 +16,11 @@ public:
 
     static TIM fromFile( std::string const & path );
 
+    // Only reads the TIM header ; the returned image has no data, but can
+    // be used to know which VRAM area the file would cover.
+
+    static TIM headerFromFile( std::string const & path );
+
 public:
 
     inline TIM( boost::uint32_t left, boost::uint32_t top, boost::uint32_t width, boost::uint32_t height, boost::uint8_t bpp, std::vector< boost::uint8_t > data );
@@ -34,6 +39,10 @@ public:
 
     inline std::vector< boost::uint8_t > const & data( void ) const;
 
+public:
+
+    inline VRAMRect rect( void ) const;
+
 public:
 
     TIM const & apply( VRAM & vram ) const;
@@ -95,3 +104,15 @@ std::vector< boost::uint8_t > const & TIM::data( void ) const
 {
     return m_data;
 }
+
+VRAMRect TIM::rect( void ) const
+{
+    VRAMRect rect;
+
+    rect.left = m_left;
+    rect.top = m_top;
+    rect.width = ( m_width * m_bpp + 15 ) / 16;
+    rect.height = m_height;
+
+    return rect;
+}
@@ -0,0 +1,44 @@
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include "tree.hpp"
+
+namespace fs = boost::filesystem;
+
+static bool isToolOutput( std::string const & extension )
+{
+    return extension == ".manifest" || extension == ".zip" || extension == ".tar" || extension == ".ff9pack";
+}
+
+std::map< unsigned long, std::string > listIndexed( std::string const & folder, unsigned int digitCount, bool directories )
+{
+    std::map< unsigned long, std::string > items;
+
+    for ( fs::directory_iterator it( folder ), end; it != end; ++ it ) {
+
+        std::string name = it->path( ).filename( ).string( );
+
+        bool isExpected = directories ? fs::is_directory( it->status( ) ) : fs::is_regular_file( it->status( ) );
+        bool isIndexed = name.size( ) >= digitCount && name.find_first_not_of( "0123456789" ) >= digitCount;
+        bool hasExtension = name.size( ) > digitCount && name[ digitCount ] == '.';
+
+        if ( ! isExpected || ! isIndexed || ( name.size( ) > digitCount && ( directories || ! hasExtension ) ) )
+            continue ;
+
+        if ( hasExtension && isToolOutput( name.substr( digitCount ) ) )
+            continue ;
+
+        unsigned long index = std::stoul( name.substr( 0, digitCount ) );
+
+        if ( ! items.insert( std::make_pair( index, it->path( ).string( ) ) ).second )
+            throw std::runtime_error( "Several files for the item " + ( fs::path( folder ) / name.substr( 0, digitCount ) ).string( ) + "." );
+
+    }
+
+    return items;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// The files (or folders) of an extracted tree standing for the items of a
+// container : their name is the item index, on a fixed number of digits,
+// followed by an extension (for the files). The other names are ignored,
+// and so are the files the tools write next to the items they extract
+// (manifests and archives). Throws if an index is used twice.
+
+std::map< unsigned long, std::string > listIndexed( std::string const & folder, unsigned int digitCount, bool directories );
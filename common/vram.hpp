@@ -1,7 +1,45 @@
 #pragma once
 
+#include <algorithm>
+
 #include <boost/cstdint.hpp>
 
 #include "constants.hpp"
 
 typedef boost::uint16_t VRAM[ SIZE( VRAM ) ];
+
+// Rectangle inside the VRAM, in 16 bits units.
+
+struct VRAMRect {
+
+    boost::uint32_t left;
+
+    boost::uint32_t top;
+
+    boost::uint32_t width;
+
+    boost::uint32_t height;
+
+    inline bool intersects( VRAMRect const & other ) const;
+
+    inline VRAMRect intersection( VRAMRect const & other ) const;
+
+};
+
+bool VRAMRect::intersects( VRAMRect const & other ) const
+{
+    return this->left < other.left + other.width && other.left < this->left + this->width
+        && this->top < other.top + other.height && other.top < this->top + this->height;
+}
+
+VRAMRect VRAMRect::intersection( VRAMRect const & other ) const
+{
+    VRAMRect rect;
+
+    rect.left = std::max( this->left, other.left );
+    rect.top = std::max( this->top, other.top );
+    rect.width = std::min( this->left + this->width, other.left + other.width ) - rect.left;
+    rect.height = std::min( this->top + this->height, other.top + other.height ) - rect.top;
+
+    return rect;
+}
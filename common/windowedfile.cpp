@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/cstdint.hpp>
+
+#include "constants.hpp"
+#include "memoryrange.hpp"
+#include "stats.hpp"
+#include "windowedfile.hpp"
+
+#define ALIGN_DOWN( N, F ) ( ( N ) / ( F ) * ( F ) )
+#define ALIGN_UP( N, F ) ALIGN_DOWN( ( N ) + ( F ) - 1, F )
+
+WindowedFile::WindowedFile( std::string const & path, unsigned long maxMemory )
+    : m_position( 0 )
+    , m_nextBuffer( 0 )
+{
+    this->m_fd = path == "-" ? dup( STDIN_FILENO ) : open( path.c_str( ), O_RDONLY );
+    if ( this->m_fd < 0 )
+        throw std::runtime_error( "Cannot open " + path + " (" + std::strerror( errno ) + ")" );
+
+    struct stat status;
+    fstat( this->m_fd, & status );
+
+    this->m_isSequential = ! S_ISREG( status.st_mode ) && ! S_ISBLK( status.st_mode );
+    this->m_size = this->m_isSequential ? std::numeric_limits< unsigned long >::max( ) : status.st_size;
+
+    unsigned int bufferCount = WINDOWEDFILE_BUFFER_COUNT;
+
+    if ( maxMemory == 0 && this->m_isSequential ) {
+        this->m_windowSize = WINDOWEDFILE_PIPE_WINDOW;
+    } else if ( maxMemory == 0 ) {
+        this->m_windowSize = ALIGN_UP( std::max( this->m_size, 1UL ), SECTOR_LENGTH );
+        bufferCount = 1;
+    } else {
+        this->m_windowSize = ALIGN_DOWN( maxMemory / bufferCount, SECTOR_LENGTH );
+    }
+
+    if ( this->m_windowSize == 0 ) {
+        close( this->m_fd );
+        throw std::runtime_error( "Memory budget too small (at least one sector per buffer is needed)." );
+    }
+
+    for ( unsigned int t = 0; t < bufferCount; ++ t ) {
+
+        Buffer buffer;
+        buffer.offset = buffer.size = 0;
+
+        // The destructor does not run when the constructor throws
+
+        if ( posix_memalign( reinterpret_cast< void ** >( & buffer.data ), SECTOR_LENGTH, this->m_windowSize ) != 0 ) {
+            for ( Buffer & allocated : this->m_buffers )
+                std::free( allocated.data );
+            close( this->m_fd );
+            throw std::bad_alloc( );
+        }
+
+        this->m_buffers.push_back( buffer );
+
+    }
+}
+
+WindowedFile::~WindowedFile( void )
+{
+    for ( Buffer & buffer : this->m_buffers )
+        std::free( buffer.data );
+
+    close( this->m_fd );
+}
+
+void WindowedFile::fill( Buffer & buffer, unsigned long offset, unsigned long size )
+{
+    STATS_TIMER( timer, "read" );
+
+    buffer.offset = offset;
+    buffer.size = 0;
+
+    if ( this->m_isSequential ) {
+
+        if ( offset < this->m_position )
+            throw std::runtime_error( "Cannot read backward in a sequential input." );
+
+        // The skipped bytes go through the buffer, which is overwritten below
+
+        while ( this->m_position < offset ) {
+
+            ssize_t count = read( this->m_fd, buffer.data, std::min( offset - this->m_position, this->m_windowSize ) );
+
+            if ( count < 0 && errno == EINTR )
+                continue ;
+
+            if ( count <= 0 )
+                throw std::runtime_error( "Unexpected end of input." );
+
+            this->m_position += count;
+
+        }
+
+    }
+
+    while ( buffer.size < size ) {
+
+        ssize_t count = this->m_isSequential
+            ? read( this->m_fd, buffer.data + buffer.size, size - buffer.size )
+            : pread( this->m_fd, buffer.data + buffer.size, size - buffer.size, offset + buffer.size );
+
+        if ( count < 0 && errno == EINTR )
+            continue ;
+
+        if ( count == 0 && this->m_isSequential )
+            break ;
+
+        if ( count <= 0 )
+            throw std::runtime_error( "Read failed." );
+
+        buffer.size += count;
+
+    }
+
+    if ( this->m_isSequential )
+        this->m_position = offset + buffer.size;
+
+    STATS_BYTES( timer, buffer.size );
+}
+
+WindowedFile::Buffer & WindowedFile::next( void )
+{
+    Buffer & buffer = this->m_buffers[ this->m_nextBuffer ];
+    this->m_nextBuffer = ( this->m_nextBuffer + 1 ) % this->m_buffers.size( );
+
+    return buffer;
+}
+
+MemoryRange WindowedFile::map( unsigned long offset, unsigned long size )
+{
+    if ( offset > this->m_size || size > this->m_size - offset )
+        throw std::out_of_range( "Invalid map (outside of the file)" );
+
+    for ( Buffer const & buffer : this->m_buffers ) {
+        if ( offset >= buffer.offset && offset + size <= buffer.offset + buffer.size ) {
+            boost::uint8_t const * begin = buffer.data + ( offset - buffer.offset );
+            return MemoryRange( begin, begin + size );
+        }
+    }
+
+    unsigned long windowOffset = ALIGN_DOWN( offset, SECTOR_LENGTH );
+
+    if ( offset + size - windowOffset > this->m_windowSize )
+        throw std::out_of_range( "Invalid map (larger than the memory window)" );
+
+    unsigned long windowEnd = std::min( windowOffset + this->m_windowSize, this->m_size );
+
+    // Reading ahead of a sequential input would consume bytes which the
+    // next calls may need
+
+    if ( this->m_isSequential ) {
+        windowOffset = offset;
+        windowEnd = offset + size;
+    }
+
+    Buffer & buffer = this->next( );
+    this->fill( buffer, windowOffset, windowEnd - windowOffset );
+
+    if ( offset + size > buffer.offset + buffer.size )
+        throw std::out_of_range( "Invalid map (past the end of the input)" );
+
+    // The following window is likely to be needed next
+
+    if ( windowEnd < this->m_size && ! this->m_isSequential )
+        posix_fadvise( this->m_fd, windowEnd, std::min( this->m_windowSize, this->m_size - windowEnd ), POSIX_FADV_WILLNEED );
+
+    boost::uint8_t const * begin = buffer.data + ( offset - windowOffset );
+    return MemoryRange( begin, begin + size );
+}
+
+void WindowedFile::stream( unsigned long offset, unsigned long size, std::function< void ( MemoryRange const & ) > const & function )
+{
+    if ( offset > this->m_size || size > this->m_size - offset )
+        throw std::out_of_range( "Invalid stream (outside of the file)" );
+
+    if ( size == 0 )
+        return ;
+
+    // With a single buffer there is nothing to overlap with
+
+    if ( this->m_buffers.size( ) == 1 ) {
+        function( this->map( offset, size ) );
+        return ;
+    }
+
+    unsigned long chunkOffset = offset, end = offset + size;
+    unsigned long chunkSize = std::min( end, ALIGN_DOWN( chunkOffset, SECTOR_LENGTH ) + this->m_windowSize ) - chunkOffset;
+
+    Buffer * current = & this->next( );
+    this->fill( * current, chunkOffset, chunkSize );
+
+    // A short chunk means the end of a sequential input has been reached
+
+    while ( current->size ) {
+
+        unsigned long nextOffset = chunkOffset + chunkSize;
+        unsigned long nextSize = current->size < chunkSize ? 0 : std::min( end - nextOffset, this->m_windowSize );
+
+        Buffer * upcoming = nextSize ? & this->next( ) : nullptr;
+
+        std::future< void > prefetch;
+        if ( upcoming )
+            prefetch = std::async( std::launch::async, [ this, upcoming, nextOffset, nextSize ] ( ) { this->fill( * upcoming, nextOffset, nextSize ); } );
+
+        function( MemoryRange( current->data, current->data + current->size ) );
+
+        if ( ! upcoming )
+            break ;
+
+        prefetch.get( );
+
+        current = upcoming;
+        chunkOffset = nextOffset;
+        chunkSize = nextSize;
+
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "memoryrange.hpp"
+
+// Read-only file accessed through a fixed ring of sector-aligned buffers,
+// so that large images can be parsed within a bounded amount of memory.
+// The ranges returned by map( ) stay valid until the ring wraps around to
+// their buffer, that is for at least WINDOWEDFILE_BUFFER_COUNT - 1 calls.
+//
+// Pipes (and "-", the standard input) are supported as long as they are
+// read front to back : the bytes between two reads are skipped, and going
+// back to data which is not buffered anymore is an error. Their size is
+// unknown, so size( ) is the largest possible offset, and the reads stop
+// at the end of the stream.
+
+#define WINDOWEDFILE_BUFFER_COUNT 4
+
+#define WINDOWEDFILE_PIPE_WINDOW ( 1024 * 1024 )
+
+class WindowedFile
+{
+
+public:
+
+    // A maxMemory of zero means no limit : the whole file fits in one window.
+
+    WindowedFile( std::string const & path, unsigned long maxMemory = 0 );
+
+    ~WindowedFile( void );
+
+public:
+
+    inline unsigned long size( void ) const;
+
+    inline unsigned long windowSize( void ) const;
+
+    inline bool isSequential( void ) const;
+
+public:
+
+    MemoryRange map( unsigned long offset, unsigned long size );
+
+    // Calls function on consecutive chunks of [offset, offset + size), each
+    // at most one window long. The next chunk is read while the current one
+    // is being processed.
+
+    void stream( unsigned long offset, unsigned long size, std::function< void ( MemoryRange const & ) > const & function );
+
+private:
+
+    struct Buffer {
+        boost::uint8_t * data;
+        unsigned long offset;
+        unsigned long size;
+    };
+
+    void fill( Buffer & buffer, unsigned long offset, unsigned long size );
+
+    Buffer & next( void );
+
+private:
+
+    int m_fd;
+
+    bool m_isSequential;
+
+    unsigned long m_position;
+
+    unsigned long m_size;
+
+    unsigned long m_windowSize;
+
+    std::vector< Buffer > m_buffers;
+
+    unsigned int m_nextBuffer;
+
+};
+
+unsigned long WindowedFile::size( void ) const
+{
+    return this->m_size;
+}
+
+unsigned long WindowedFile::windowSize( void ) const
+{
+    return this->m_windowSize;
+}
+
+bool WindowedFile::isSequential( void ) const
+{
+    return this->m_isSequential;
+}
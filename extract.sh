@@ -16,11 +16,17 @@ BATTLESCENES_DIR="${TARGET_DIR}"/battlescenes
 CHARACTERS_DIR="${TARGET_DIR}"/characters
 MONSTERS_DIR="${TARGET_DIR}"/monsters
 
+# When SHARD is set (as in SHARD=2/4), only this part of the image is
+# extracted ; the later steps only see the files of this part
+
+SHARD_OPTIONS="${SHARD:+--shard ${SHARD}}"
+
 ## Binaries
 
 FFIX_EXTRACT_IMG="${BINARY_DIR}"/ffix-extract-img
 FFIX_EXTRACT_DB="${BINARY_DIR}"/ffix-extract-db
 FFIX_CONVERT_BS="${BINARY_DIR}"/ffix-convert-bs
+FFIX_SCAN="${BINARY_DIR}"/ffix-scan
 
 ## Clean logs
 
@@ -28,37 +34,39 @@ FFIX_CONVERT_BS="${BINARY_DIR}"/ffix-convert-bs
 
 ## Extract files
 
+# Every tool keeps a manifest next to its output, and only rewrites the
+# files whose inputs changed since the previous run.
+
 extract_all_ff9dbs() {
-    local recurse=0
+    local dbs
 
-    find "$1" -name '*.ff9db' -print0 | sort -z | while read -r -d $'\0' db; do
-        recurse=1
+    # The nested DB files are expanded by the extractor itself (--recursive)
 
+    mapfile -d $'\0' dbs < <(find "$1" -mindepth 2 -maxdepth 2 -name '*.ff9db' -print0 | sort -z)
+
+    for db in "${dbs[@]}"; do
         echo " - ${db}"
 
         local destination="$(dirname "${db}")"/"$(basename "${db}" .ff9db)"
-        if ! ${FFIX_EXTRACT_DB} "${db}" "${destination}" >> "${LOG_PATH}"; then
-            echo This file will be removed from the source data directory.
+        if ! ${FFIX_EXTRACT_DB} --recursive --incremental --manifest "${destination}".manifest "${db}" "${destination}" >> "${LOG_PATH}"; then
+            echo This file has not been extracted.
         fi
-
-        rm -f "${db}"
     done
-
-    if [[ "${recurse}" -eq 1 ]]; then
-        extract_all_ff9dbs "$1"
-    fi
 }
 
-if [[ ! -e "${OBJECT_DIR}" || "${FFIX_EXTRACT_IMG}" -nt "${OBJECT_DIR}" || "${FFIX_EXTRACT_DB}" -nt "${OBJECT_DIR}" ]]; then
-    echo Extracting image file.
-    ${FFIX_EXTRACT_IMG} "${IMG_PATH}" "${OBJECT_DIR}" >> "${LOG_PATH}"
-    echo Extracting database files.
-    extract_all_ff9dbs "${OBJECT_DIR}"
-else
-    echo Object directory "(${OBJECT_DIR})" seems newer than your binaries. Skipping extraction.
-    echo Remove this folder to force new extraction.
+# The scan lists every corrupt file at once ; the extraction still goes
+# on, and only skips the files which cannot be parsed
+
+echo Scanning image file.
+if ! ${FFIX_SCAN} --quiet "${IMG_PATH}" >> "${LOG_PATH}"; then
+    echo Some files are corrupt, see "${LOG_PATH}".
 fi
 
+echo Extracting image file.
+${FFIX_EXTRACT_IMG} ${SHARD_OPTIONS} --exact-size --incremental --manifest "${OBJECT_DIR%/}".manifest "${IMG_PATH}" "${OBJECT_DIR}" >> "${LOG_PATH}"
+echo Extracting database files.
+extract_all_ff9dbs "${OBJECT_DIR}"
+
 ## Battle scenes
 
 echo Extracting battle scenes.
@@ -68,16 +76,26 @@ find "${OBJECT_DIR}/06" -mindepth 1 -maxdepth 1 -type d -print0 | sort -z | whil
     tims="$(find "${pack}" -name '*.tim' -print0 | sort -z | xargs -0 -r -n1 printf " --tim %s")"
 
     destination="${BATTLESCENES_DIR}/$(basename "${pack}")"
-    rm -rf "${destination}"
 
-    if ! ${FFIX_CONVERT_BS} --fake-textures-extension ."${TEXTURE_FORMAT}" "${pack}"/000/000.ff9bs "$destination" ${tims} >> "${LOG_PATH}"; then
+    # The formats written by the converter itself go straight into the
+    # archive ; the others need the TGA files on disk for mogrify
+
+    if [[ "${TEXTURE_FORMAT}" == tga || "${TEXTURE_FORMAT}" == dds ]]; then
+        if ! ${FFIX_CONVERT_BS} --textures-format "${TEXTURE_FORMAT}" --bundle zip "${pack}"/000/000.ff9bs "$destination" ${tims} >> "${LOG_PATH}"; then
+            echo This file has not been converted.
+        fi
+    elif ! ${FFIX_CONVERT_BS} --incremental --manifest "${destination}".manifest --fake-textures-extension ."${TEXTURE_FORMAT}" "${pack}"/000/000.ff9bs "$destination" ${tims} >> "${LOG_PATH}"; then
         echo This file has not been converted.
     else
+        # The TGA files are kept, so that the unchanged ones are not
+        # converted again
+
         find "${destination}" -name '*.tga' -print0 | while read -r -d $'\0' tga; do
-            mogrify -format "${TEXTURE_FORMAT}" "${tga}"
-            rm "${tga}"
+            if [[ "${tga}" -nt "${tga%.tga}.${TEXTURE_FORMAT}" ]]; then
+                mogrify -format "${TEXTURE_FORMAT}" "${tga}"
+            fi
         done
 
-        zip -r "${destination}".zip "${destination}"
+        zip -r -FS "${destination}".zip "${destination}" -x '*.tga'
     fi
 done
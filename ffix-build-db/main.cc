@@ -0,0 +1,249 @@
+#include <boost/filesystem/operations.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "db.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "path.hpp"
+#include "preallocatedfile.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "tree.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+#define CEIL_FACTOR( N, F ) ( ( N ) % ( F ) == 0 ? ( N ) : ( N ) + ( F ) - ( ( N ) % ( F ) ) )
+
+// An object of the tree, and where it goes in the DB.
+
+struct Object {
+    std::string source;
+    unsigned long size;
+    boost::uint32_t identifier;
+    unsigned long offset;
+};
+
+struct Pack {
+    boost::uint32_t dataType;
+    unsigned long offset;
+    std::vector< Object > objects;
+};
+
+void writeLittle( std::vector< boost::uint8_t > & buffer, unsigned long offset, boost::uint32_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t )
+        buffer[ offset + t ] = ( value >> ( t * 8 ) ) & 0xFF;
+}
+
+// Lists the tree, then places every pack : each one starts on a 4 bytes
+// boundary, with its header, its identifiers and pointers tables, then its
+// objects, one after the other. The identifiers come from the template DB
+// when there is one, and are the object indices otherwise (they are not
+// part of the extracted tree).
+
+std::vector< Pack > planDB( std::string const & root, std::map< std::pair< unsigned long, unsigned long >, boost::uint32_t > const & identifiers, unsigned long & size )
+{
+    STATS_TIMER( timer, "plan" );
+
+    std::map< unsigned long, std::string > folders = listIndexed( root, 3, true );
+
+    std::vector< Pack > packs( folders.empty( ) ? 0 : folders.rbegin( )->first + 1, Pack{ 0, 0, std::vector< Object >( ) } );
+
+    if ( packs.size( ) > 0xFF )
+        throw std::runtime_error( "Too many packs (255 at most)." );
+
+    for ( std::pair< unsigned long const, std::string > const & folder : folders ) {
+
+        std::map< unsigned long, std::string > files = listIndexed( folder.second, 3, false );
+        Pack & pack = packs[ folder.first ];
+
+        if ( files.size( ) > 0xFF )
+            throw std::runtime_error( "Too many objects in " + folder.second + " (255 at most)." );
+
+        for ( std::pair< unsigned long const, std::string > const & file : files ) {
+
+            // A pack has no way to skip an object
+
+            if ( file.first != pack.objects.size( ) )
+                throw std::runtime_error( "Missing object before " + file.second + "." );
+
+            std::string name = fs::path( file.second ).filename( ).string( );
+            boost::uint32_t dataType = DB::dataType( name.substr( 3 ) );
+
+            if ( ! pack.objects.empty( ) && dataType != pack.dataType )
+                throw std::runtime_error( "Objects of several types in " + folder.second + "." );
+
+            std::map< std::pair< unsigned long, unsigned long >, boost::uint32_t >::const_iterator identifier = identifiers.find( std::make_pair( folder.first, file.first ) );
+
+            pack.dataType = dataType;
+            pack.objects.push_back( Object{ file.second, static_cast< unsigned long >( fs::file_size( file.second ) ), identifier != identifiers.end( ) ? identifier->second : static_cast< boost::uint32_t >( file.first ), 0 } );
+
+        }
+
+    }
+
+    unsigned long offset = 4 + 4 * packs.size( );
+
+    for ( unsigned long packIndex = 0; packIndex < packs.size( ); ++ packIndex ) {
+
+        Pack & pack = packs[ packIndex ];
+
+        offset = CEIL_FACTOR( offset, 4 );
+        pack.offset = offset;
+
+        // Pack pointers are stored on 3 bytes
+
+        if ( pack.offset - 4 - packIndex * 4 > 0xFFFFFF )
+            throw std::runtime_error( "The DB would be too large (the packs have to start within its first 16MB)." );
+
+        offset += 4 + CEIL_FACTOR( pack.objects.size( ) * 2, 4 ) + ( pack.objects.size( ) + 1 ) * 4;
+
+        for ( Object & object : pack.objects ) {
+            object.offset = offset;
+            offset += object.size;
+        }
+
+    }
+
+    size = offset;
+
+    return packs;
+}
+
+////////////
+// See db.cpp for the layout. The object pointers are stored relative to
+// their own position in the pointer table (minus the identifiers table),
+// and the pointer following the last object tells where it ends.
+
+void writeTables( PreallocatedFile & output, std::vector< Pack > const & packs )
+{
+    std::vector< boost::uint8_t > header( 4 + 4 * packs.size( ) );
+
+    writeLittle( header, 0, 0xDB, 1 );
+    writeLittle( header, 1, packs.size( ), 1 );
+
+    for ( unsigned long packIndex = 0; packIndex < packs.size( ); ++ packIndex ) {
+
+        Pack const & pack = packs[ packIndex ];
+
+        unsigned long objectCount = pack.objects.size( );
+        unsigned long identifiersByteLength = CEIL_FACTOR( objectCount * 2, 4 );
+        unsigned long base = pack.offset + 4;
+
+        writeLittle( header, 4 + packIndex * 4, ( pack.offset - 4 - packIndex * 4 ) | ( pack.dataType << 24 ), 4 );
+
+        std::vector< boost::uint8_t > tables( 4 + identifiersByteLength + ( objectCount + 1 ) * 4 );
+
+        writeLittle( tables, 0, pack.dataType, 1 );
+        writeLittle( tables, 1, objectCount, 1 );
+
+        for ( unsigned long objectIndex = 0; objectIndex < objectCount; ++ objectIndex )
+            writeLittle( tables, 4 + objectIndex * 2, pack.objects[ objectIndex ].identifier, 2 );
+
+        unsigned long end = objectCount ? pack.objects.back( ).offset + pack.objects.back( ).size : pack.offset + tables.size( );
+
+        for ( unsigned long objectIndex = 0; objectIndex <= objectCount; ++ objectIndex ) {
+            unsigned long objectOffset = objectIndex < objectCount ? pack.objects[ objectIndex ].offset : end;
+            writeLittle( tables, 4 + identifiersByteLength + objectIndex * 4, objectOffset - base - identifiersByteLength - objectIndex * 4, 4 );
+        }
+
+        output.write( pack.offset, tables.data( ), tables.size( ) );
+
+    }
+
+    output.write( 0, header.data( ), header.size( ) );
+}
+
+int main( int argc, char ** argv )
+{
+    po::options_description options( "Allowed options" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count" );
+    options.add_options( )( "template", po::value< std::string >( ), "Take the object identifiers from this DB (usually the one the tree was extracted from)" );
+    options.add_options( )( "input", po::value< std::string >( )->required( ) );
+    options.add_options( )( "output", po::value< std::string >( )->required( ) );
+
+    po::positional_options_description positional;
+    positional.add( "input", 1 );
+    positional.add( "output", 1 );
+
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
+    po::notify( vm );
+
+    Log::start( vm );
+
+    Stats::start( );
+
+    if ( vm.count( "input" ) && vm.count( "output" ) ) {
+
+        std::map< std::pair< unsigned long, unsigned long >, boost::uint32_t > identifiers;
+
+        if ( vm.count( "template" ) ) {
+
+            std::vector< boost::uint8_t > content = Path( vm[ "template" ].as< std::string >( ) ).read( );
+
+            for ( DB::Object const & object : DB( MemoryRange( content ) ) ) {
+                identifiers[ std::make_pair( object.packIndex, object.objectIndex ) ] = object.identifier;
+            }
+
+        }
+
+        unsigned long size;
+        std::vector< Pack > packs = planDB( vm[ "input" ].as< std::string >( ), identifiers, size );
+
+        std::vector< Object const * > objects;
+        for ( Pack const & pack : packs )
+            for ( Object const & object : pack.objects )
+                objects.push_back( & object );
+
+        LOG( Info, "Pointer count : " << packs.size( ) );
+        LOG( Info, "Object count  : " << objects.size( ) );
+
+        PreallocatedFile output( vm[ "output" ].as< std::string >( ), size );
+
+        writeTables( output, packs );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        pool.parallelFor( objects.size( ), [ & ] ( unsigned long objectIndex ) {
+            Object const & object = * objects[ objectIndex ];
+            LOG( Verbose, "Writing " << object.source );
+            output.copy( object.offset, object.source, object.size );
+            STATS_COUNT( "objects", 1 );
+            STATS_COUNT( "bytes", object.size );
+        } );
+
+        output.close( );
+
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-build-db" );
+
+        return 0;
+
+    } else {
+
+        std::cerr << "Usage: " << argv[ 0 ] << " [options] <source folder> <*.ff9db path>" << std::endl;
+        std::cerr << options;
+
+        return -1;
+
+    }
+}
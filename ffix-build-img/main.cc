@@ -0,0 +1,365 @@
+#include <boost/filesystem/operations.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include "constants.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "parse.hpp"
+#include "preallocatedfile.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "tree.hpp"
+#include "windowedfile.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+namespace qi = boost::spirit::qi;
+
+#define SECTOR_COUNT( LENGTH ) ( ( ( LENGTH ) + SECTOR_LENGTH - 1 ) / SECTOR_LENGTH )
+
+// Memory the template is read with : only its directory is needed.
+
+#define TEMPLATE_MEMORY ( WINDOWEDFILE_BUFFER_COUNT * 4 * 1024 * 1024 )
+
+// An entry of the tree, and where it goes in the image. The identifier is
+// the first dword of a file list entry : the file ID, then the unknown
+// field.
+
+struct Entry {
+    std::string source;
+    unsigned long long size;
+    unsigned long sector;
+    boost::uint32_t identifier;
+    bool exists;
+};
+
+////////////
+// Containers holding every entry from 0 to their entry count are written
+// as file lists (0x02) ; the others as fragment lists (0x03), in which the
+// missing entries are marked by 0xFFFF. The directory ends with an empty
+// terminator (0x04), whose base sector is the end of the image.
+
+struct Container {
+    boost::uint32_t type;
+    unsigned long listSector;
+    unsigned long baseSector;
+    std::vector< Entry > entries;
+};
+
+// What the tree does not hold, taken from the image it was extracted from :
+// the unknown fields of the header, the container types (for the 0x04
+// ones, which have no folder) and the identifiers of the file lists.
+
+struct Template {
+    boost::uint32_t headerFields[ 2 ];
+    std::vector< boost::uint32_t > types;
+    std::map< std::pair< unsigned long, unsigned long >, boost::uint32_t > identifiers;
+};
+
+void writeLittle( std::vector< boost::uint8_t > & buffer, unsigned long offset, boost::uint32_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t )
+        buffer[ offset + t ] = ( value >> ( t * 8 ) ) & 0xFF;
+}
+
+////////////
+// 4 bytes : magic 0x46463920
+// 4 bytes : - unknown -
+// 4 bytes : directories count
+// 4 bytes : - unknown -
+//
+// Only the directory is read : the descriptors, and the file lists.
+
+Template readTemplate( std::string const & path )
+{
+    STATS_TIMER( timer, "template" );
+
+    WindowedFile image( path, TEMPLATE_MEMORY );
+    Template imageTemplate;
+
+    boost::uint32_t magicNumber;
+    boost::uint32_t containerCount;
+
+    MemoryRange range = image.map( 0, 16 );
+
+    parse( range, qi::big_dword, magicNumber );
+    if ( magicNumber != 0x46463920 )
+        throw std::runtime_error( "Bad magic number in the template." );
+
+    parse( range, qi::little_dword, imageTemplate.headerFields[ 0 ] );
+    parse( range, qi::little_dword, containerCount );
+    parse( range, qi::little_dword, imageTemplate.headerFields[ 1 ] );
+
+    std::vector< boost::uint8_t > descriptors;
+    MemoryRange descriptorsRange = image.map( 16, 16 * containerCount );
+    descriptors.assign( descriptorsRange.begin( ), descriptorsRange.end( ) );
+
+    for ( unsigned long containerIndex = 0; containerIndex < containerCount; ++ containerIndex ) {
+
+        MemoryRange descriptor( & descriptors[ 16 * containerIndex ], & descriptors[ 16 * containerIndex ] + 16 );
+
+        boost::uint32_t type;
+        boost::uint32_t entryCount;
+        boost::uint32_t entryListSector;
+
+        parse( descriptor, qi::little_dword, type );
+        parse( descriptor, qi::little_dword, entryCount );
+        parse( descriptor, qi::little_dword, entryListSector );
+
+        imageTemplate.types.push_back( type );
+
+        if ( type != 0x02 )
+            continue ;
+
+        MemoryRange list = image.map( static_cast< unsigned long >( entryListSector ) * SECTOR_LENGTH, entryCount * 8 );
+
+        for ( unsigned long entryIndex = 0; entryIndex < entryCount; ++ entryIndex ) {
+            parse( list, qi::little_dword, imageTemplate.identifiers[ std::make_pair( containerIndex, entryIndex ) ] );
+            parse( list, qi::little_dword );
+        }
+
+    }
+
+    return imageTemplate;
+}
+
+// Lists the tree, then places every part of the image : the header and the
+// container descriptors, the entry lists, then the entries, container after
+// container. The entries of a container are contiguous, and each one ends
+// where the next one begins, as the parser expects. The empty containers
+// which are terminators in the template stay so ; without one, a single
+// terminator is added at the end.
+
+std::vector< Container > planImage( std::string const & root, Template const * imageTemplate, unsigned long & sectorCount )
+{
+    STATS_TIMER( timer, "plan" );
+
+    std::map< unsigned long, std::string > folders = listIndexed( root, 2, true );
+
+    std::vector< Container > containers( folders.empty( ) ? 0 : folders.rbegin( )->first + 1, Container{ 0x02, 0, 0, std::vector< Entry >( ) } );
+
+    for ( std::pair< unsigned long const, std::string > const & folder : folders ) {
+
+        std::map< unsigned long, std::string > files = listIndexed( folder.second, 3, false );
+
+        Container & container = containers[ folder.first ];
+        container.entries.resize( files.empty( ) ? 0 : files.rbegin( )->first + 1, Entry{ std::string( ), 0, 0, 0, false } );
+
+        for ( std::pair< unsigned long const, std::string > const & file : files )
+            container.entries[ file.first ] = Entry{ file.second, fs::file_size( file.second ), 0, 0, true };
+
+        container.type = files.size( ) == container.entries.size( ) ? 0x02 : 0x03;
+
+    }
+
+    if ( imageTemplate ) {
+
+        if ( imageTemplate->types.size( ) > containers.size( ) )
+            containers.resize( imageTemplate->types.size( ), Container{ 0x02, 0, 0, std::vector< Entry >( ) } );
+
+        for ( unsigned long containerIndex = 0; containerIndex < imageTemplate->types.size( ); ++ containerIndex )
+            if ( imageTemplate->types[ containerIndex ] == 0x04 && containers[ containerIndex ].entries.empty( ) )
+                containers[ containerIndex ].type = 0x04;
+
+    }
+
+    if ( containers.empty( ) || containers.back( ).type != 0x04 )
+        containers.push_back( Container{ 0x04, 0, 0, std::vector< Entry >( ) } );
+
+    for ( unsigned long containerIndex = 0; containerIndex < containers.size( ); ++ containerIndex ) {
+
+        Container & container = containers[ containerIndex ];
+
+        for ( unsigned long entryIndex = 0; entryIndex < container.entries.size( ); ++ entryIndex ) {
+
+            std::map< std::pair< unsigned long, unsigned long >, boost::uint32_t >::const_iterator identifier;
+
+            if ( imageTemplate && ( identifier = imageTemplate->identifiers.find( std::make_pair( containerIndex, entryIndex ) ) ) != imageTemplate->identifiers.end( ) ) {
+                container.entries[ entryIndex ].identifier = identifier->second;
+            } else {
+                container.entries[ entryIndex ].identifier = entryIndex;
+            }
+
+        }
+
+    }
+
+    unsigned long sector = SECTOR_COUNT( 16 + 16 * containers.size( ) );
+
+    for ( Container & container : containers ) {
+        container.listSector = sector;
+        sector += SECTOR_COUNT( container.entries.size( ) * ( container.type == 0x02 ? 8 : container.type == 0x03 ? 2 : 0 ) );
+    }
+
+    for ( unsigned long containerIndex = 0; containerIndex < containers.size( ); ++ containerIndex ) {
+
+        Container & container = containers[ containerIndex ];
+        container.baseSector = sector;
+
+        for ( Entry & entry : container.entries ) {
+
+            if ( ! entry.exists )
+                continue ;
+
+            entry.sector = sector;
+            sector += SECTOR_COUNT( entry.size );
+
+            if ( container.type == 0x03 && entry.sector - container.baseSector >= 0xFFFF ) {
+                std::ostringstream errorBuilder;
+                errorBuilder << "Container " << containerIndex << " has missing entries, and is too large to be written as a fragment list.";
+                throw std::runtime_error( errorBuilder.str( ) );
+            }
+
+        }
+
+        LOG( Verbose, "Container #" << containerIndex << " : type 0x" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << container.type << std::dec << ", " << container.entries.size( ) << " entries, sectors " << container.baseSector << " to " << sector );
+
+    }
+
+    sectorCount = sector;
+
+    return containers;
+}
+
+////////////
+// 4 bytes : magic 0x46463920
+// 4 bytes : - unknown - (from the template, or 0)
+// 4 bytes : directories count
+// 4 bytes : - unknown - (from the template, or 0)
+//
+// See ffix-extract-img for the directories layout.
+
+void writeDirectory( PreallocatedFile & output, std::vector< Container > const & containers, Template const * imageTemplate )
+{
+    std::vector< boost::uint8_t > header( 16 + 16 * containers.size( ) );
+
+    writeLittle( header, 0, 0x20394646, 4 );
+    writeLittle( header, 4, imageTemplate ? imageTemplate->headerFields[ 0 ] : 0, 4 );
+    writeLittle( header, 8, containers.size( ), 4 );
+    writeLittle( header, 12, imageTemplate ? imageTemplate->headerFields[ 1 ] : 0, 4 );
+
+    for ( unsigned long containerIndex = 0; containerIndex < containers.size( ); ++ containerIndex ) {
+
+        Container const & container = containers[ containerIndex ];
+        unsigned long descriptor = 16 + 16 * containerIndex;
+
+        writeLittle( header, descriptor + 0, container.type, 4 );
+        writeLittle( header, descriptor + 4, container.entries.size( ), 4 );
+        writeLittle( header, descriptor + 8, container.listSector, 4 );
+        writeLittle( header, descriptor + 12, container.baseSector, 4 );
+
+        std::vector< boost::uint8_t > list( container.entries.size( ) * ( container.type == 0x02 ? 8 : container.type == 0x03 ? 2 : 0 ) );
+
+        for ( unsigned long entryIndex = 0; entryIndex < container.entries.size( ); ++ entryIndex ) {
+
+            Entry const & entry = container.entries[ entryIndex ];
+
+            if ( container.type == 0x02 ) {
+                writeLittle( list, entryIndex * 8 + 0, entry.identifier, 4 );
+                writeLittle( list, entryIndex * 8 + 4, entry.sector, 4 );
+            } else {
+                writeLittle( list, entryIndex * 2, entry.exists ? entry.sector - container.baseSector : 0xFFFF, 2 );
+            }
+
+        }
+
+        output.write( static_cast< unsigned long long >( container.listSector ) * SECTOR_LENGTH, list.data( ), list.size( ) );
+
+    }
+
+    output.write( 0, header.data( ), header.size( ) );
+}
+
+int main( int argc, char ** argv )
+{
+    po::options_description options( "Allowed options" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count" );
+    options.add_options( )( "template", po::value< std::string >( ), "Take the terminators, the unknown header fields and the entry identifiers from this image (usually the one the tree was extracted from)" );
+    options.add_options( )( "input", po::value< std::string >( )->required( ) );
+    options.add_options( )( "output", po::value< std::string >( )->required( ) );
+
+    po::positional_options_description positional;
+    positional.add( "input", 1 );
+    positional.add( "output", 1 );
+
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
+    po::notify( vm );
+
+    Log::start( vm );
+
+    Stats::start( );
+
+    if ( vm.count( "input" ) && vm.count( "output" ) ) {
+
+        std::unique_ptr< Template > imageTemplate;
+
+        if ( vm.count( "template" ) )
+            imageTemplate.reset( new Template( readTemplate( vm[ "template" ].as< std::string >( ) ) ) );
+
+        unsigned long sectorCount;
+        std::vector< Container > containers = planImage( vm[ "input" ].as< std::string >( ), imageTemplate.get( ), sectorCount );
+
+        std::vector< Entry const * > entries;
+        for ( Container const & container : containers )
+            for ( Entry const & entry : container.entries )
+                if ( entry.exists )
+                    entries.push_back( & entry );
+
+        LOG( Info, "Container count : " << containers.size( ) );
+        LOG( Info, "Entry count     : " << entries.size( ) );
+        LOG( Info, "Image size      : " << sectorCount << " sector(s)" );
+
+        // Every entry has its place already : they are copied concurrently,
+        // the padding being left to the zeros of the preallocated file
+
+        PreallocatedFile output( vm[ "output" ].as< std::string >( ), static_cast< unsigned long long >( sectorCount ) * SECTOR_LENGTH );
+
+        writeDirectory( output, containers, imageTemplate.get( ) );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        pool.parallelFor( entries.size( ), [ & ] ( unsigned long entryIndex ) {
+            Entry const & entry = * entries[ entryIndex ];
+            LOG( Verbose, "Writing " << entry.source );
+            output.copy( static_cast< unsigned long long >( entry.sector ) * SECTOR_LENGTH, entry.source, entry.size );
+            STATS_COUNT( "entries", 1 );
+            STATS_COUNT( "bytes", entry.size );
+        } );
+
+        output.close( );
+
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-build-img" );
+
+        return 0;
+
+    } else {
+
+        std::cerr << "Usage: " << argv[ 0 ] << " [options] <source folder> <FF9.IMG path>" << std::endl;
+        std::cerr << options;
+
+        return -1;
+
+    }
+}
@@ -1,333 +1,481 @@
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
+#include <boost/filesystem/operations.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/positional_options.hpp>
 #include <boost/program_options/variables_map.hpp>
-#include <boost/spirit/include/qi.hpp>
 #include <boost/cstdint.hpp>
 
+#include "battlescene.hpp"
+#include "bc.hpp"
+#include "bundle.hpp"
+#include "bvh.hpp"
 #include "constants.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
 #include "memoryrange.hpp"
-#include "parse.hpp"
+#include "mesh.hpp"
 #include "path.hpp"
+#include "raster.hpp"
+#include "shard.hpp"
+#include "simplify.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
 #include "tim.hpp"
 #include "vram.hpp"
 
 namespace po = boost::program_options;
-namespace qi = boost::spirit::qi;
 
-// Base color palette used for battle scenes.
-// Each value in the textures is actually an index to one of this array's cells.
+// Part of the inputs of every converted file : bump it whenever a change
+// alters the output, so that --incremental does not keep the files written
+// by the previous versions.
 //
 
-boost::uint8_t g_primitivePalette[] = {
+#define TOOL_VERSION "ffix-convert-bs 1"
 
-      0,   8,  16,  24,
-     32,  40,  48,  56,
-     65,  73,  81,  89,
-    100, 108, 118, 125,
-    135, 143, 152, 162,
-    170, 178, 186, 194,
-    202, 210, 217, 225,
-    232, 240, 246, 255
+// Format of the exported textures, either "tga" or "dds".
+// DDS textures are block compressed (BC1 or BC3) and carry a full mip chain.
+//
 
-};
+std::string g_texturesFormat;
 
 // Texture extension in the material file.
-// Does not affect the actual format of exported textures, which will always be TGA.
+// Does not affect the actual format of exported textures, which is set by g_texturesFormat.
 //
 
 std::string g_fakeTexturesExtension;
 
+// Format of the exported geometry, either "obj" (along with its MTL file)
+// or "ff9mesh" (see mesh.hpp).
+//
+
+std::string g_geometryFormat;
+
+// Number of simplified levels of detail written after the full geometry
+// (--lods), each level having half the triangles of the previous one.
+//
+
+unsigned int g_lodCount = 0;
+
+// Whether bounding volume hierarchies of the full geometry are also
+// written into geometry.ff9bvh (--bvh, see bvh.hpp).
+//
+
+bool g_bvh = false;
+
+// List of the written files (--manifest), and whether the files it lists
+// should be left untouched when their inputs did not change.
 //
+
+std::unique_ptr< Manifest > g_manifest;
+
+bool g_incremental = false;
+
+// Part of the outputs converted by this run (--shard) : each texture is an
+// item, and the geometry (OBJ and MTL files or mesh, the hierarchies and
+// the preview) is another one.
 //
 
-void parseTexture( VRAM const & vram, MemoryRange range, Path outputPath, boost::uint16_t textureIndex )
+Shard g_shard;
+
+// Width and height of the scene preview (--thumbnail), or 0 when there is
+// none. The preview goes along with the geometry.
+//
+
+unsigned int g_thumbnailSize = 0;
+
+//
+//
+
+void dumpTexture( Path const & outputPath, boost::uint16_t width, boost::uint16_t height, std::vector< boost::uint32_t > const & data, ThreadPool & pool )
 {
-    // binary packet structure :
-    // aaaaaaaa aabbbbbb ???????? ccccdddd
-    //
-    // a : palyy
-    // b : palxx
-    //
-    // c : texture Y
-    // d : texture X
+    if ( g_texturesFormat == "dds" ) {
 
-    boost::uint32_t packet;
-    parse( range, qi::dword, packet );
+        STATS_TIMER( timer, "encode texture" );
 
-    boost::uint8_t palX = ( ( packet >> 16 ) & 0x3F ) * 16 * 2;
-    boost::uint8_t palY = ( ( packet >> 22 ) );
-    boost::uint8_t texX = ( packet >> 0 ) & 0xF;
-    boost::uint8_t texY = ( packet >> 4 ) & 0x1;
+        BlockFormat format = selectBlockFormat( data );
+        std::vector< MipLevel > chain = buildMipChain( width, height, data );
 
-    // Palette generation
+        std::vector< std::vector< boost::uint8_t > > levels;
+        for ( MipLevel const & level : chain )
+            levels.push_back( encodeBlocks( format, level, pool ) );
 
-    boost::uint32_t palette[ SIZE( BATTLESCENE_PALETTE ) ] = { };
+        outputPath.dumpDds( width, height, format == BlockFormatBC1 ? "DXT1" : "DXT5", levels );
 
-    for ( int u = 0; u < SIZE( BATTLESCENE_PALETTE ); ++ u ) {
+    } else {
 
-        boost::uint16_t colorIndex = vram[ palY * VRAM_WIDTH + palX + u ];
+        outputPath.dumpTga( width, height, data );
 
-        palette[ u ]
-            = ( g_primitivePalette[ ( colorIndex >>  0 ) & 0x1f ] << 16 )
-            | ( g_primitivePalette[ ( colorIndex >>  5 ) & 0x1f ] <<  8 )
-            | ( g_primitivePalette[ ( colorIndex >> 10 ) & 0x1f ] <<  0 )
-            ;
+    }
+}
 
-        if ( ( colorIndex & 0x8000 ) == 0x8000 ) {
-            palette[ u ] |= 0xff000000;
-        }
+// Writes a file produced in memory, unless the previous run already wrote
+// it from the same inputs, or wrote the same content.
+
+void dumpTracked( Path const & outputPath, std::string const & content, boost::uint64_t inputs )
+{
+    boost::uint64_t hash = Hash( ).update( reinterpret_cast< boost::uint8_t const * >( content.data( ) ), content.size( ) ).digest( );
 
+    if ( g_incremental && ( g_manifest->keep( outputPath.string( ), inputs ) || g_manifest->keep( outputPath.string( ), hash, content.size( ), inputs ) ) ) {
+        STATS_COUNT( "unchanged", 1 );
+        return ;
     }
 
-    // Image restitution
+    outputPath.dump( content );
 
-    std::vector< boost::uint32_t > data( SIZE( BATTLESCENE_TEXTURE ) );
+    if ( g_manifest ) {
+        g_manifest->add( outputPath.string( ), hash, content.size( ), inputs );
+    }
+}
 
-    for ( boost::uint32_t y = 0; y < BATTLESCENE_TEXTURE_HEIGHT; ++ y ) {
-        for ( boost::uint32_t x = 0; x < BATTLESCENE_TEXTURE_WIDTH; ++ x ) {
-            boost::uint8_t const * binaryvram = reinterpret_cast< boost::uint8_t const * >( & vram );
-            boost::uint32_t absoluteX = texX * BATTLESCENE_CELL_WIDTH + x;
-            boost::uint32_t absoluteY = texY * BATTLESCENE_CELL_HEIGHT + y;
-            data[ y * BATTLESCENE_TEXTURE_WIDTH + x ] = palette[ binaryvram[ absoluteY * VRAM_WIDTH * 2 + absoluteX ] ];
-        }
+// A texture only depends on its packet and on the VRAM content ; inputs
+// tells both, along with the conversion options.
+
+void parseTexture( VRAM const & vram, BattleScene const & scene, Path outputPath, boost::uint16_t textureIndex, boost::uint64_t inputs, ThreadPool & pool )
+{
+    if ( g_incremental && g_manifest->keep( outputPath.string( ), inputs ) ) {
+        STATS_COUNT( "unchanged", 1 );
+        return ;
     }
 
+    std::vector< boost::uint32_t > data = scene.decodeTexture( vram, textureIndex );
+
     // Store to disk
 
-    outputPath.dumpTga( BATTLESCENE_TEXTURE_WIDTH, BATTLESCENE_TEXTURE_HEIGHT, data );
+    dumpTexture( outputPath, BATTLESCENE_TEXTURE_WIDTH, BATTLESCENE_TEXTURE_HEIGHT, data, pool );
+
+    if ( g_manifest ) {
+        boost::uint64_t hash = Hash( ).update( reinterpret_cast< boost::uint8_t const * >( data.data( ) ), data.size( ) * 4 ).digest( );
+        g_manifest->add( outputPath.string( ), hash, boost::filesystem::file_size( outputPath.string( ) ), inputs );
+    }
 
+    STATS_COUNT( "textures", 1 );
 }
 
-////////////
-// 4 bytes : ???
-// 2 bytes : object count
-// 2 bytes : ???
-// 2 bytes : texture count
-// 2 bytes : textures offset
-// 2 bytes : ???
-// 2 bytes : object offset
+// The preview depends on the same inputs as the geometry and the textures
+// together : the scene and the VRAM content.
 
-void parseBattleScene( VRAM const & vram, MemoryRange range, Path outputPath )
+void renderThumbnail( VRAM const & vram, BattleScene const & scene, Path outputPath, boost::uint64_t inputs, ThreadPool & pool )
 {
-    parse( range, qi::dword );
+    if ( g_incremental && g_manifest->keep( outputPath.string( ), inputs ) ) {
+        STATS_COUNT( "unchanged", 1 );
+        return ;
+    }
 
-    boost::uint16_t objectCount;
-    parse( range, qi::word, objectCount );
+    std::vector< boost::uint32_t > data = renderScene( scene, vram, g_thumbnailSize, g_thumbnailSize, pool );
 
-    parse( range, qi::word );
+    outputPath.dumpTga( g_thumbnailSize, g_thumbnailSize, data );
 
-    boost::uint16_t textureCount;
-    parse( range, qi::word, textureCount );
+    if ( g_manifest ) {
+        boost::uint64_t hash = Hash( ).update( reinterpret_cast< boost::uint8_t const * >( data.data( ) ), data.size( ) * 4 ).digest( );
+        g_manifest->add( outputPath.string( ), hash, boost::filesystem::file_size( outputPath.string( ) ), inputs );
+    }
+
+    STATS_COUNT( "thumbnails", 1 );
+}
+
+// Loads into the VRAM the TIM files covering at least one of the required
+// rectangles, and skips the others without reading more than their header.
+// Overlapping images and uncovered areas are reported.
+
+void loadTims( VRAM & vram, std::vector< std::string > const & paths, std::vector< VRAMRect > const & requiredRects, bool loadAll )
+{
+    std::vector< std::string > loadedPaths;
+    std::vector< VRAMRect > loadedRects;
+
+    for ( std::string const & path : paths ) {
+
+        VRAMRect rect = TIM::headerFromFile( path ).rect( );
+
+        bool isRequired = loadAll;
+        for ( VRAMRect const & required : requiredRects )
+            isRequired = isRequired || rect.intersects( required );
+
+        if ( ! isRequired ) {
+            LOG( Verbose, "Skipping " << path << " (not referenced by any texture)" );
+            continue ;
+        }
+
+        TIM tim = TIM::fromFile( path );
+
+        LOG( Info, "Loading " << path << " into VRAM ..." );
+        LOG( Verbose, "    Import takes place at X " << tim.left( ) << ", Y " << tim.top( ) << ", W " << tim.width( ) << " and H " << tim.height( ) << " (" << static_cast< int >( tim.bpp( ) ) << " bpp)" );
+
+        for ( std::size_t t = 0; t < loadedRects.size( ); ++ t ) {
+            if ( rect.intersects( loadedRects[ t ] ) ) {
+                VRAMRect overlap = rect.intersection( loadedRects[ t ] );
+                LOG( Warning, path << " overlaps " << loadedPaths[ t ] << " at X " << overlap.left << ", Y " << overlap.top << ", W " << overlap.width << " and H " << overlap.height );
+            }
+        }
+
+        tim.apply( vram );
 
-    boost::uint16_t texturesOffset;
-    parse( range, qi::word, texturesOffset );
+        loadedPaths.push_back( path );
+        loadedRects.push_back( rect );
 
-    parse( range, qi::word );
+    }
+
+    std::vector< bool > coverage( SIZE( VRAM ) );
+
+    for ( VRAMRect const & rect : loadedRects )
+        for ( boost::uint32_t y = rect.top; y < rect.top + rect.height && y < VRAM_HEIGHT; ++ y )
+            for ( boost::uint32_t x = rect.left; x < rect.left + rect.width && x < VRAM_WIDTH; ++ x )
+                coverage[ y * VRAM_WIDTH + x ] = true;
+
+    for ( VRAMRect const & rect : requiredRects ) {
+
+        unsigned long missing = 0;
 
-    boost::uint16_t verticesOffset;
-    parse( range, qi::word, verticesOffset );
+        for ( boost::uint32_t y = rect.top; y < rect.top + rect.height; ++ y )
+            for ( boost::uint32_t x = rect.left; x < rect.left + rect.width; ++ x )
+                missing += y >= VRAM_HEIGHT || x >= VRAM_WIDTH || ! coverage[ y * VRAM_WIDTH + x ];
 
-    parse( range, qi::word );
-    parse( range, qi::word );
-    parse( range, qi::word );
-    parse( range, qi::word );
+        if ( missing ) {
+            LOG( Warning, "area at X " << rect.left << ", Y " << rect.top << ", W " << rect.width << " and H " << rect.height << " is not covered by any TIM (" << missing << " unit(s) missing)" );
+        }
+
+    }
+}
 
-    std::cout << "Object count  : " << objectCount << std::endl;
-    std::cout << "Texture count : " << textureCount << std::endl;
-    std::cout << std::endl;
+// The textures and the objects don't depend on each other : they are all
+// submitted to the thread pool at once, and the scene is complete as soon
+// as the slowest of them is done.
+
+void parseBattleScene( VRAM const & vram, BattleScene const & scene, Path outputPath, ThreadPool & pool )
+{
+    LOG( Info, "Object count  : " << scene.objectCount( ) );
+    LOG( Info, "Texture count : " << scene.textureCount( ) );
 
-    std::ostringstream material;
     std::ostringstream geometry;
 
-    std::cout << "Parsing textures :" << std::endl;
+    // The inputs of each output, for --manifest and --incremental. The TIM
+    // set is accounted for by the VRAM content it produced.
+
+    boost::uint64_t sceneHash = 0, vramHash = 0;
+
+    if ( g_manifest ) {
+        sceneHash = Hash::compute( scene.range( ) );
+        vramHash = Hash( ).update( reinterpret_cast< boost::uint8_t const * >( & vram ), sizeof( VRAM ) ).digest( );
+    }
+
+    std::vector< unsigned long > sizes( scene.textureCount( ), BATTLESCENE_TEXTURE_WIDTH * BATTLESCENE_TEXTURE_HEIGHT * 4 );
+    sizes.push_back( scene.range( ).size( ) );
+
+    std::vector< bool > selected( sizes.size( ) );
+    for ( unsigned long itemIndex : g_shard.select( sizes ) )
+        selected[ itemIndex ] = true;
+
+    LOG( Verbose, "Parsing textures :" );
 
-    for ( boost::uint16_t textureIndex = 0; textureIndex < textureCount; ++ textureIndex ) {
+    std::vector< std::future< void > > textureTasks;
 
-        std::ostringstream pathBuilder, fakePathBuilder;
-        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << textureIndex << ".tga";
-        fakePathBuilder << std::setfill( '0' ) << std::setw( 3 ) << textureIndex << g_fakeTexturesExtension;
+    for ( boost::uint16_t textureIndex = 0; textureIndex < scene.textureCount( ); ++ textureIndex ) {
 
-        Path subOutputPath( outputPath ), subFakeOutputPath( outputPath );
+        if ( ! selected[ textureIndex ] )
+            continue ;
+
+        std::ostringstream pathBuilder;
+        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << textureIndex << "." << g_texturesFormat;
+
+        Path subOutputPath( outputPath );
         subOutputPath.push( pathBuilder.str( ) );
-        subFakeOutputPath.push( fakePathBuilder.str( ) );
 
-        std::cout << std::endl;
-        std::cout << " - Processing texture #" << textureIndex << std::endl;
+        LOG( Verbose, " - Processing texture #" << textureIndex );
 
-        MemoryRange subTexturesRange( range );
-        subTexturesRange.seek( MemoryRange::SeekSet, texturesOffset );
-        subTexturesRange.seek( MemoryRange::SeekCur, textureIndex * 4 );
+        boost::uint64_t textureInputs = g_manifest ? Hash( ).update( std::string( TOOL_VERSION ) ).update( g_texturesFormat ).update( scene.texturePacket( textureIndex ) ).update( vramHash ).digest( ) : 0;
 
-        parseTexture( vram, subTexturesRange, subOutputPath, textureIndex );
+        textureTasks.push_back( pool.submit( [ &vram, &scene, subOutputPath, textureIndex, textureInputs, &pool ] ( ) {
+            parseTexture( vram, scene, subOutputPath, textureIndex, textureInputs, pool );
+        } ) );
 
-        material << "newmtl tex" << static_cast< int >( textureIndex ) << std::endl;
-        material << "Ka 1 1 1" << std::endl;
-        material << "Kd 1 1 1" << std::endl;
-        material << "Ks 0 0 0" << std::endl;
-        material << "d 1" << std::endl;
-        material << "illum 0" << std::endl;
-        material << "map_Kd " << subFakeOutputPath.filename( ) << std::endl;
+    }
 
+    if ( ! selected.back( ) ) {
+        for ( std::future< void > & task : textureTasks )
+            task.get( );
+        return ;
     }
 
-    std::cout << std::endl;
+    LOG( Verbose, "Parsing geometry :" );
 
-    std::cout << "Parsing geometry :" << std::endl;
+    Path geometryPath( outputPath );
+    geometryPath.push( "geometry." + g_geometryFormat );
 
-    geometry << "mtllib materials.mtl" << std::endl;
+    boost::uint64_t geometryInputs = 0;
 
-    MemoryRange verticesRange( range );
-    verticesRange.seek( MemoryRange::SeekSet, verticesOffset );
+    if ( g_manifest ) {
+        Hash inputs;
+        inputs.update( std::string( TOOL_VERSION ) ).update( sceneHash );
+        if ( g_lodCount )
+            inputs.update( static_cast< boost::uint64_t >( g_lodCount ) );
+        geometryInputs = inputs.digest( );
+    }
 
-    for ( boost::uint16_t objectIndex = 0, verticesStart = 0, uvStart = 0; objectIndex < objectCount; ++ objectIndex ) {
+    // The geometry is not even serialized when the previous run already
+    // did it from the same scene
 
-        boost::uint16_t timp;
-        parse( range, qi::word, timp );
+    bool keepGeometry = g_incremental && g_manifest->keep( geometryPath.string( ), geometryInputs );
 
-        boost::uint16_t verticeCount;
-        parse( range, qi::word, verticeCount );
+    Path bvhPath( outputPath );
+    bvhPath.push( "geometry.ff9bvh" );
 
-        parse( range, qi::word );
+    boost::uint64_t bvhInputs = g_manifest ? Hash( ).update( std::string( TOOL_VERSION ) ).update( std::string( "bvh" ) ).update( sceneHash ).digest( ) : 0;
 
-        boost::uint16_t texidxOffset, facesOffset, texmapOffset;
-        parse( range, qi::word, texidxOffset );
-        parse( range, qi::word, facesOffset );
-        parse( range, qi::word, texmapOffset );
+    bool keepBvh = ! g_bvh || ( g_incremental && g_manifest->keep( bvhPath.string( ), bvhInputs ) );
 
-        boost::uint16_t rectangleCount, triangleCount;
-        parse( range, qi::word, rectangleCount );
-        parse( range, qi::word, triangleCount );
+    // The objects are decoded when something else than the OBJ file needs
+    // them ; the OBJ file alone is serialized straight from the scene
 
-        boost::uint32_t totalVerticeCount = rectangleCount * 4 + triangleCount * 3;
+    bool needsObjects = ! keepGeometry || ! keepBvh;
+    bool decodeObjects = g_geometryFormat != "obj" || g_lodCount || ! keepBvh;
 
-        std::cout << std::endl;
-        std::cout << " - Processing object #" << static_cast< int >( objectIndex ) << std::endl;
-        std::cout << "   Vertice count   : " << static_cast< int >( verticeCount ) << std::endl;
-        std::cout << "   Rectangle count : " << static_cast< int >( rectangleCount ) << std::endl;
-        std::cout << "   Triangle count  : " << static_cast< int >( triangleCount ) << std::endl;
+    std::vector< std::future< std::string > > objectTasks;
+    std::vector< std::future< std::vector< BattleScene::Object > > > levelTasks;
 
-        for ( boost::uint16_t verticeIndex = 0; verticeIndex < verticeCount; ++ verticeIndex ) {
+    std::future< void > thumbnailTask;
 
-            boost::int16_t x, y, z;
-            parse( verticesRange, qi::word, x );
-            parse( verticesRange, qi::word, y );
-            parse( verticesRange, qi::word, z );
+    if ( g_thumbnailSize ) {
 
-            double dx = + static_cast< double >( x ) / 100.0;
-            double dy = - static_cast< double >( y ) / 100.0;
-            double dz = + static_cast< double >( z ) / 100.0;
+        Path thumbnailPath( outputPath );
+        thumbnailPath.push( "thumbnail.tga" );
 
-            geometry << "v " << std::fixed << dx << " " << std::fixed << dy << " " << std::fixed << dz << std::endl;
+        boost::uint64_t thumbnailInputs = g_manifest ? Hash( ).update( std::string( TOOL_VERSION ) ).update( static_cast< boost::uint64_t >( g_thumbnailSize ) ).update( sceneHash ).update( vramHash ).digest( ) : 0;
 
-        }
+        thumbnailTask = pool.submit( [ &vram, &scene, thumbnailPath, thumbnailInputs, &pool ] ( ) {
+            renderThumbnail( vram, scene, thumbnailPath, thumbnailInputs, pool );
+        } );
 
-        MemoryRange texmapRange( range );
-        texmapRange.seek( MemoryRange::SeekCur, - 16 );
-        texmapRange.seek( MemoryRange::SeekCur, texmapOffset );
+    }
 
-        for ( boost::uint32_t verticeIndex = 0; verticeIndex < totalVerticeCount; ++ verticeIndex ) {
+    for ( unsigned long objectIndex = 0; objectIndex < scene.objectCount( ) && needsObjects; ++ objectIndex ) {
+        if ( ! decodeObjects ) {
+            objectTasks.push_back( pool.submit( [ &scene, objectIndex ] ( ) {
+                return scene.serializeObject( objectIndex );
+            } ) );
+        } else {
+            levelTasks.push_back( pool.submit( [ &scene, objectIndex ] ( ) {
+                std::vector< BattleScene::Object > levels = buildLevels( scene.decodeObject( objectIndex ), g_lodCount );
+                std::ostringstream counts;
+                for ( BattleScene::Object const & level : levels )
+                    counts << " " << level.faces.size( );
+                LOG( Verbose, " - Object #" << objectIndex << " triangles :" << counts.str( ) );
+                return levels;
+            } ) );
+        }
+    }
 
-            boost::uint8_t tx, ty;
-            parse( texmapRange, qi::byte_, tx );
-            parse( texmapRange, qi::byte_, ty );
+    // The levels of each object, the first one being the object itself
 
-            double dtx = 0.0 + static_cast< double >( tx ) / 255.0;
-            double dty = 1.0 - static_cast< double >( ty ) / 255.0;
+    std::vector< std::vector< BattleScene::Object > > objectLevels;
 
-            geometry << "vt" << " " << std::fixed << dtx << " " << std::fixed << dty << std::endl;
+    for ( std::future< std::vector< BattleScene::Object > > & task : levelTasks )
+        objectLevels.push_back( task.get( ) );
 
-        }
+    if ( g_geometryFormat == "obj" ) {
 
-        MemoryRange facesRange( range );
-        facesRange.seek( MemoryRange::SeekCur, - 16 );
-        facesRange.seek( MemoryRange::SeekCur, facesOffset );
+        geometry << scene.geometryHeader( );
 
-        MemoryRange texidxRange( range );
-        texidxRange.seek( MemoryRange::SeekCur, - 16 );
-        texidxRange.seek( MemoryRange::SeekCur, texidxOffset );
+        for ( std::future< std::string > & task : objectTasks )
+            geometry << task.get( );
 
-        boost::int16_t previousTexidx = - 1;
+        // Each level is a group of its own, in which the objects follow
+        // each other as in the full one
 
-        for ( boost::uint16_t rectangleIndex = 0; rectangleIndex < rectangleCount; ++ rectangleIndex ) {
+        unsigned long verticesStart = 0, uvStart = 0;
 
-            boost::uint32_t texidx;
-            parse( texidxRange, qi::dword, texidx );
-            texidx = ( texidx >> 24 ) & 0x1f;
+        for ( unsigned int level = 0; level <= g_lodCount && ! objectLevels.empty( ); ++ level ) {
 
-            boost::uint16_t v1, v2, v3, v4;
-            parse( facesRange, qi::word, v1 ); v1 /= 4;
-            parse( facesRange, qi::word, v2 ); v2 /= 4;
-            parse( facesRange, qi::word, v3 ); v3 /= 4;
-            parse( facesRange, qi::word, v4 ); v4 /= 4;
+            if ( g_lodCount )
+                geometry << "g lod" << level << std::endl;
 
-            if ( texidx != previousTexidx ) {
-                geometry << "usemtl tex" << texidx << std::endl;
-                previousTexidx = texidx;
+            for ( std::vector< BattleScene::Object > const & levels : objectLevels ) {
+                geometry << BattleScene::serializeObject( levels[ level ], verticesStart, uvStart );
+                verticesStart += levels[ level ].vertices.size( );
+                uvStart += levels[ level ].texCoords.size( );
             }
 
-            geometry << "f " << ( verticesStart + v1 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 1 )
-                     << " "  << ( verticesStart + v2 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 2 )
-                     << " "  << ( verticesStart + v3 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 3 )
-            << std::endl;
+        }
 
-            geometry << "f " << ( verticesStart + v4 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 4 )
-                     << " "  << ( verticesStart + v3 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 3 )
-                     << " "  << ( verticesStart + v2 + 1 ) << "/" << ( uvStart + rectangleIndex * 4 + 2 )
-            << std::endl;
+    } else if ( ! keepGeometry ) {
 
-        }
+        // Same scale as the OBJ positions (see BattleScene::serializeObject)
 
-        for ( boost::uint16_t triangleIndex = 0; triangleIndex < triangleCount; ++ triangleIndex ) {
+        Mesh mesh = { { 0.01f, - 0.01f, 0.01f }, g_lodCount + 1, std::vector< BattleScene::Object >( ) };
 
-            boost::uint32_t texidx;
-            parse( texidxRange, qi::dword, texidx );
-            texidx = ( texidx >> 24 ) & 0x1f;
+        for ( unsigned int level = 0; level <= g_lodCount; ++ level )
+            for ( std::vector< BattleScene::Object > const & levels : objectLevels )
+                mesh.objects.push_back( levels[ level ] );
 
-            boost::uint16_t v1, v2, v3;
-            parse( facesRange, qi::word, v1 ); v1 /= 4;
-            parse( facesRange, qi::word, v2 ); v2 /= 4;
-            parse( facesRange, qi::word, v3 ); v3 /= 4;
+        std::vector< boost::uint8_t > encoded = encodeMesh( mesh );
+        geometry.write( reinterpret_cast< char const * >( encoded.data( ) ), encoded.size( ) );
 
-            if ( texidx != previousTexidx ) {
-                geometry << "usemtl tex" << texidx << std::endl;
-                previousTexidx = texidx;
-            }
+    }
 
-            geometry << "f " << ( verticesStart + v1 + 1 ) << "/" << ( uvStart + rectangleCount * 4 + triangleIndex * 3 + 1 )
-                     << " "  << ( verticesStart + v2 + 1 ) << "/" << ( uvStart + rectangleCount * 4 + triangleIndex * 3 + 2 )
-                     << " "  << ( verticesStart + v3 + 1 ) << "/" << ( uvStart + rectangleCount * 4 + triangleIndex * 3 + 3 )
-            << std::endl;
+    if ( ! keepBvh ) {
 
-        }
+        std::vector< BattleScene::Object > objects;
 
-        verticesStart += verticeCount;
-        uvStart += totalVerticeCount;
+        for ( std::vector< BattleScene::Object > const & levels : objectLevels )
+            objects.push_back( levels[ 0 ] );
 
+        std::vector< boost::uint8_t > encoded = encodeBVHs( buildSceneBVHs( objects, pool ) );
+        dumpTracked( bvhPath, std::string( encoded.begin( ), encoded.end( ) ), bvhInputs );
+
+    } else if ( g_bvh ) {
+        STATS_COUNT( "unchanged", 1 );
     }
 
-    Path materialPath( outputPath );
-    materialPath.push( "materials.mtl" );
-    materialPath.dump( material.str( ) );
+    for ( std::future< void > & task : textureTasks )
+        task.get( );
 
-    Path geometryPath( outputPath );
-    geometryPath.push( "geometry.obj" );
-    geometryPath.dump( geometry.str( ) );
+    if ( thumbnailTask.valid( ) )
+        thumbnailTask.get( );
+
+    if ( g_geometryFormat == "obj" ) {
+        Path materialPath( outputPath );
+        materialPath.push( "materials.mtl" );
+        dumpTracked( materialPath, scene.material( g_fakeTexturesExtension ), g_manifest ? Hash( ).update( std::string( TOOL_VERSION ) ).update( g_texturesFormat ).update( g_fakeTexturesExtension ).update( sceneHash ).digest( ) : 0 );
+    }
+
+    if ( ! keepGeometry ) {
+        dumpTracked( geometryPath, geometry.str( ), geometryInputs );
+    } else {
+        STATS_COUNT( "unchanged", 1 );
+    }
 }
 
 int main( int argc, char ** argv )
 {
-    std::cout.precision( 9 );
-
     po::options_description options( "Allowed options" );
     options.add_options( )( "tim", po::value< std::vector< std::string > >( )->default_value( std::vector< std::string >( ), "" ), "Image clusters (TIM files)" );
+    options.add_options( )( "all-tims", "Load every TIM file, even those not referenced by the scene textures" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
     options.add_options( )( "input", po::value< std::string >( )->required( ) );
     options.add_options( )( "output", po::value< std::string >( )->required( ) );
-    options.add_options( )( "fake-textures-extension", po::value< std::string >( )->default_value( ".tga" ) );
+    options.add_options( )( "textures-format", po::value< std::string >( )->default_value( "tga" ), "Exported textures format (tga or dds)" );
+    options.add_options( )( "geometry-format", po::value< std::string >( )->default_value( "obj" ), "Exported geometry format (obj or ff9mesh)" );
+    options.add_options( )( "lods", po::value< unsigned int >( )->default_value( 0 ), "Number of simplified levels of detail to write after the full geometry, each one having half the triangles of the previous one" );
+    options.add_options( )( "bvh", "Also write bounding volume hierarchies of the geometry, for each object and for the whole scene, into geometry.ff9bvh" );
+    options.add_options( )( "fake-textures-extension", po::value< std::string >( )->default_value( "", "same as --textures-format" ) );
+    options.add_options( )( "manifest", po::value< std::string >( ), "Write the list of the converted files, with their inputs hash, to this file" );
+    options.add_options( )( "incremental", "Leave untouched the files whose inputs did not change since the run which wrote the manifest (requires --manifest)" );
+    options.add_options( )( "bundle", po::value< std::string >( ), "Write the converted files into a single archive next to the destination, instead of separate files (zip, tar or ff9pack)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count" );
+    options.add_options( )( "thumbnail", po::value< unsigned int >( )->implicit_value( 128 ), "Also render a preview of the scene into thumbnail.tga (--thumbnail=<size>, 128 pixels by default)" );
+    options.add_options( )( "shard", po::value< std::string >( ), "Only convert this part of the textures and geometry (<index>/<count>, balanced by size)" );
+    options.add_options( )( "merge", po::value< std::vector< std::string > >( ), "Merge the manifests written by the shards into --manifest, checking that every file has been converted" );
 
     po::positional_options_description positional;
     positional.add( "input", 1 );
@@ -337,30 +485,130 @@ int main( int argc, char ** argv )
     po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
     po::notify( vm );
 
-    g_fakeTexturesExtension = vm[ "fake-textures-extension" ].as< std::string >( );
+    Log::start( vm );
 
-    if ( vm.count( "input" ) && vm.count( "output" ) ) {
+    Stats::start( );
 
-        VRAM vram = { };
+    g_texturesFormat = vm[ "textures-format" ].as< std::string >( );
+    if ( g_texturesFormat != "tga" && g_texturesFormat != "dds" )
+        throw std::runtime_error( "Unsupported textures format." );
 
-        auto textures = vm[ "tim" ].as< std::vector< std::string > >( );
-        for ( std::string const & path : textures ) {
-            TIM tim = TIM::fromFile( path );
+    g_geometryFormat = vm[ "geometry-format" ].as< std::string >( );
+    if ( g_geometryFormat != "obj" && g_geometryFormat != "ff9mesh" )
+        throw std::runtime_error( "Unsupported geometry format." );
 
-            std::cout << "Loading " << path << " into VRAM ..." << std::endl;
-            std::cout << "    Import takes place at X " << tim.left( ) << ", Y " << tim.top( ) << ", W " << tim.width( ) << " and H " << tim.height( ) << " (" << static_cast< int >( tim.bpp( ) ) << " bpp)" << std::endl;
-            std::cout << std::endl;
+    g_lodCount = vm[ "lods" ].as< unsigned int >( );
+    if ( g_lodCount > 16 )
+        throw std::runtime_error( "--lods cannot be more than 16." );
 
-            tim.apply( vram );
-        }
+    g_bvh = vm.count( "bvh" );
+
+    g_fakeTexturesExtension = vm[ "fake-textures-extension" ].as< std::string >( );
+    if ( g_fakeTexturesExtension.empty( ) )
+        g_fakeTexturesExtension = "." + g_texturesFormat;
+
+    if ( vm.count( "thumbnail" ) ) {
+        g_thumbnailSize = vm[ "thumbnail" ].as< unsigned int >( );
+        if ( g_thumbnailSize < 16 || g_thumbnailSize > 1024 )
+            throw std::runtime_error( "The thumbnail size has to be between 16 and 1024 pixels." );
+    }
+
+    if ( vm.count( "input" ) && vm.count( "output" ) ) {
 
         Path input( vm[ "input" ].as< std::string >( ) );
         Path output( vm[ "output" ].as< std::string >( ) );
 
+        g_incremental = vm.count( "incremental" );
+
+        if ( g_incremental && ! vm.count( "manifest" ) )
+            throw std::runtime_error( "--incremental requires --manifest." );
+
+        if ( vm.count( "manifest" ) )
+            g_manifest.reset( new Manifest( output.string( ) ) );
+
+        if ( g_incremental )
+            g_manifest->read( vm[ "manifest" ].as< std::string >( ) );
+
+        if ( vm.count( "shard" ) )
+            g_shard = Shard( vm[ "shard" ].as< std::string >( ) );
+
         auto content = input.read( );
         MemoryRange range( content );
+        BattleScene scene( range );
+
+        // Nothing is converted when merging : the scene only tells which
+        // files the shards should have recorded
+
+        if ( vm.count( "merge" ) ) {
+
+            if ( ! g_manifest )
+                throw std::runtime_error( "--merge requires --manifest." );
+
+            if ( vm.count( "shard" ) || g_incremental || vm.count( "bundle" ) )
+                throw std::runtime_error( "--merge cannot be used with --shard, --incremental or --bundle." );
+
+            std::vector< std::string > outputPaths;
+
+            for ( boost::uint16_t textureIndex = 0; textureIndex < scene.textureCount( ); ++ textureIndex ) {
+                std::ostringstream pathBuilder;
+                pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << textureIndex << "." << g_texturesFormat;
+                outputPaths.push_back( pathBuilder.str( ) );
+            }
+
+            outputPaths.push_back( "geometry." + g_geometryFormat );
+
+            if ( g_geometryFormat == "obj" )
+                outputPaths.push_back( "materials.mtl" );
+
+            if ( g_bvh )
+                outputPaths.push_back( "geometry.ff9bvh" );
+
+            if ( g_thumbnailSize )
+                outputPaths.push_back( "thumbnail.tga" );
+
+            Manifest merged( output.string( ) );
+            Shard::merge( vm[ "merge" ].as< std::vector< std::string > >( ), outputPaths, merged );
+            merged.write( vm[ "manifest" ].as< std::string >( ) );
+
+            if ( vm.count( "stats" ) )
+                Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-convert-bs" );
+
+            return 0;
+
+        }
+
+        std::unique_ptr< Bundle > bundle;
+
+        if ( vm.count( "bundle" ) ) {
+            if ( g_manifest )
+                throw std::runtime_error( "--bundle cannot be used with --manifest or --incremental." );
+            std::string format = vm[ "bundle" ].as< std::string >( );
+            bundle.reset( new Bundle( Bundle::format( format ), output.string( ) + "." + format, output.string( ) ) );
+            Path::bundle( bundle.get( ) );
+        }
+
+        VRAM vram = { };
+
+        auto textures = vm[ "tim" ].as< std::vector< std::string > >( );
+        loadTims( vram, textures, scene.textureRects( ), vm.count( "all-tims" ) );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        parseBattleScene( vram, scene, output, pool );
+
+        // Only the converted files go into the archive : the manifest and
+        // the stats are written next to it
+
+        if ( bundle ) {
+            bundle->close( );
+            Path::bundle( nullptr );
+        }
+
+        if ( g_manifest )
+            g_manifest->write( vm[ "manifest" ].as< std::string >( ) );
 
-        parseBattleScene( vram, range, output );
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-convert-bs" );
 
         return 0;
 
@@ -0,0 +1,517 @@
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "battlescene.hpp"
+#include "constants.hpp"
+#include "db.hpp"
+#include "image.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "parse.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "tim.hpp"
+#include "vram.hpp"
+#include "windowedfile.hpp"
+
+namespace po = boost::program_options;
+namespace qi = boost::spirit::qi;
+
+#define REQUEST_EXTRACT_ENTRY  0x01
+#define REQUEST_CONVERT_SCENE  0x02
+#define REQUEST_DECODE_TEXTURE 0x03
+
+#define STATUS_OK    0x00
+#define STATUS_ERROR 0x01
+
+// Requests larger than this are rejected, rather than allocated.
+
+#define MAX_REQUEST_LENGTH ( 1024 * 1024 )
+
+// The image, fully loaded once : every range handed to the requests comes
+// from its single window, so the workers only ever read it.
+//
+
+std::unique_ptr< WindowedFile > g_file;
+std::unique_ptr< Image > g_image;
+
+std::map< std::string, Image::Entry const * > g_entries;
+
+// The VRAM states composed for the previous requests, most recently used
+// first, keyed by their TIM list.
+//
+
+struct ComposedVRAM {
+    VRAM vram;
+};
+
+std::list< std::pair< std::string, std::shared_ptr< ComposedVRAM const > > > g_vramCache;
+std::mutex g_vramCacheMutex;
+unsigned long g_vramCacheSize;
+
+// The connected clients, each read by its own thread ; the requests
+// themselves are served by the worker pool.
+//
+
+std::set< int > g_clients;
+std::mutex g_clientsMutex;
+std::condition_variable g_clientsCondition;
+
+volatile std::sig_atomic_t g_stopping = 0;
+
+void stop( int )
+{
+    g_stopping = 1;
+}
+
+// Resolves "<container>/<entry>[/<pack>/<object>...]" into the bytes it
+// designates : an image entry, or an object of the DBs nested into it. The
+// extensions (as written by the extraction tools) are optional.
+
+static std::string stem( std::string const & name )
+{
+    return name.substr( 0, name.find( '.' ) );
+}
+
+MemoryRange resolve( std::string const & path )
+{
+    std::vector< std::string > parts;
+
+    for ( std::string::size_type begin = 0, end; begin <= path.size( ); begin = end + 1 ) {
+        end = std::min( path.find( '/', begin ), path.size( ) );
+        parts.push_back( path.substr( begin, end - begin ) );
+    }
+
+    if ( parts.size( ) % 2 )
+        throw std::runtime_error( "Invalid path : " + path );
+
+    std::map< std::string, Image::Entry const * >::const_iterator it = g_entries.find( parts[ 0 ] + "/" + stem( parts[ 1 ] ) );
+
+    if ( it == g_entries.end( ) )
+        throw std::runtime_error( "No such entry : " + path );
+
+    MemoryRange range = g_image->map( * it->second );
+
+    for ( std::size_t t = 2; t < parts.size( ); t += 2 ) {
+
+        std::string objectPath = parts[ t ] + "/" + stem( parts[ t + 1 ] );
+        bool isFound = false;
+
+        for ( DB::Object const & object : DB( range ) ) {
+            if ( stem( object.path ) == objectPath ) {
+                range = object.range;
+                isFound = true;
+                break ;
+            }
+        }
+
+        if ( ! isFound )
+            throw std::runtime_error( "No such object : " + path );
+
+    }
+
+    return range;
+}
+
+// Returns the VRAM produced by the given TIM files, applied in order ; the
+// last states are kept, since the scenes of a same area share their TIMs.
+
+std::shared_ptr< ComposedVRAM const > composeVRAM( std::vector< std::string > const & timPaths )
+{
+    std::string key;
+
+    for ( std::string const & timPath : timPaths )
+        key += timPath + "\n";
+
+    {
+        std::unique_lock< std::mutex > lock( g_vramCacheMutex );
+
+        for ( auto it = g_vramCache.begin( ); it != g_vramCache.end( ); ++ it ) {
+            if ( it->first == key ) {
+                g_vramCache.splice( g_vramCache.begin( ), g_vramCache, it );
+                STATS_COUNT( "vram cache hits", 1 );
+                return g_vramCache.front( ).second;
+            }
+        }
+    }
+
+    std::shared_ptr< ComposedVRAM > composed = std::make_shared< ComposedVRAM >( );
+
+    for ( std::string const & timPath : timPaths )
+        TIM::fromRange( resolve( timPath ) ).apply( composed->vram );
+
+    STATS_COUNT( "vram compositions", 1 );
+
+    std::unique_lock< std::mutex > lock( g_vramCacheMutex );
+
+    if ( g_vramCacheSize ) {
+        g_vramCache.push_front( std::make_pair( key, composed ) );
+        if ( g_vramCache.size( ) > g_vramCacheSize ) {
+            g_vramCache.pop_back( );
+        }
+    }
+
+    return composed;
+}
+
+////////////
+// Every message starts with its length (4 bytes, not counting itself).
+// The integers are little-endian ; the strings are prefixed by their
+// length (2 bytes).
+//
+// Request :
+//
+// 1 byte  : request type
+//
+//  0x01 (extract entry)  : path
+//  0x02 (convert scene)  : scene path, textures extension (as written in
+//                          the MTL file)
+//  0x03 (decode texture) : scene path, texture index (2 bytes), TIM count
+//                          (1 byte), TIM paths
+//
+// Response :
+//
+// 1 byte  : status (0x00 = success, 0x01 = error)
+//
+//  error                 : message
+//  0x01 (extract entry)  : the entry bytes
+//  0x02 (convert scene)  : MTL file length (4 bytes), MTL file, OBJ file
+//  0x03 (decode texture) : width (2 bytes), height (2 bytes), ARGB pixels
+//                          (4 bytes each)
+
+static std::string parseString( MemoryRange & range )
+{
+    boost::uint16_t length;
+    parse( range, qi::little_word, length );
+
+    MemoryRange text( range );
+    text.crop( MemoryRange::SeekCur, 0, length );
+    range.seek( MemoryRange::SeekCur, length );
+
+    return std::string( text.begin( ), text.end( ) );
+}
+
+static std::vector< std::string > parseStrings( MemoryRange & range )
+{
+    boost::uint8_t count;
+    parse( range, qi::byte_, count );
+
+    std::vector< std::string > strings;
+
+    for ( boost::uint8_t t = 0; t < count; ++ t )
+        strings.push_back( parseString( range ) );
+
+    return strings;
+}
+
+static void storeLittle( std::string & output, boost::uint32_t value, int byteCount )
+{
+    for ( int t = 0; t < byteCount; ++ t ) {
+        output += static_cast< char >( ( value >> ( t * 8 ) ) & 0xff );
+    }
+}
+
+std::string serve( MemoryRange request )
+{
+    STATS_TIMER( timer, "serve" );
+
+    boost::uint8_t type;
+    parse( request, qi::byte_, type );
+
+    std::string response( 1, STATUS_OK );
+
+    switch ( type ) {
+
+        case REQUEST_EXTRACT_ENTRY: {
+
+            std::string path = parseString( request );
+            LOG( Verbose, "Extracting " << path );
+
+            MemoryRange range = resolve( path );
+            response.append( range.begin( ), range.end( ) );
+
+        } break;
+
+        case REQUEST_CONVERT_SCENE: {
+
+            std::string path = parseString( request );
+            std::string texturesExtension = parseString( request );
+            LOG( Verbose, "Converting " << path );
+
+            BattleScene scene( resolve( path ) );
+
+            std::string material = scene.material( texturesExtension );
+            storeLittle( response, material.size( ), 4 );
+            response += material;
+            response += scene.geometry( );
+
+        } break;
+
+        case REQUEST_DECODE_TEXTURE: {
+
+            std::string path = parseString( request );
+            boost::uint16_t textureIndex;
+            parse( request, qi::little_word, textureIndex );
+            std::vector< std::string > timPaths = parseStrings( request );
+            LOG( Verbose, "Decoding " << path << " texture #" << textureIndex );
+
+            BattleScene scene( resolve( path ) );
+
+            if ( textureIndex >= scene.textureCount( ) )
+                throw std::runtime_error( "No such texture." );
+
+            std::shared_ptr< ComposedVRAM const > composed = composeVRAM( timPaths );
+            std::vector< boost::uint32_t > pixels = scene.decodeTexture( composed->vram, textureIndex );
+
+            storeLittle( response, BATTLESCENE_TEXTURE_WIDTH, 2 );
+            storeLittle( response, BATTLESCENE_TEXTURE_HEIGHT, 2 );
+            for ( boost::uint32_t pixel : pixels )
+                storeLittle( response, pixel, 4 );
+
+        } break;
+
+        default:
+            throw std::runtime_error( "Unknown request type." );
+
+    }
+
+    STATS_BYTES( timer, response.size( ) );
+    STATS_COUNT( "requests", 1 );
+
+    return response;
+}
+
+static bool readAll( int fd, boost::uint8_t * data, unsigned long size )
+{
+    while ( size ) {
+
+        ssize_t count = read( fd, data, size );
+
+        if ( count < 0 && errno == EINTR )
+            continue ;
+
+        if ( count <= 0 )
+            return false;
+
+        data += count;
+        size -= count;
+
+    }
+
+    return true;
+}
+
+static bool writeAll( int fd, char const * data, unsigned long size )
+{
+    while ( size ) {
+
+        ssize_t count = send( fd, data, size, MSG_NOSIGNAL );
+
+        if ( count < 0 && errno == EINTR )
+            continue ;
+
+        if ( count <= 0 )
+            return false;
+
+        data += count;
+        size -= count;
+
+    }
+
+    return true;
+}
+
+// Reads the requests of a client until it disconnects, and has them served
+// by the pool one after the other. A request which fails only fails its own
+// response.
+
+void serveClient( int fd, ThreadPool & pool )
+{
+    for ( ; ; ) {
+
+        boost::uint8_t header[ 4 ];
+        if ( ! readAll( fd, header, sizeof( header ) ) )
+            break ;
+
+        unsigned long length = header[ 0 ] | header[ 1 ] << 8 | header[ 2 ] << 16 | static_cast< unsigned long >( header[ 3 ] ) << 24;
+
+        if ( length > MAX_REQUEST_LENGTH ) {
+            LOG( Warning, "Request too large (" << length << " bytes), closing the connection" );
+            break ;
+        }
+
+        std::vector< boost::uint8_t > request( length );
+        if ( ! readAll( fd, request.data( ), length ) )
+            break ;
+
+        std::string response;
+
+        try {
+            response = pool.submit( [ &request ] ( ) {
+                return serve( MemoryRange( request ) );
+            } ).get( );
+        } catch ( std::exception const & error ) {
+            LOG( Warning, "Request failed : " << error.what( ) );
+            response = std::string( 1, STATUS_ERROR ) + error.what( );
+            STATS_COUNT( "failed requests", 1 );
+        }
+
+        std::string framed;
+        storeLittle( framed, response.size( ), 4 );
+
+        if ( ! writeAll( fd, framed.data( ), framed.size( ) ) || ! writeAll( fd, response.data( ), response.size( ) ) )
+            break ;
+
+    }
+
+    std::unique_lock< std::mutex > lock( g_clientsMutex );
+
+    g_clients.erase( fd );
+    close( fd );
+
+    g_clientsCondition.notify_all( );
+}
+
+int main( int argc, char ** argv )
+{
+    po::options_description options( "Allowed options" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file, on exit" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count (requests served concurrently)" );
+    options.add_options( )( "vram-cache", po::value< unsigned long >( )->default_value( 16 ), "Number of composed VRAM states kept between requests (1MB each)" );
+    options.add_options( )( "input", po::value< std::string >( )->required( ) );
+    options.add_options( )( "socket", po::value< std::string >( )->required( ) );
+
+    po::positional_options_description positional;
+    positional.add( "input", 1 );
+    positional.add( "socket", 1 );
+
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
+    po::notify( vm );
+
+    Log::start( vm );
+
+    Stats::start( );
+
+    if ( vm.count( "input" ) && vm.count( "socket" ) ) {
+
+        std::string socketPath = vm[ "socket" ].as< std::string >( );
+        g_vramCacheSize = vm[ "vram-cache" ].as< unsigned long >( );
+
+        // The whole image fits in the window of the file : once it has
+        // been read, mapping an entry does not touch the file anymore
+
+        g_file.reset( new WindowedFile( vm[ "input" ].as< std::string >( ) ) );
+
+        if ( g_file->isSequential( ) )
+            throw std::runtime_error( "The daemon needs a regular file as input." );
+
+        g_file->map( 0, g_file->size( ) );
+        g_image.reset( new Image( * g_file ) );
+
+        for ( Image::Entry const & entry : g_image->entries( ) )
+            g_entries[ entry.path ] = & entry;
+
+        LOG( Info, "Loaded " << g_entries.size( ) << " entries" );
+
+        int server = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+        sockaddr_un address = { };
+        address.sun_family = AF_UNIX;
+
+        if ( socketPath.size( ) >= sizeof( address.sun_path ) )
+            throw std::runtime_error( "Socket path too long." );
+
+        std::strcpy( address.sun_path, socketPath.c_str( ) );
+        unlink( socketPath.c_str( ) );
+
+        if ( server < 0 || bind( server, reinterpret_cast< sockaddr * >( & address ), sizeof( address ) ) < 0 || listen( server, SOMAXCONN ) < 0 )
+            throw std::runtime_error( "Cannot listen on " + socketPath + " (" + std::strerror( errno ) + ")" );
+
+        // SIGINT and SIGTERM interrupt accept( ), so that the daemon can
+        // clean up behind itself
+
+        struct sigaction action = { };
+        action.sa_handler = stop;
+        sigaction( SIGINT, & action, nullptr );
+        sigaction( SIGTERM, & action, nullptr );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        LOG( Info, "Listening on " << socketPath << " (" << pool.size( ) << " workers)" );
+
+        while ( ! g_stopping ) {
+
+            int client = accept( server, nullptr, nullptr );
+
+            if ( client < 0 ) {
+                if ( errno != EINTR )
+                    LOG( Warning, "accept failed (" << std::strerror( errno ) << ")" );
+                continue ;
+            }
+
+            std::unique_lock< std::mutex > lock( g_clientsMutex );
+            g_clients.insert( client );
+
+            std::thread( serveClient, client, std::ref( pool ) ).detach( );
+
+        }
+
+        LOG( Info, "Stopping" );
+
+        // The clients are disconnected once their current request is
+        // answered
+
+        {
+            std::unique_lock< std::mutex > lock( g_clientsMutex );
+
+            for ( int client : g_clients )
+                shutdown( client, SHUT_RD );
+
+            g_clientsCondition.wait( lock, [ ] ( ) { return g_clients.empty( ); } );
+        }
+
+        close( server );
+        unlink( socketPath.c_str( ) );
+
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-daemon" );
+
+        return 0;
+
+    } else {
+
+        std::cerr << "Usage: " << argv[ 0 ] << " [options] <FF9.IMG path> <socket path>" << std::endl;
+        std::cerr << options;
+
+        return -1;
+
+    }
+}
@@ -1,170 +1,312 @@
+#include <boost/filesystem/operations.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/positional_options.hpp>
 #include <boost/program_options/variables_map.hpp>
-#include <boost/spirit/include/qi.hpp>
 
+#include <algorithm>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
-
+#include <string>
+#include <vector>
+
+#include "bundle.hpp"
+#include "db.hpp"
+#include "dedup.hpp"
+#include "filetypes.hpp"
+#include "hash.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
 #include "memoryrange.hpp"
-#include "parse.hpp"
+#include "packedfile.hpp"
 #include "path.hpp"
+#include "scan.hpp"
+#include "shard.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
 
 namespace po = boost::program_options;
-namespace qi = boost::spirit::qi;
 
-////////////
-// 1 byte  : data type
-// 1 byte  : object count
-// 2 bytes : padding (0x0000)
+// Part of the inputs of every extracted file : bump it whenever a change
+// alters the output, so that --incremental does not keep the files written
+// by the previous versions.
+//
+
+#define TOOL_VERSION "ffix-extract-db 1"
+
+// An object of a pack : a byte range of the DB, and where to write it.
+// Every object is located first, and they are all written afterward.
 
-void parsePack( MemoryRange range, Path outputPath )
+struct Object {
+    Path path;
+    MemoryRange range;
+};
+
+int main( int argc, char ** argv )
 {
-    boost::uint32_t dataType;
-    boost::uint32_t objectCount;
-
-    parse( range, qi::byte_, dataType );
-    parse( range, qi::byte_, objectCount );
-    parse( range, qi::word );
-
-    std::string extension;
-
-    switch ( dataType ) {
-        case 0x02 : extension = ".ff9md"; break ;
-        case 0x04 : extension = ".tim";   break ;
-        case 0x0C : extension = ".ff9bs"; break ;
-        case 0x1B : extension = ".ff9db"; break ;
-
-        default :
-            std::ostringstream extensionBuilder;
-            extensionBuilder << ".raw" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << dataType;
-            extension = extensionBuilder.str( );
-        break ;
-    }
+    po::options_description options( "Allowed options" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count" );
+    options.add_options( )( "dedup", po::value< std::string >( ), "Turn the copies of identical objects into links to the first one (hardlink or reflink)" );
+    options.add_options( )( "manifest", po::value< std::string >( ), "Write the list of the extracted files, with their content hash, to this file" );
+    options.add_options( )( "verify", po::value< std::string >( ), "Compare the objects with this manifest (as written by --manifest) and report the differences, without writing any file" );
+    options.add_options( )( "incremental", "Leave untouched the files whose inputs did not change since the run which wrote the manifest (requires --manifest)" );
+    options.add_options( )( "bundle", po::value< std::string >( ), "Write the objects into a single archive next to the destination, instead of separate files (zip, tar or ff9pack)" );
+    options.add_options( )( "recursive", "Also extract the nested DB files, each one into a folder named after it" );
+    options.add_options( )( "pack", po::value< std::string >( ), "Read the input from this .ff9pack archive (the input is then the name of a file it holds)" );
+    options.add_options( )( "shard", po::value< std::string >( ), "Only extract this part of the objects (<index>/<count>, balanced by object size)" );
+    options.add_options( )( "merge", po::value< std::vector< std::string > >( ), "Merge the manifests written by the shards into --manifest, checking that every object has been extracted" );
+    options.add_options( )( "input", po::value< std::string >( )->required( ) );
+    options.add_options( )( "output", po::value< std::string >( )->required( ) );
 
-    std::cout << "   Data type    : 0x" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << dataType << " (" << extension << ")" << std::endl;
-    std::cout << "   Object count : "   << std::dec << objectCount << std::endl;
+    po::positional_options_description positional;
+    positional.add( "input", 1 );
+    positional.add( "output", 1 );
 
-    #define CEIL_FACTOR( N, F ) ( ( N ) % ( F ) == 0 ? ( N ) : ( N ) + ( F ) - ( ( N ) % ( F ) ) )
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
+    po::notify( vm );
 
-    int identifiersByteLength = CEIL_FACTOR( objectCount * 2, 4 );
-    int pointersByteLength = CEIL_FACTOR( ( objectCount + 1 ) * 4, 4 );
+    Log::start( vm );
 
-    MemoryRange identifiersRange( range );
-    identifiersRange.crop( MemoryRange::SeekCur, 0, identifiersByteLength );
+    Stats::start( );
 
-    MemoryRange pointersRange( range );
-    pointersRange.crop( MemoryRange::SeekCur, identifiersByteLength, pointersByteLength );
+    if ( vm.count( "input" ) && vm.count( "output" ) ) {
 
-    for ( unsigned long objectIndex = 0; objectIndex < objectCount; ++ objectIndex ) {
+        Path input( vm[ "input" ].as< std::string >( ) );
+        Path output( vm[ "output" ].as< std::string >( ) );
 
-        boost::uint32_t identifier, start, end;
+        // The DB can also be read from a pack, which only inflates the
+        // blocks it spans
 
-        identifiersRange.seek( MemoryRange::SeekSet, objectIndex * 2 );
-        parse( identifiersRange, qi::little_word, identifier );
+        std::unique_ptr< PackedFile > pack;
+        std::vector< boost::uint8_t > content;
+        MemoryRange range( content );
 
-        pointersRange.seek( MemoryRange::SeekSet, objectIndex * 4 );
-        parse( pointersRange, qi::little_dword, start );
-        parse( pointersRange, qi::little_dword, end );
-        start += identifiersByteLength + objectIndex * 4;
-        end += identifiersByteLength + objectIndex * 4 + 4;
+        if ( vm.count( "pack" ) ) {
+            pack.reset( new PackedFile( vm[ "pack" ].as< std::string >( ) ) );
+            PackedFile::Entry const * entry = pack->find( input.string( ) );
+            if ( ! entry )
+                throw std::runtime_error( "No such file in the pack : " + input.string( ) );
+            range = pack->map( * entry );
+        } else {
+            content = input.read( );
+            range = MemoryRange( content );
+        }
 
-        unsigned long size = end - start;
+        std::vector< Object > objects;
+        std::vector< std::string > objectPaths;
 
-        std::cout << std::endl;
-        std::cout << "    - Unpacking #" << objectIndex << std::endl;
-        std::cout << "      Identifier    : " << identifier << std::endl;
-        std::cout << "      Start pointer : " << start << std::endl;
-        std::cout << "      End pointer   : " << end << std::endl;
-        std::cout << "      Size          : " << size << " byte(s)" << std::endl;
+        // Every object is handed to the handler of its type as it is
+        // located ; with --recursive, the nested DBs are expanded in turn,
+        // their objects going into a folder named after them
 
-        MemoryRange dataRange( range );
-        dataRange.crop( MemoryRange::SeekCur, start, size );
+        FileTypes types;
 
-        std::stringstream pathBuilder;
-        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << objectIndex << extension;
+        auto locate = [ & ] ( DB const & db, std::string const & prefix ) {
+            for ( DB::Object const & dbObject : db ) {
+                Object object = { output, dbObject.range };
+                object.path.push( prefix + dbObject.path );
+                objects.push_back( object );
+                objectPaths.push_back( prefix + dbObject.path );
+                types.dispatch( prefix + dbObject.path, dbObject.range, dbObject.dataType );
+            }
+        };
 
-        Path subOutputPath( outputPath );
-        subOutputPath.push( pathBuilder.str( ) );
+        if ( vm.count( "recursive" ) ) {
+            types.on( FileTypes::DB, [ & ] ( FileTypes::Type const & type, std::string const & path, MemoryRange const & nestedRange ) {
 
-        subOutputPath.dump( dataRange );
+                // The nested DB file is still written as it is ; only its
+                // expansion is skipped when it cannot be parsed
 
-    }
-}
+                std::vector< Scan::Object > scanned;
+                Scan::Report report = Scan::db( nestedRange, scanned );
 
-////////////
-// 1 byte  : magic 0xDB
-// 1 byte  : pointers count
-// 2 bytes : padding (0x0000)
-//
-// Each pointer :
-//
-// 3 bytes : pointer
-// 1 byte  : data type
+                if ( report.status != Scan::Valid ) {
+                    LOG( Warning, path << " has not been expanded : " << Scan::describe( report.status ) << " (" << report.field << ")" );
+                    return ;
+                }
 
-void parseDB( MemoryRange range, Path outputPath )
-{
-    boost::uint32_t magicNumber;
-    boost::uint32_t pointerCount;
+                locate( DB( nestedRange ), path.substr( 0, path.size( ) - std::string( type.extension ).size( ) ) + "/" );
 
-    parse( range, qi::byte_, magicNumber );
-    if ( magicNumber != 0xDB )
-        throw std::runtime_error( "Bad magic number." );
+            } );
+        }
 
-    parse( range, qi::byte_, pointerCount );
-    parse( range, qi::word );
+        DB db( range );
 
-    std::cout << "Pointer count : " << pointerCount << std::endl;
+        LOG( Info, "Pointer count : " << db.packCount( ) );
 
-    for ( unsigned long pointerIndex = 0; pointerIndex < pointerCount; ++ pointerIndex ) {
+        locate( db, std::string( ) );
 
-        boost::uint32_t pointer;
-        parse( range, qi::little_dword, pointer );
-        pointer = pointer & 0xFFFFFF;
+        // Nothing is extracted when merging : the DB only tells which
+        // objects the shards should have recorded
 
-        MemoryRange subRange( range );
-        subRange.seek( MemoryRange::SeekCur, pointer - 4 );
+        if ( vm.count( "merge" ) ) {
 
-        std::stringstream pathBuilder;
-        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << pointerIndex;
+            if ( ! vm.count( "manifest" ) )
+                throw std::runtime_error( "--merge requires --manifest." );
 
-        Path subOutputPath( outputPath );
-        subOutputPath.push( pathBuilder.str( ) );
+            if ( vm.count( "shard" ) || vm.count( "incremental" ) || vm.count( "bundle" ) || vm.count( "verify" ) )
+                throw std::runtime_error( "--merge cannot be used with --shard, --incremental, --bundle or --verify." );
 
-        std::cout << std::endl << " - Extracting #" << pointerIndex << std::endl;
-        parsePack( subRange, subOutputPath );
+            Manifest merged( output.string( ) );
+            Shard::merge( vm[ "merge" ].as< std::vector< std::string > >( ), objectPaths, merged );
+            merged.write( vm[ "manifest" ].as< std::string >( ) );
 
-    }
-}
+            if ( vm.count( "stats" ) )
+                Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-extract-db" );
 
-int main( int argc, char ** argv )
-{
-    po::options_description options( "Allowed options" );
-    options.add_options( )( "input", po::value< std::string >( )->required( ) );
-    options.add_options( )( "output", po::value< std::string >( )->required( ) );
+            return 0;
 
-    po::positional_options_description positional;
-    positional.add( "input", 1 );
-    positional.add( "output", 1 );
+        }
 
-    po::variables_map vm;
-    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
-    po::notify( vm );
+        // Every shard computes the same partition from the pack tables
 
-    if ( vm.count( "input" ) && vm.count( "output" ) ) {
+        if ( vm.count( "shard" ) ) {
 
-        Path input( vm[ "input" ].as< std::string >( ) );
-        Path output( vm[ "output" ].as< std::string >( ) );
+            std::vector< unsigned long > sizes;
+            for ( Object const & object : objects )
+                sizes.push_back( object.range.size( ) );
 
-        auto content = input.read( );
-        MemoryRange range( content );
+            std::vector< Object > selection;
+            for ( unsigned long objectIndex : Shard( vm[ "shard" ].as< std::string >( ) ).select( sizes ) )
+                selection.push_back( objects[ objectIndex ] );
+
+            objects.swap( selection );
+
+        }
+
+        std::unique_ptr< Dedup > dedup;
+        std::unique_ptr< Manifest > manifest;
+
+        if ( vm.count( "dedup" ) ) {
+            std::string mode = vm[ "dedup" ].as< std::string >( );
+            if ( mode != "hardlink" && mode != "reflink" )
+                throw std::runtime_error( "Invalid deduplication mode (hardlink or reflink expected)." );
+            dedup.reset( new Dedup( mode == "reflink" ? Dedup::Reflink : Dedup::Hardlink ) );
+        }
+
+        bool incremental = vm.count( "incremental" );
+        bool verify = vm.count( "verify" );
+
+        if ( incremental && ! vm.count( "manifest" ) )
+            throw std::runtime_error( "--incremental requires --manifest." );
+
+        if ( verify && ( vm.count( "manifest" ) || vm.count( "bundle" ) || vm.count( "shard" ) ) )
+            throw std::runtime_error( "--verify cannot be used with --manifest, --incremental, --bundle or --shard." );
+
+        // When verifying, the manifest of the run is only kept in memory,
+        // to be compared with the expected one
+
+        if ( vm.count( "manifest" ) || verify )
+            manifest.reset( new Manifest( output.string( ) ) );
+
+        if ( incremental )
+            manifest->read( vm[ "manifest" ].as< std::string >( ) );
+
+        std::unique_ptr< Bundle > bundle;
+
+        if ( vm.count( "bundle" ) ) {
+            if ( dedup || manifest )
+                throw std::runtime_error( "--bundle cannot be used with --dedup, --manifest or --incremental." );
+            std::string format = vm[ "bundle" ].as< std::string >( );
+            bundle.reset( new Bundle( Bundle::format( format ), output.string( ) + "." + format, output.string( ) ) );
+            Path::bundle( bundle.get( ) );
+        }
+
+        // Objects are independent byte ranges of the same buffer
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        std::vector< boost::uint64_t > hashes( objects.size( ) );
+        std::vector< boost::uint64_t > inputs( objects.size( ) );
+        std::vector< std::string > originals( objects.size( ) );
+        std::vector< char > kept( objects.size( ) );
+
+        // An object file only depends on the object bytes ; it is kept when
+        // the previous run wrote it from the same bytes
 
-        parseDB( range, output );
+        if ( dedup || manifest ) {
+            pool.parallelFor( objects.size( ), [ & ] ( unsigned long objectIndex ) {
+                STATS_TIMER( timer, "hash" );
+                hashes[ objectIndex ] = Hash::compute( objects[ objectIndex ].range );
+                inputs[ objectIndex ] = Hash( ).update( std::string( TOOL_VERSION ) ).update( hashes[ objectIndex ] ).digest( );
+                kept[ objectIndex ] = incremental && manifest->keep( objects[ objectIndex ].path.string( ), inputs[ objectIndex ] );
+                STATS_BYTES( timer, objects[ objectIndex ].range.size( ) );
+            } );
+        }
 
-        return 0;
+        // The first object of each content is the one written, whatever
+        // the thread count ; the others are linked once it exists
+
+        if ( dedup ) {
+            for ( unsigned long objectIndex = 0; objectIndex < objects.size( ); ++ objectIndex ) {
+                originals[ objectIndex ] = dedup->claim( hashes[ objectIndex ], objects[ objectIndex ].range.size( ), objects[ objectIndex ].path.string( ) );
+                if ( kept[ objectIndex ] ) {
+                    originals[ objectIndex ].clear( );
+                }
+            }
+        }
+
+        // An archive is a single stream : its files are written in order,
+        // so that it does not depend on the thread count either
+
+        if ( bundle ) {
+            for ( Object const & object : objects ) {
+                object.path.dump( object.range );
+            }
+            bundle->close( );
+            Path::bundle( nullptr );
+        }
+
+        pool.parallelFor( bundle || verify ? 0 : objects.size( ), [ & ] ( unsigned long objectIndex ) {
+            if ( originals[ objectIndex ].empty( ) && ! kept[ objectIndex ] ) {
+                // The file may be a link left by a previous run, which
+                // must not be written through
+                if ( dedup || incremental )
+                    boost::filesystem::remove( objects[ objectIndex ].path.string( ) );
+                objects[ objectIndex ].path.dump( objects[ objectIndex ].range );
+            }
+        } );
+
+        STATS_COUNT( "unchanged", std::count( kept.begin( ), kept.end( ), 1 ) );
+
+        if ( dedup && ! verify ) {
+            pool.parallelFor( objects.size( ), [ & ] ( unsigned long objectIndex ) {
+                if ( ! originals[ objectIndex ].empty( ) ) {
+                    dedup->link( originals[ objectIndex ], objects[ objectIndex ].path.string( ) );
+                    STATS_COUNT( "duplicates", 1 );
+                    STATS_COUNT( "duplicate bytes", objects[ objectIndex ].range.size( ) );
+                }
+            } );
+        }
+
+        if ( manifest ) {
+            for ( unsigned long objectIndex = 0; objectIndex < objects.size( ); ++ objectIndex ) {
+                if ( ! kept[ objectIndex ] ) {
+                    manifest->add( objects[ objectIndex ].path.string( ), hashes[ objectIndex ], objects[ objectIndex ].range.size( ), inputs[ objectIndex ], originals[ objectIndex ] );
+                }
+            }
+        }
+
+        unsigned long differenceCount = 0;
+
+        if ( verify ) {
+            differenceCount = manifest->compare( vm[ "verify" ].as< std::string >( ) );
+            LOG( Info, differenceCount << " difference(s) with " << vm[ "verify" ].as< std::string >( ) );
+        } else if ( manifest ) {
+            manifest->write( vm[ "manifest" ].as< std::string >( ) );
+        }
+
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-extract-db" );
+
+        return differenceCount ? 1 : 0;
 
     } else {
 
@@ -1,184 +1,571 @@
+#include <boost/filesystem/operations.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/positional_options.hpp>
 #include <boost/program_options/variables_map.hpp>
-#include <boost/spirit/include/qi.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#include "bundle.hpp"
 #include "constants.hpp"
+#include "dedup.hpp"
+#include "filetypes.hpp"
+#include "hash.hpp"
+#include "image.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
 #include "memoryrange.hpp"
-#include "parse.hpp"
 #include "path.hpp"
+#include "shard.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "windowedfile.hpp"
 
 namespace po = boost::program_options;
-namespace qi = boost::spirit::qi;
 
-void suffixize( Path & outputPath, MemoryRange range )
-{
-    boost::uint32_t mime;
-    std::string suffix = ".raw";
+// Part of the inputs of every extracted file : bump it whenever a change
+// alters the output, so that --incremental does not keep the files written
+// by the previous versions.
+//
 
-    try {
+#define TOOL_VERSION "ffix-extract-img 1"
 
-        parse( range, qi::byte_, mime );
+// Whether the sector padding should be trimmed from the entries for which
+// the actual payload length is known.
+//
 
-        if ( mime == 0xDB )
-            suffix = ".ff9db";
+bool g_exactSize = false;
 
-    } catch ( ... ) {
+// Content tracking, both are optional : the first one turns the identical
+// entries into links, the second one lists the written files.
 
-    }
+std::unique_ptr< Dedup > g_dedup;
+std::unique_ptr< Manifest > g_manifest;
+
+// Whether the files recorded in the manifest of the previous run should be
+// left untouched when their inputs did not change.
+//
+
+bool g_incremental = false;
+
+// Part of the entries extracted by this run (--shard).
+//
+
+Shard g_shard;
+
+// Whether the entries are only hashed and recorded into g_manifest, to be
+// compared with an expected manifest (--verify), rather than written.
+//
+
+bool g_verify = false;
+
+// Names the entries after their type, which only their first bytes tell.
+
+void suffixize( Path & outputPath, MemoryRange range )
+{
+    FileTypes::Type const * type = FileTypes::classify( range );
 
-    outputPath.push( suffix );
+    outputPath.push( type ? type->extension : ".raw" );
+}
+
+// Payload length of an entry. The directory tables only give a number of
+// sectors, so the last one is usually padded ; the actual length can be
+// found for some file types. As the entries are streamed, the length is
+// computed in two steps : the entry head tells which region holds the
+// missing information (if any), and this region is then captured from the
+// chunks as they go by. The region always precedes the end of the payload,
+// so the chunks can be cropped before being written.
+
+struct LengthProbe {
+    unsigned long length;
+    unsigned long regionOffset;
+    unsigned long regionCaptured;
+    std::vector< boost::uint8_t > region;
+};
+
+static unsigned long readLittle( MemoryRange const & range, unsigned long offset, int byteCount )
+{
+    unsigned long value = 0;
+
+    for ( int t = byteCount; t --; )
+        value = ( value << 8 ) | range.begin( )[ offset + t ];
+
+    return value;
 }
 
 ////////////
-// 2 bytes : file ID
-// 2 bytes : - unknown -
-// 4 bytes : first sector
+// TIM : 4 bytes magic (0x10), 4 bytes flags, then the CLUT block (if flags
+// & 0x08) and the image block, each starting with its own byte length.
+//
+// DB : the pointer table gives the offset of each pack ; the last pack ends
+// where its last object does, according to its own pointer table.
 
-void parseFile( MemoryRange range, Path outputPath, unsigned long & endSector )
+void probeHead( LengthProbe & probe, MemoryRange const & head, unsigned long size )
 {
-    boost::uint32_t id;
-    boost::uint32_t beginSector;
+    probe.length = size;
+
+    FileTypes::Type const * type = FileTypes::classify( head );
+
+    if ( ! type )
+        return ;
+
+    if ( type->kind == FileTypes::TIM && head.size( ) >= 12 ) {
+
+        unsigned long flags = readLittle( head, 4, 4 );
+        unsigned long length = 8;
+
+        if ( flags & 0x08 )
+            length += readLittle( head, length, 4 );
+
+        if ( length + 4 <= head.size( ) ) {
+            length += readLittle( head, length, 4 );
+            probe.length = std::min( length, size );
+        }
+
+    } else if ( type->kind == FileTypes::DB && head.size( ) >= 4 ) {
 
-    parse( range, qi::little_word, id );
-    parse( range, qi::little_word );
-    parse( range, qi::little_dword, beginSector );
+        unsigned long pointerCount = head.begin( )[ 1 ];
 
-    unsigned long offset = beginSector * SECTOR_LENGTH;
-    unsigned long size = ( endSector - beginSector ) * SECTOR_LENGTH;
+        if ( 4 + pointerCount * 4 > head.size( ) )
+            return ;
 
-    MemoryRange dataRange( range );
-    dataRange.crop( MemoryRange::SeekSet, offset, size );
+        unsigned long lastPack = 0;
 
-    suffixize( outputPath, dataRange );
-    outputPath.dump( dataRange );
+        for ( unsigned long pointerIndex = 0; pointerIndex < pointerCount; ++ pointerIndex )
+            lastPack = std::max( lastPack, 4 + pointerIndex * 4 + ( readLittle( head, 4 + pointerIndex * 4, 4 ) & 0xFFFFFF ) );
 
-    endSector = beginSector;
+        // Pack header, identifiers and pointers, for the largest object count
+
+        if ( pointerCount && lastPack < size ) {
+            probe.regionOffset = lastPack;
+            probe.region.resize( std::min( size - lastPack, 4UL + 256 * 2 + 257 * 4 ) );
+        }
+
+    }
 }
 
-////////////
-// 2 bytes : fragment sector, or 0xFFFF
+void probeChunk( LengthProbe & probe, MemoryRange const & chunk, unsigned long chunkOffset )
+{
+    if ( probe.region.empty( ) )
+        return ;
+
+    unsigned long begin = std::max( chunkOffset, probe.regionOffset );
+    unsigned long end = std::min( chunkOffset + chunk.size( ), probe.regionOffset + probe.region.size( ) );
+
+    if ( begin < end ) {
+        std::copy( chunk.begin( ) + ( begin - chunkOffset ), chunk.begin( ) + ( end - chunkOffset ), probe.region.begin( ) + ( begin - probe.regionOffset ) );
+        probe.regionCaptured = end - probe.regionOffset;
+    }
+
+    // The pack header tells how much of the region is actually needed
+
+    if ( probe.regionCaptured < 4 )
+        return ;
+
+    MemoryRange pack( probe.region );
+
+    unsigned long objectCount = pack.begin( )[ 1 ];
+    unsigned long identifiersByteLength = ( objectCount * 2 + 3 ) / 4 * 4;
+    unsigned long lastPointer = 4 + identifiersByteLength + objectCount * 4;
 
-void parseFragment( MemoryRange range, Path outputPath, unsigned long baseSector, unsigned long & endSector )
+    if ( lastPointer + 4 > pack.size( ) ) {
+        probe.region.clear( );
+        return ;
+    }
+
+    if ( lastPointer + 4 > probe.regionCaptured )
+        return ;
+
+    unsigned long length = probe.regionOffset + lastPointer + ( objectCount ? readLittle( pack, lastPointer, 4 ) : 4 );
+
+    probe.length = std::min( length, probe.length );
+    probe.region.clear( );
+}
+
+// Zero runs are skipped rather than written, which leaves holes in the file
+// on the filesystems supporting them.
+
+void writeSparse( std::ofstream & output, MemoryRange const & chunk )
 {
-    boost::uint32_t fragmentSector;
+    boost::uint8_t const * current = chunk.begin( );
 
-    parse( range, qi::little_word, fragmentSector );
+    while ( current < chunk.end( ) ) {
 
-    if ( fragmentSector == 0xFFFF ) return ;
+        boost::uint8_t const * blockEnd = std::min( current + SECTOR_LENGTH, chunk.end( ) );
 
-    boost::uint32_t beginSector = baseSector + fragmentSector;
+        if ( std::find_if( current, blockEnd, [ ] ( boost::uint8_t byte ) { return byte != 0; } ) == blockEnd ) {
+            output.seekp( blockEnd - current, std::ios_base::cur );
+        } else {
+            output.write( reinterpret_cast< char const * >( current ), blockEnd - current );
+        }
 
-    unsigned long offset = beginSector * SECTOR_LENGTH;
-    unsigned long size = ( endSector - beginSector ) * SECTOR_LENGTH;
+        current = blockEnd;
 
-    MemoryRange dataRange( range );
-    dataRange.crop( MemoryRange::SeekSet, offset, size );
+    }
+}
 
-    suffixize( outputPath, dataRange );
-    outputPath.dump( dataRange );
+// Hash of everything an entry file is computed from.
 
-    endSector = beginSector;
+boost::uint64_t entryInputs( boost::uint64_t hash, unsigned long size )
+{
+    return Hash( ).update( std::string( TOOL_VERSION ) ).update( static_cast< boost::uint64_t >( g_exactSize ) ).update( hash ).update( size ).digest( );
 }
 
-////////////
-// 4 bytes : directory type [0x02 = file, 0x03 = fragment]
-// 4 bytes : entries count
-// 4 bytes : entries list sector
-// 4 bytes : base sector
+// The hash of the entry is given when it has been computed beforehand
+// (see hashEntries), and is computed along the way otherwise.
 
-void parseContainer( MemoryRange range, Path outputPath, unsigned long & endSector )
+void extractEntry( WindowedFile & image, Image::Entry const & entry, Path const & root, boost::uint64_t const * precomputed )
 {
-    boost::uint32_t type;
-    boost::uint32_t entryCount;
-    boost::uint32_t entryListSector;
-    boost::uint32_t baseSector;
+    std::ostringstream stageBuilder;
+    stageBuilder << "container " << std::setfill( '0' ) << std::setw( 2 ) << entry.containerIndex;
+    STATS_TIMER_DYNAMIC( timer, stageBuilder.str( ) );
 
-    parse( range, qi::little_dword, type );
-    parse( range, qi::little_dword, entryCount );
-    parse( range, qi::little_dword, entryListSector );
-    parse( range, qi::little_dword, baseSector );
+    unsigned long offset = entry.beginSector * SECTOR_LENGTH;
+    unsigned long size = ( entry.endSector - entry.beginSector ) * SECTOR_LENGTH;
 
-    std::cout << "  Container type : 0x" << std::hex << std::setfill( '0' ) << std::setw( 2 ) << type << std::endl;
-    std::cout << "  Entry count    : "   << std::dec << entryCount << std::endl;
+    Path outputPath( root );
+    outputPath.push( entry.path );
+    std::ofstream output;
 
-    range.seek( MemoryRange::SeekSet, entryListSector * SECTOR_LENGTH );
+    if ( size == 0 ) {
 
-    for ( unsigned long entryIndex = entryCount; entryIndex --;  ) {
+        suffixize( outputPath, MemoryRange( nullptr, nullptr ) );
 
-        MemoryRange subRange( range );
+        boost::uint64_t hash = Hash( ).digest( );
 
-        std::stringstream pathBuilder;
-        pathBuilder << std::setfill( '0' ) << std::setw( 3 ) << entryIndex;
+        if ( g_incremental && g_manifest->keep( outputPath.string( ), entryInputs( hash, 0 ) ) )
+            return ;
 
-        Path subOutputPath( outputPath );
-        subOutputPath.push( pathBuilder.str( ) );
+        outputPath.dump( "" );
 
-        switch ( type ) {
+        if ( g_manifest )
+            g_manifest->add( outputPath.string( ), hash, 0, entryInputs( hash, 0 ) );
 
-            case 0x02:
-                subRange.seek( MemoryRange::SeekCur, 8 * entryIndex );
-                parseFile( subRange, subOutputPath, endSector );
-            break;
+        return ;
 
-            case 0x03:
-                subRange.seek( MemoryRange::SeekCur, 2 * entryIndex );
-                parseFragment( subRange, subOutputPath, baseSector, endSector );
-            break;
+    }
+
+    LengthProbe probe = { size, 0, 0, std::vector< boost::uint8_t >( ) };
+    unsigned long chunkOffset = 0;
+
+    Hash hash;
+
+    Bundle * bundle = Path::bundle( );
+    bool isOpen = false;
+
+    auto write = [ & ] ( MemoryRange const & chunk ) {
+
+        if ( ! isOpen ) {
+            suffixize( outputPath, chunk );
+            if ( bundle ) {
+                bundle->begin( outputPath.string( ) );
+            } else {
+                // The file may be a link left by a previous run, which
+                // must not be written through
+                if ( g_dedup || g_incremental )
+                    boost::filesystem::remove( outputPath.string( ) );
+                outputPath.open( output );
+            }
+            if ( g_exactSize ) {
+                probeHead( probe, chunk, size );
+            }
+            isOpen = true;
+        }
+
+        if ( g_exactSize ) {
+            probeChunk( probe, chunk, chunkOffset );
+        }
+
+        // Nothing is written past the payload, once its length is known
+
+        unsigned long payloadSize = chunkOffset < probe.length ? std::min( chunk.size( ), probe.length - chunkOffset ) : 0;
+        MemoryRange payload( chunk.begin( ), chunk.begin( ) + payloadSize );
 
+        if ( bundle ) {
+            bundle->write( reinterpret_cast< char const * >( payload.begin( ) ), payload.size( ) );
+        } else if ( g_exactSize ) {
+            writeSparse( output, payload );
+        } else {
+            output.write( reinterpret_cast< char const * >( payload.begin( ) ), payload.size( ) );
         }
 
+        chunkOffset += chunk.size( );
+
+    };
+
+    // When needed, the entries are hashed before anything is written, so
+    // that their duplicates, or the entries which did not change since the
+    // previous run, are never written at all. This is free for the entries
+    // fitting in a window ; the larger ones have to be read twice, unless
+    // the input cannot seek (they are then hashed while being streamed,
+    // and replaced by a link afterward).
+
+    MemoryRange range( nullptr, nullptr );
+    std::vector< boost::uint8_t > head;
+    bool isHashed = false;
+
+    auto digest = [ & ] ( ) {
+        return precomputed ? * precomputed : hash.digest( );
+    };
+
+    if ( precomputed ) {
+
+        range = image.map( offset, size );
+
+        head.assign( range.begin( ), range.begin( ) + std::min< unsigned long >( range.size( ), FILE_TYPES_HEAD_LENGTH ) );
+        isHashed = true;
+
+    } else if ( ( g_dedup || g_incremental ) && size <= image.windowSize( ) ) {
+
+        range = image.map( offset, size );
+        hash.update( range );
+
+        head.assign( range.begin( ), range.begin( ) + std::min< unsigned long >( range.size( ), FILE_TYPES_HEAD_LENGTH ) );
+        isHashed = true;
+
+    } else if ( g_incremental && ! image.isSequential( ) ) {
+
+        image.stream( offset, size, [ & ] ( MemoryRange const & chunk ) {
+            if ( head.empty( ) )
+                head.assign( chunk.begin( ), chunk.begin( ) + std::min< unsigned long >( chunk.size( ), FILE_TYPES_HEAD_LENGTH ) );
+            hash.update( chunk );
+        } );
+
+        isHashed = true;
+
     }
 
-    if ( type == 0x04 ) {
-        endSector = ( range.end( ) - range.begin( ) ) / SECTOR_LENGTH;
+    if ( isHashed ) {
+
+        Path finalPath( outputPath );
+        suffixize( finalPath, MemoryRange( head ) );
+
+        if ( g_incremental && g_manifest->keep( finalPath.string( ), entryInputs( digest( ), size ) ) ) {
+
+            if ( g_dedup )
+                g_dedup->claim( digest( ), size, finalPath.string( ) );
+
+            STATS_COUNT( "entries", 1 );
+            STATS_COUNT( "unchanged", 1 );
+            return ;
+
+        }
+
+        std::string original = g_dedup ? g_dedup->claim( digest( ), size, finalPath.string( ) ) : std::string( );
+
+        if ( ! original.empty( ) ) {
+
+            g_dedup->link( original, finalPath.string( ) );
+
+            if ( g_manifest )
+                g_manifest->add( finalPath.string( ), digest( ), boost::filesystem::file_size( original ), entryInputs( digest( ), size ), original );
+
+            STATS_COUNT( "entries", 1 );
+            STATS_COUNT( "duplicates", 1 );
+            STATS_COUNT( "duplicate bytes", size );
+            return ;
+
+        }
+
+        if ( range.size( ) ) {
+            write( range );
+        } else {
+            image.stream( offset, size, write );
+        }
+
     } else {
-        endSector = baseSector;
+
+        image.stream( offset, size, [ & ] ( MemoryRange const & chunk ) {
+            if ( g_dedup || g_manifest )
+                hash.update( chunk );
+            write( chunk );
+        } );
+
+    }
+
+    if ( bundle ) {
+
+        bundle->end( );
+
+    } else {
+
+        output.close( );
+
+        // Sets the final length : drops the padding left by a payload
+        // shorter than what it was written from, and materializes the
+        // trailing holes left by writeSparse
+
+        if ( g_exactSize ) {
+            boost::filesystem::resize_file( outputPath.string( ), std::min( probe.length, chunkOffset ) );
+        }
+
+    }
+
+    std::string original;
+
+    if ( g_dedup && ! isHashed ) {
+        original = g_dedup->claim( digest( ), size, outputPath.string( ) );
+        if ( ! original.empty( ) ) {
+            g_dedup->link( original, outputPath.string( ) );
+            STATS_COUNT( "duplicates", 1 );
+            STATS_COUNT( "duplicate bytes", size );
+        }
+    }
+
+    if ( g_manifest )
+        g_manifest->add( outputPath.string( ), digest( ), std::min( probe.length, chunkOffset ), entryInputs( digest( ), size ), original );
+
+    STATS_BYTES( timer, size );
+    STATS_COUNT( "entries", 1 );
+    STATS_COUNT( "bytes", std::min( probe.length, chunkOffset ) );
+
+    // The bundle counts the files it receives itself
+
+    if ( ! bundle ) {
+        STATS_COUNT( "files written", 1 );
     }
 }
 
-////////////
-// 4 bytes : magic 0x46463920
-// 4 bytes : - unknown -
-// 4 bytes : directories count
-// 4 bytes : - unknown -
+// Records what extractEntry would write, without writing anything : the
+// entry is named and measured as it would be, and compared afterward.
 
-void parseImage( MemoryRange range, Path outputPath )
+void verifyEntry( WindowedFile & image, Image::Entry const & entry, Path const & root, boost::uint64_t const * precomputed )
 {
-    boost::uint32_t magicNumber;
-    boost::uint32_t containerCount;
+    STATS_TIMER( timer, "verify" );
+
+    unsigned long offset = entry.beginSector * SECTOR_LENGTH;
+    unsigned long size = ( entry.endSector - entry.beginSector ) * SECTOR_LENGTH;
+
+    Path outputPath( root );
+    outputPath.push( entry.path );
+
+    LengthProbe probe = { size, 0, 0, std::vector< boost::uint8_t >( ) };
+    unsigned long chunkOffset = 0;
+
+    Hash hash;
+
+    if ( size == 0 )
+        suffixize( outputPath, MemoryRange( nullptr, nullptr ) );
 
-    parse( range, qi::big_dword, magicNumber );
-    if ( magicNumber != 0x46463920 )
-        throw std::runtime_error( "Bad magic number." );
+    image.stream( offset, size, [ & ] ( MemoryRange const & chunk ) {
 
-    parse( range, qi::little_dword );
-    parse( range, qi::little_dword, containerCount );
-    parse( range, qi::little_dword );
+        if ( chunkOffset == 0 ) {
+            suffixize( outputPath, chunk );
+            if ( g_exactSize ) {
+                probeHead( probe, chunk, size );
+            }
+        }
+
+        if ( g_exactSize ) {
+            probeChunk( probe, chunk, chunkOffset );
+        }
+
+        if ( ! precomputed )
+            hash.update( chunk );
+
+        chunkOffset += chunk.size( );
+
+    } );
+
+    boost::uint64_t digest = precomputed ? * precomputed : hash.digest( );
+    unsigned long length = std::min( probe.length, chunkOffset );
 
-    unsigned long endSector;
+    std::string original = g_dedup && size ? g_dedup->claim( digest, size, outputPath.string( ) ) : std::string( );
+
+    g_manifest->add( outputPath.string( ), digest, length, entryInputs( digest, size ), original );
+
+    STATS_BYTES( timer, size );
+    STATS_COUNT( "entries", 1 );
+}
+
+// When the whole image fits in a window, every entry can be mapped at once,
+// and they are all hashed concurrently before anything is written (the
+// hash is then the only part of the work which depends on the content).
+// Returns nothing otherwise : the entries are hashed as they are streamed.
+
+std::vector< boost::uint64_t > hashEntries( WindowedFile & image, std::vector< Image::Entry > const & entries, ThreadPool & pool )
+{
+    std::vector< boost::uint64_t > hashes;
 
-    std::cout << "Container count : " << containerCount << std::endl;
+    if ( image.isSequential( ) || image.size( ) > image.windowSize( ) || ! ( g_dedup || g_manifest ) )
+        return hashes;
 
-    for ( unsigned long containerIndex = containerCount; containerIndex --;  ) {
+    MemoryRange whole = image.map( 0, image.size( ) );
+
+    hashes.resize( entries.size( ) );
+
+    pool.parallelFor( entries.size( ), [ & ] ( unsigned long entryIndex ) {
+
+        STATS_TIMER( timer, "hash" );
+
+        unsigned long offset = entries[ entryIndex ].beginSector * SECTOR_LENGTH;
+        unsigned long size = ( entries[ entryIndex ].endSector - entries[ entryIndex ].beginSector ) * SECTOR_LENGTH;
+
+        if ( offset > whole.size( ) || size > whole.size( ) - offset )
+            throw std::out_of_range( "Invalid map (outside of the file)" );
+
+        hashes[ entryIndex ] = Hash::compute( MemoryRange( whole.begin( ) + offset, whole.begin( ) + offset + size ) );
+
+        STATS_BYTES( timer, size );
+
+    } );
+
+    return hashes;
+}
+
+// Extracts a whole image. The entries identical to an entry of an image
+// extracted before become links as well.
+
+void extractImage( std::string const & input, Path const & output, unsigned long maxMemory, bool sequential, ThreadPool & pool )
+{
+    WindowedFile image( input, maxMemory );
+
+    std::vector< Image::Entry > entries = Image( image ).entries( );
+
+    LOG( Info, "Entry count : " << entries.size( ) );
+
+    // Every shard computes the same partition from the directory table
+
+    if ( g_shard.count( ) > 1 ) {
+
+        std::vector< unsigned long > sizes;
+        for ( Image::Entry const & entry : entries )
+            sizes.push_back( ( entry.endSector - entry.beginSector ) * SECTOR_LENGTH );
+
+        std::vector< Image::Entry > selection;
+        for ( unsigned long entryIndex : g_shard.select( sizes ) )
+            selection.push_back( entries[ entryIndex ] );
+
+        entries.swap( selection );
+
+    }
+
+    // Sector order turns the extraction into a single front to back pass
+
+    if ( sequential || image.isSequential( ) ) {
+        std::stable_sort( entries.begin( ), entries.end( ), [ ] ( Image::Entry const & a, Image::Entry const & b ) {
+            return a.beginSector < b.beginSector;
+        } );
+    }
 
-        MemoryRange subRange( range );
-        subRange.seek( MemoryRange::SeekCur, 16 * containerIndex );
+    std::vector< boost::uint64_t > hashes = hashEntries( image, entries, pool );
 
-        std::stringstream pathBuilder;
-        pathBuilder << std::setfill( '0' ) << std::setw( 2 ) << containerIndex;
+    for ( unsigned long entryIndex = 0; entryIndex < entries.size( ); ++ entryIndex ) {
 
-        Path subOutputPath( outputPath );
-        subOutputPath.push( pathBuilder.str( ) );
+        boost::uint64_t const * precomputed = hashes.empty( ) ? nullptr : & hashes[ entryIndex ];
 
-        std::cout << std::endl << "* Extracting #" << containerIndex << std::endl;
-        parseContainer( subRange, subOutputPath, endSector );
+        if ( g_verify ) {
+            verifyEntry( image, entries[ entryIndex ], output, precomputed );
+        } else {
+            extractEntry( image, entries[ entryIndex ], output, precomputed );
+        }
 
     }
 }
@@ -186,32 +573,187 @@ void parseImage( MemoryRange range, Path outputPath )
 int main( int argc, char ** argv )
 {
     po::options_description options( "Allowed options" );
-    options.add_options( )( "input", po::value< std::string >( )->required( ) );
-    options.add_options( )( "output", po::value< std::string >( )->required( ) );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "max-memory", po::value< unsigned long >( )->default_value( 0, "unlimited" ), "Memory budget for the image buffers, in bytes" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count (for hashing the entries)" );
+    options.add_options( )( "sequential", "Extract the entries in disk order (implied when the input is a pipe)" );
+    options.add_options( )( "exact-size", "Trim the sector padding of the entries whose length can be computed (DB, TIM), and write zero runs as sparse holes" );
+    options.add_options( )( "dedup", po::value< std::string >( ), "Turn the copies of identical entries into links to the first one (hardlink or reflink)" );
+    options.add_options( )( "manifest", po::value< std::string >( ), "Write the list of the extracted files, with their content hash, to this file" );
+    options.add_options( )( "verify", po::value< std::string >( ), "Compare the entries with this manifest (as written by --manifest) and report the differences, without writing any file" );
+    options.add_options( )( "incremental", "Leave untouched the files whose inputs did not change since the run which wrote the manifest (requires --manifest)" );
+    options.add_options( )( "bundle", po::value< std::string >( ), "Write the entries into a single archive next to the destination, instead of separate files (zip, tar or ff9pack)" );
+    options.add_options( )( "shard", po::value< std::string >( ), "Only extract this part of the entries (<index>/<count>, balanced by entry size)" );
+    options.add_options( )( "merge", po::value< std::vector< std::string > >( ), "Merge the manifests written by the shards into --manifest, checking that every entry has been extracted" );
+    options.add_options( )( "paths", po::value< std::vector< std::string > >( ) );
 
     po::positional_options_description positional;
-    positional.add( "input", 1 );
-    positional.add( "output", 1 );
+    positional.add( "paths", -1 );
 
     po::variables_map vm;
     po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
     po::notify( vm );
 
-    if ( vm.count( "input" ) && vm.count( "output" ) ) {
+    Log::start( vm );
+
+    Stats::start( );
+
+    g_exactSize = vm.count( "exact-size" );
+    g_incremental = vm.count( "incremental" );
+
+    if ( vm.count( "dedup" ) ) {
+        std::string mode = vm[ "dedup" ].as< std::string >( );
+        if ( mode != "hardlink" && mode != "reflink" )
+            throw std::runtime_error( "Invalid deduplication mode (hardlink or reflink expected)." );
+        g_dedup.reset( new Dedup( mode == "reflink" ? Dedup::Reflink : Dedup::Hardlink ) );
+    }
+
+    std::unique_ptr< Bundle > bundle;
+
+    if ( vm.count( "bundle" ) ) {
+        if ( g_dedup || vm.count( "manifest" ) || g_incremental )
+            throw std::runtime_error( "--bundle cannot be used with --dedup, --manifest or --incremental." );
+    }
+
+    if ( vm.count( "shard" ) )
+        g_shard = Shard( vm[ "shard" ].as< std::string >( ) );
+
+    if ( vm.count( "merge" ) ) {
+        if ( ! vm.count( "manifest" ) )
+            throw std::runtime_error( "--merge requires --manifest." );
+        if ( vm.count( "shard" ) || g_incremental || vm.count( "bundle" ) || vm.count( "verify" ) )
+            throw std::runtime_error( "--merge cannot be used with --shard, --incremental, --bundle or --verify." );
+    }
+
+    g_verify = vm.count( "verify" );
+
+    if ( g_verify && ( vm.count( "manifest" ) || g_incremental || vm.count( "bundle" ) || vm.count( "shard" ) ) )
+        throw std::runtime_error( "--verify cannot be used with --manifest, --incremental, --bundle or --shard." );
+
+    std::vector< std::string > paths;
+
+    if ( vm.count( "paths" ) )
+        paths = vm[ "paths" ].as< std::vector< std::string > >( );
+
+    if ( paths.size( ) >= 2 ) {
+
+        Path output( paths.back( ) );
+        paths.pop_back( );
+
+        unsigned long maxMemory = vm[ "max-memory" ].as< unsigned long >( );
+        bool sequential = vm.count( "sequential" );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        unsigned long differenceCount = 0;
+
+        if ( paths.size( ) == 1 && vm.count( "merge" ) ) {
+
+            // Nothing is extracted : the directory table only tells which
+            // entries the shards should have recorded
+
+            WindowedFile file( paths[ 0 ], maxMemory );
+            Image image( file );
+
+            std::vector< std::string > entryPaths;
+            for ( Image::Entry const & entry : image.entries( ) )
+                entryPaths.push_back( entry.path );
+
+            Manifest merged( output.string( ) );
+            Shard::merge( vm[ "merge" ].as< std::vector< std::string > >( ), entryPaths, merged );
+            merged.write( vm[ "manifest" ].as< std::string >( ) );
+
+        } else if ( paths.size( ) == 1 ) {
 
-        Path input( vm[ "input" ].as< std::string >( ) );
-        Path output( vm[ "output" ].as< std::string >( ) );
+            if ( g_incremental && ! vm.count( "manifest" ) )
+                throw std::runtime_error( "--incremental requires --manifest." );
 
-        auto content = input.read( );
-        MemoryRange range( content );
+            // When verifying, the manifest of the run is only kept in
+            // memory, to be compared with the expected one
+
+            if ( vm.count( "manifest" ) || g_verify )
+                g_manifest.reset( new Manifest( output.string( ) ) );
+
+            if ( g_incremental )
+                g_manifest->read( vm[ "manifest" ].as< std::string >( ) );
+
+            if ( vm.count( "bundle" ) ) {
+                std::string format = vm[ "bundle" ].as< std::string >( );
+                bundle.reset( new Bundle( Bundle::format( format ), output.string( ) + "." + format, output.string( ) ) );
+                Path::bundle( bundle.get( ) );
+            }
+
+            extractImage( paths[ 0 ], output, maxMemory, sequential, pool );
+
+            // Only the entries go into the archive : the stats are written
+            // next to it
+
+            if ( bundle ) {
+                bundle->close( );
+                Path::bundle( nullptr );
+            }
+
+            if ( g_verify ) {
+                differenceCount = g_manifest->compare( vm[ "verify" ].as< std::string >( ) );
+                LOG( Info, differenceCount << " difference(s) with " << vm[ "verify" ].as< std::string >( ) );
+            } else if ( g_manifest ) {
+                g_manifest->write( vm[ "manifest" ].as< std::string >( ) );
+            }
+
+        } else {
+
+            // Each disc gets its own tree, and a manifest listing it ; the
+            // entries shared with a previous disc are only stored once
+
+            if ( vm.count( "manifest" ) )
+                throw std::runtime_error( "--manifest cannot be used with several images (each disc gets its own manifest)." );
+
+            if ( vm.count( "bundle" ) )
+                throw std::runtime_error( "--bundle cannot be used with several images (the discs share their identical entries through links)." );
+
+            if ( vm.count( "shard" ) || vm.count( "merge" ) || g_verify )
+                throw std::runtime_error( "--shard, --merge and --verify cannot be used with several images." );
+
+            if ( ! g_dedup )
+                g_dedup.reset( new Dedup( Dedup::Hardlink ) );
+
+            for ( unsigned long discIndex = 0; discIndex < paths.size( ); ++ discIndex ) {
+
+                std::ostringstream discBuilder;
+                discBuilder << "disc" << discIndex + 1;
+
+                Path discOutput( output );
+                discOutput.push( discBuilder.str( ) );
+
+                LOG( Info, "Disc " << discIndex + 1 << " : " << paths[ discIndex ] );
+
+                Path manifestPath( output );
+                manifestPath.push( discBuilder.str( ) ).push( ".manifest" );
+
+                g_manifest.reset( new Manifest( output.string( ) ) );
+
+                if ( g_incremental )
+                    g_manifest->read( manifestPath.string( ) );
+
+                extractImage( paths[ discIndex ], discOutput, maxMemory, sequential, pool );
+
+                g_manifest->write( manifestPath.string( ) );
+
+            }
+
+        }
 
-        parseImage( range, output );
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-extract-img" );
 
-        return 0;
+        return differenceCount ? 1 : 0;
 
     } else {
 
-        std::cerr << "Usage: " << argv[ 0 ] << " [options] <FF9.IMG path> <destination path>" << std::endl;
+        std::cerr << "Usage: " << argv[ 0 ] << " [options] <FF9.IMG path, or - for stdin> [<FF9.IMG path>...] <destination path>" << std::endl;
         std::cerr << options;
 
         return -1;
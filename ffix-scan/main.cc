@@ -0,0 +1,211 @@
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "constants.hpp"
+#include "db.hpp"
+#include "filetypes.hpp"
+#include "image.hpp"
+#include "log.hpp"
+#include "memoryrange.hpp"
+#include "scan.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "windowedfile.hpp"
+
+namespace po = boost::program_options;
+
+// What was found in an image entry and in the files nested in it. Each
+// entry is scanned by a single task ; the reports are only printed once
+// every entry has been scanned, in directory order.
+
+struct EntryReport {
+    std::string path;
+    unsigned long fileCount;
+    unsigned long checkedCount;
+    std::vector< std::string > problems;
+};
+
+// Checks a file according to its type, then the objects it holds (for the
+// DB files). The files of the other types are only counted.
+
+void scanFile( MemoryRange const & range, std::string const & path, EntryReport & report )
+{
+    STATS_TIMER( timer, "scan" );
+
+    Scan::Report result = { Scan::Valid, nullptr, 0 };
+    std::vector< Scan::Object > objects;
+
+    ++ report.fileCount;
+
+    std::string::size_type dot = path.rfind( '.' );
+    std::string extension = dot == std::string::npos ? std::string( ) : path.substr( dot );
+
+    if ( extension == ".ff9db" ) {
+        result = Scan::db( range, objects );
+    } else if ( extension == ".ff9bs" ) {
+        result = Scan::battleScene( range );
+    } else if ( extension == ".tim" ) {
+        result = Scan::tim( range );
+    } else {
+        return ;
+    }
+
+    ++ report.checkedCount;
+
+    STATS_BYTES( timer, range.size( ) );
+    STATS_COUNT( "files checked", 1 );
+
+    if ( result.status != Scan::Valid ) {
+
+        std::ostringstream problemBuilder;
+        problemBuilder << path << " : " << Scan::describe( result.status ) << " (" << result.field << " at 0x" << std::hex << result.offset << ")";
+        report.problems.push_back( problemBuilder.str( ) );
+
+        STATS_COUNT( "problems", 1 );
+        return ;
+
+    }
+
+    LOG( Verbose, path << " : valid" );
+
+    for ( Scan::Object const & object : objects ) {
+
+        std::ostringstream pathBuilder;
+        pathBuilder << path.substr( 0, dot ) << "/" << std::setfill( '0' ) << std::setw( 3 ) << object.packIndex << "/" << std::setw( 3 ) << object.objectIndex << DB::extension( object.dataType );
+
+        scanFile( object.range, pathBuilder.str( ), report );
+
+    }
+}
+
+// Compares the "<container index>/<entry index>" paths as numbers : the
+// indices are padded to a minimal width only.
+
+bool directoryOrder( EntryReport const & first, EntryReport const & second )
+{
+    char * firstEntry, * secondEntry;
+
+    unsigned long firstContainer = std::strtoul( first.path.c_str( ), & firstEntry, 10 );
+    unsigned long secondContainer = std::strtoul( second.path.c_str( ), & secondEntry, 10 );
+
+    if ( firstContainer != secondContainer )
+        return firstContainer < secondContainer;
+
+    return std::strtoul( firstEntry + 1, nullptr, 10 ) < std::strtoul( secondEntry + 1, nullptr, 10 );
+}
+
+int main( int argc, char ** argv )
+{
+    po::options_description options( "Allowed options" );
+    options.add_options( )( "quiet", "Only log warnings and errors" );
+    options.add_options( )( "verbose", "Log every processed item" );
+    options.add_options( )( "stats", po::value< std::string >( ), "Write timings and counters to this JSON file" );
+    options.add_options( )( "log-format", po::value< std::string >( )->default_value( "text" ), "Log format (text or jsonl)" );
+    options.add_options( )( "jobs", po::value< unsigned int >( )->default_value( 0, "all cores" ), "Worker thread count" );
+    options.add_options( )( "input", po::value< std::string >( )->required( ) );
+
+    po::positional_options_description positional;
+    positional.add( "input", 1 );
+
+    po::variables_map vm;
+    po::store( po::command_line_parser( argc, argv ).options( options ).positional( positional ).run( ), vm );
+    po::notify( vm );
+
+    Log::start( vm );
+
+    Stats::start( );
+
+    if ( vm.count( "input" ) ) {
+
+        // The whole image is loaded in a single window, so the entries are
+        // plain views of it, which the workers can read concurrently
+
+        WindowedFile file( vm[ "input" ].as< std::string >( ) );
+
+        if ( file.isSequential( ) )
+            throw std::runtime_error( "The scan needs a regular file as input." );
+
+        MemoryRange whole = file.map( 0, file.size( ) );
+
+        Scan::Report result = Scan::image( whole );
+
+        if ( result.status != Scan::Valid ) {
+            LOG( Error, "Image : " << Scan::describe( result.status ) << " (" << result.field << " at 0x" << std::hex << result.offset << ")" );
+            return 1;
+        }
+
+        Image image( file );
+        std::vector< Image::Entry > const & entries = image.entries( );
+
+        std::vector< EntryReport > reports( entries.size( ) );
+
+        ThreadPool pool( vm[ "jobs" ].as< unsigned int >( ) );
+
+        pool.parallelFor( entries.size( ), [ & ] ( unsigned long entryIndex ) {
+
+            Image::Entry const & entry = entries[ entryIndex ];
+            MemoryRange range( whole.begin( ) + entry.beginSector * SECTOR_LENGTH, whole.begin( ) + entry.endSector * SECTOR_LENGTH );
+
+            // Same naming as ffix-extract-img
+
+            FileTypes::Type const * type = FileTypes::classify( range );
+
+            EntryReport & report = reports[ entryIndex ];
+            report.path = entry.path + ( type ? type->extension : ".raw" );
+
+            scanFile( range, report.path, report );
+
+            STATS_COUNT( "entries", 1 );
+
+        } );
+
+        // The image lists its entries from the last container to the first
+
+        std::sort( reports.begin( ), reports.end( ), & directoryOrder );
+
+        unsigned long fileCount = 0, checkedCount = 0, problemCount = 0;
+
+        for ( EntryReport const & report : reports ) {
+
+            if ( report.problems.empty( ) ) {
+                LOG( Info, report.path << " : ok (" << report.fileCount << " file(s), " << report.checkedCount << " checked)" );
+            } else {
+                LOG( Error, report.path << " : " << report.problems.size( ) << " problem(s) (" << report.fileCount << " file(s), " << report.checkedCount << " checked)" );
+                for ( std::string const & problem : report.problems ) {
+                    LOG( Error, "  " << problem );
+                }
+            }
+
+            fileCount += report.fileCount;
+            checkedCount += report.checkedCount;
+            problemCount += report.problems.size( );
+
+        }
+
+        LOG( Info, "Scanned " << reports.size( ) << " entries, " << fileCount << " file(s) (" << checkedCount << " checked) : " << problemCount << " problem(s)" );
+
+        if ( vm.count( "stats" ) )
+            Stats::write( vm[ "stats" ].as< std::string >( ), "ffix-scan" );
+
+        return problemCount ? 1 : 0;
+
+    } else {
+
+        std::cerr << "Usage: " << argv[ 0 ] << " [options] <FF9.IMG path>" << std::endl;
+        std::cerr << options;
+
+        return -1;
+
+    }
+}